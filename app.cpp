@@ -6,81 +6,46 @@
 #include <vector>
 #include <set>
 #include <optional>
-#include <fstream>
-#include <filesystem>
-#include <filesystem>
-
-
-#if defined(_WIN32)
-#define NOMINMAX
-#include <windows.h>
-std::string getExecutablePath() {
-	char path[MAX_PATH];
-	GetModuleFileNameA(NULL, path, MAX_PATH);
-	return std::string(path);
-}
-#elif defined(__linux__)
-#include <unistd.h>
-#include <limits.h>
-std::string getExecutablePath() {
-	char path[PATH_MAX];
-	ssize_t count = readlink("/proc/self/exe", path, PATH_MAX);
-	return std::string(path, (count > 0) ? count : 0);
-}
-#elif defined(__APPLE__)
-#include <mach-o/dyld.h>
-std::string getExecutablePath() {
-	char path[PATH_MAX];
-	uint32_t size = sizeof(path);
-	if (_NSGetExecutablePath(path, &size) == 0) {
-		return std::string(path);
-	}
-	return "";
-}
-#endif
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/constants.hpp>
 
-static std::filesystem::path getExecutableDir() {
-	return std::filesystem::path(getExecutablePath()).parent_path();
-}
+#include "shader.h"
+#include "device_support.h"
+
+//TRIANGLE_SCALE of vertex.vert
+static const float TriangleScale = 1.0f;
 
-Application::Application()
+Application::Application(uint32_t windowCount)
+	: outputs(std::max(windowCount, 1u))
 {
 
 #ifdef DEBUG_MODE
 	std::cout << "Create a graphics Application\n";
 #endif
 
+	jobs.init();
 	createWindow();
 	createInstance();
 	createValidation();
+	createSurfaces();
 	choosePhysicalDevice();
 	createLogicalDevice();
 	createSwapChain();
+	frameNumber = 0;
+	maxFramesInFlight = static_cast<int>(swapchainSettings.framesInFlight);
+	createDepthBuffer();
 	createPipeline();
 	createFramebuffer();
 	createCommandPool();
 	createCommandBuffer();
-
-	frameNumber = 0;
-	maxFramesInFlight = static_cast<int>(swapchainFrames.size());
-	inFlightFence.resize(maxFramesInFlight);
-	imageAvailable.resize(maxFramesInFlight);
-	renderFinished.resize(maxFramesInFlight);
-
-	for (auto& fence : inFlightFence)
-	{
-		fence = makeFence();
-	}
-
-	for (auto& imageSem : imageAvailable)
-	{
-		imageSem = makeSemaphore();
-	}
-
-	for (auto& renderSem : renderFinished)
-	{
-		renderSem = makeSemaphore();
-	}
+	createMesh();
+	createCulling();
+	createCommandRecorder();
+	createDynamicResolution();
+	frameGraph.init(physicalDevice, logicalDevice);
+	createSyncObjects();
 
 	createScene();
 }
@@ -92,20 +57,59 @@ void Application::createWindow()
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
-	if (window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr))
+	//With several windows each one starts on its own monitor, as far as there are enough
+	int monitorCount = 0;
+	GLFWmonitor** monitors = glfwGetMonitors(&monitorCount);
+
+	for (size_t i = 0; i < outputs.size(); ++i)
 	{
+		GLFWwindow*& window = outputs[i].window;
+		if (window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr))
+		{
 #ifdef DEBUG_MODE
-		std::cout << "Successfully made a glfw window called \"VulkanWindow\", width: " << width << ", height: " << height << "\n";
+			std::cout << "Successfully made a glfw window called \"VulkanWindow\", width: " << width << ", height: " << height << "\n";
 #endif
-	}
-	else
-	{
+			if (outputs.size() > 1 && i < size_t(monitorCount))
+			{
+				int x, y;
+				glfwGetMonitorPos(monitors[i], &x, &y);
+				glfwSetWindowPos(window, x + 32, y + 32);
+			}
+
+			//Every input event is timestamped for the latency measurement. update() only reads the
+			//first window, input to the others can never change a frame and isn't counted.
+			if (i == 0)
+			{
+				glfwSetWindowUserPointer(window, this);
+				glfwSetKeyCallback(window, keyCallback);
+				glfwSetMouseButtonCallback(window, mouseButtonCallback);
+				glfwSetCursorPosCallback(window, cursorPosCallback);
+			}
+		}
+		else
+		{
 #ifdef DEBUG_MODE
-		std::cout << "GLFW window creation failed\n";
+			std::cout << "GLFW window creation failed\n";
 #endif
+		}
 	}
 }
 
+void Application::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	static_cast<Application*>(glfwGetWindowUserPointer(window))->latency.recordInput();
+}
+
+void Application::mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+	static_cast<Application*>(glfwGetWindowUserPointer(window))->latency.recordInput();
+}
+
+void Application::cursorPosCallback(GLFWwindow* window, double x, double y)
+{
+	static_cast<Application*>(glfwGetWindowUserPointer(window))->latency.recordInput();
+}
+
 void Application::createInstance()
 {
 #ifdef DEBUG_MODE
@@ -124,9 +128,11 @@ void Application::createInstance()
 #endif 
 
 	//Ϊ˼ԺȶԣǿԽͰ汾ӦӲͰ汾ַﶼг
-	version &= ~(0xFFFFU);
+	version &= ~(0xFFFU);
 
-	version = VK_MAKE_API_VERSION(0, 1, 0, 0);
+	//1.1 is needed for the pipeline library path, nothing past 1.3 is used
+	version = std::min(version, VK_MAKE_API_VERSION(0, 1, 3, 0));
+	apiVersion = version;
 
 	vk::ApplicationInfo appInfo = vk::ApplicationInfo(
 		title.c_str(),
@@ -278,27 +284,6 @@ void Application::printDeviceProperties(const vk::PhysicalDevice& device)
 	}
 }
 
-bool Application::checkDeviceExtensionSupport(const vk::PhysicalDevice& device,
-	const std::vector<const char*>& requestedExtensions)
-{
-	std::set<std::string> requiredExtensions(requestedExtensions.begin(), requestedExtensions.end());
-
-#ifdef DEBUG_MODE
-	std::cout << "Device can support extensions:\n";
-#endif // DEBUG_MODE
-
-	for (vk::ExtensionProperties& extension : device.enumerateDeviceExtensionProperties()) {
-
-#ifdef DEBUG_MODE
-		std::cout << "\t\"" << extension.extensionName << "\"\n";
-#endif // DEBUG_MODE
-
-		requiredExtensions.erase(extension.extensionName);
-	}
-
-	return requiredExtensions.empty();
-}
-
 bool Application::checkDeviceSuitable(const vk::PhysicalDevice& device)
 {
 #ifdef DEBUG_MODE
@@ -310,6 +295,12 @@ bool Application::checkDeviceSuitable(const vk::PhysicalDevice& device)
 	};
 
 #ifdef DEBUG_MODE
+	std::cout << "Device can support extensions:\n";
+
+	for (vk::ExtensionProperties& extension : device.enumerateDeviceExtensionProperties()) {
+		std::cout << "\t\"" << extension.extensionName << "\"\n";
+	}
+
 	std::cout << "We are requesting device extensions:\n";
 
 	for (const char* extension : requestedExtensions) {
@@ -331,9 +322,28 @@ bool Application::checkDeviceSuitable(const vk::PhysicalDevice& device)
 
 		return false;
 	}
+
+	//It has to draw and present to every window
+	if (!findQueueFamilies(device, getSurfaces()).isComplete())
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Device can't present to every window!\n";
+#endif 
+		return false;
+	}
 	return true;
 }
 
+std::vector<vk::SurfaceKHR> Application::getSurfaces() const
+{
+	std::vector<vk::SurfaceKHR> surfaces;
+	for (const OutputWindow& output : outputs)
+	{
+		surfaces.push_back(output.surface);
+	}
+	return surfaces;
+}
+
 void Application::choosePhysicalDevice()
 {
 #ifdef DEBUG_MODE
@@ -357,67 +367,88 @@ void Application::choosePhysicalDevice()
 			std::cout << "Choosing Physical Device Successful \n";
 #endif 
 			physicalDevice = device;
+			//Found once here, everything after uses this record
+			queueFamilies = findQueueFamilies(physicalDevice, getSurfaces());
 			break;
 		}
 	}
 }
 
-struct QueueFamilyIndices
+void Application::createLogicalDevice()
 {
-	std::optional<uint32_t> graphicsFamily;
-	std::optional<uint32_t> presentFamily;
-
-	bool isComplete()
+	//One queue in each family in use, roles that share a family share its queue
+	float queuePriority = 1.0f;
+	std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+	for (uint32_t family : queueFamilies.getUniqueFamilies())
 	{
-		return graphicsFamily.has_value() && presentFamily.has_value();
+		queueCreateInfos.push_back(vk::DeviceQueueCreateInfo(
+			vk::DeviceQueueCreateFlags(), family,
+			1, &queuePriority
+		));
 	}
-};
 
-void Application::findQueueFamilies(const vk::PhysicalDevice& device, QueueFamilyIndices& indices)
-{
-	std::vector<vk::QueueFamilyProperties> queueFamilies = device.getQueueFamilyProperties();
+	vk::PhysicalDeviceFeatures deviceFeatures = vk::PhysicalDeviceFeatures();
 
-#ifdef DEBUG_MODE
-	std::cout << "There are " << queueFamilies.size() << " queue families available on the system.\n";
-#endif
+	std::vector<const char*> deviceExtensions = {
+		VK_KHR_SWAPCHAIN_EXTENSION_NAME
+	};
 
-	int i = 0;
-	for (const vk::QueueFamilyProperties& queueFamily : queueFamilies)
+	//Optional, pipelines are fast linked from shared libraries when available
+	pipelineLibrarySupported = GraphicsPipelineLibrary::isSupported(physicalDevice, apiVersion);
+	vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures = {};
+	libraryFeatures.graphicsPipelineLibrary = VK_TRUE;
+	if (pipelineLibrarySupported)
 	{
-		if (queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) {
-			indices.graphicsFamily = i;
-			indices.presentFamily = i;
-
-#ifdef DEBUG_MODE
-			std::cout << "Queue Family " << i << " is suitable for graphics and presenting\n";
-#endif
+		for (const char* extension : GraphicsPipelineLibrary::getDeviceExtensions())
+		{
+			deviceExtensions.push_back(extension);
 		}
+	}
 
-		if (indices.isComplete()) {
-			break;
+	//Optional, the scene renders without a render pass and framebuffer when available
+	dynamicRenderingSupported = isDynamicRenderingSupported(physicalDevice, apiVersion);
+	vk::PhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures = {};
+	dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+	if (dynamicRenderingSupported)
+	{
+		for (const char* extension : getDynamicRenderingExtensions(physicalDevice, apiVersion))
+		{
+			deviceExtensions.push_back(extension);
 		}
-
-		i++;
 	}
-}
-
-void Application::createLogicalDevice()
-{
-	QueueFamilyIndices indices;
-	findQueueFamilies(physicalDevice, indices);
-
-	float queuePriority = 1.0f;
-
-	vk::DeviceQueueCreateInfo queueCreateInfo = vk::DeviceQueueCreateInfo(
-		vk::DeviceQueueCreateFlags(), indices.graphicsFamily.value(),
-		1, &queuePriority
-	);
 
-	vk::PhysicalDeviceFeatures deviceFeatures = vk::PhysicalDeviceFeatures();
+	//Optional, latency is measured up to the actual present when available
+	presentWaitSupported = LatencyTracker::isSupported(physicalDevice, apiVersion);
+	vk::PhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+	presentIdFeatures.presentId = VK_TRUE;
+	vk::PhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+	presentWaitFeatures.presentWait = VK_TRUE;
+	if (presentWaitSupported)
+	{
+		for (const char* extension : LatencyTracker::getDeviceExtensions())
+		{
+			deviceExtensions.push_back(extension);
+		}
+	}
 
-	std::vector<const char*> deviceExtensions = {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME
-	};
+	//Chain the features of every optional extension in use
+	void* featureChain = nullptr;
+	if (pipelineLibrarySupported)
+	{
+		libraryFeatures.pNext = featureChain;
+		featureChain = &libraryFeatures;
+	}
+	if (dynamicRenderingSupported)
+	{
+		dynamicRenderingFeatures.pNext = featureChain;
+		featureChain = &dynamicRenderingFeatures;
+	}
+	if (presentWaitSupported)
+	{
+		presentIdFeatures.pNext = featureChain;
+		presentWaitFeatures.pNext = &presentIdFeatures;
+		featureChain = &presentWaitFeatures;
+	}
 
 	std::vector<const char*> enabledLayers;
 #ifdef DEBUG_MODE
@@ -425,20 +456,26 @@ void Application::createLogicalDevice()
 #endif
 	vk::DeviceCreateInfo deviceInfo = vk::DeviceCreateInfo(
 		vk::DeviceCreateFlags(),
-		1, &queueCreateInfo,
+		static_cast<uint32_t>(queueCreateInfos.size()), queueCreateInfos.data(),
 		enabledLayers.size(), enabledLayers.data(),
 		deviceExtensions.size(), deviceExtensions.data(),
 		&deviceFeatures
 	);
+	deviceInfo.pNext = featureChain;
 
 	try
 	{
 		logicalDevice = physicalDevice.createDevice(deviceInfo);
-		graphicsQueue = logicalDevice.getQueue(indices.graphicsFamily.value(), 0);
-		presentQueue = logicalDevice.getQueue(indices.presentFamily.value(), 0),
+		graphicsQueue = logicalDevice.getQueue(queueFamilies.graphicsFamily.value(), 0);
+		presentQueue = logicalDevice.getQueue(queueFamilies.presentFamily.value(), 0);
+		computeQueue = logicalDevice.getQueue(queueFamilies.computeFamily, 0);
+		transferQueue = logicalDevice.getQueue(queueFamilies.transferFamily, 0);
 #ifdef DEBUG_MODE
-			std::cout << "GPU has been successfully abstracted!\n";
+		std::cout << "GPU has been successfully abstracted!\n";
 #endif
+		//Device level extension functions come from the device
+		dynamicloader.init(logicalDevice);
+		latency.init(logicalDevice, presentWaitSupported, dynamicloader);
 	}
 	catch (vk::SystemError err)
 	{
@@ -447,6 +484,9 @@ void Application::createLogicalDevice()
 #endif // DEBUG_MODE
 		logicalDevice = nullptr;
 		graphicsQueue = nullptr;
+		presentQueue = nullptr;
+		computeQueue = nullptr;
+		transferQueue = nullptr;
 	}
 }
 
@@ -642,18 +682,6 @@ static vk::SurfaceFormatKHR chooseSwapchainSurfaceFormat(std::vector<vk::Surface
 	return formats[0];
 }
 
-static vk::PresentModeKHR chooseSwapchainPresentMode(std::vector<vk::PresentModeKHR> presentModes)
-{
-	for (vk::PresentModeKHR presentMode : presentModes)
-	{
-		if (presentMode == vk::PresentModeKHR::eMailbox)
-		{
-			return presentMode;
-		}
-	}
-	return vk::PresentModeKHR::eFifo;
-}
-
 static vk::Extent2D chooseSwapchainExtent(uint32_t width, uint32_t height, vk::SurfaceCapabilitiesKHR capabilities)
 {
 	if (capabilities.currentExtent.width != UINT32_MAX)
@@ -678,114 +706,128 @@ static vk::Extent2D chooseSwapchainExtent(uint32_t width, uint32_t height, vk::S
 	}
 }
 
-void Application::createSwapChain()
+void Application::createSurfaces()
 {
-	VkSurfaceKHR csurface;
-	if (glfwCreateWindowSurface(instance, window, nullptr, &csurface) != VK_SUCCESS)
+	//Made before the device is chosen, since it has to be able to present to them
+	for (OutputWindow& output : outputs)
 	{
+		VkSurfaceKHR csurface;
+		if (glfwCreateWindowSurface(instance, output.window, nullptr, &csurface) != VK_SUCCESS)
+		{
 #ifdef DEBUG_MODE
-		std::cout << "Failed to abstract glfw surface for Vulkan\n";
+			std::cout << "Failed to abstract glfw surface for Vulkan\n";
 #endif // DEBUG_MODE
 
-	}
-	else
-	{
+		}
+		else
+		{
 #ifdef DEBUG_MODE
-		std::cout << "Successfully abstracted glfw surface for Vulkan\n";
+			std::cout << "Successfully abstracted glfw surface for Vulkan\n";
 #endif // DEBUG_MODE
-	}
+		}
 
-	surface = csurface;
+		output.surface = csurface;
+	}
+}
 
-	capabilities = physicalDevice.getSurfaceCapabilitiesKHR(surface);
+void Application::createSwapChain()
+{
+	for (OutputWindow& output : outputs)
+	{
+		output.capabilities = physicalDevice.getSurfaceCapabilitiesKHR(output.surface);
 #ifdef DEBUG_MODE
-	std::cout << "Swapchain can support the following surface capabilities:\n";
+		std::cout << "Swapchain can support the following surface capabilities:\n";
 
-	std::cout << "\tminimum image count: " << capabilities.minImageCount << '\n';
-	std::cout << "\tmaximum image count: " << capabilities.maxImageCount << '\n';
+		std::cout << "\tminimum image count: " << output.capabilities.minImageCount << '\n';
+		std::cout << "\tmaximum image count: " << output.capabilities.maxImageCount << '\n';
 
-	std::cout << "\tcurrent extent: \n";
+		std::cout << "\tcurrent extent: \n";
 
-	std::cout << "\t\twidth: " << capabilities.currentExtent.width << '\n';
-	std::cout << "\t\theight: " << capabilities.currentExtent.height << '\n';
+		std::cout << "\t\twidth: " << output.capabilities.currentExtent.width << '\n';
+		std::cout << "\t\theight: " << output.capabilities.currentExtent.height << '\n';
 
-	std::cout << "\tminimum supported extent: \n";
-	std::cout << "\t\twidth: " << capabilities.minImageExtent.width << '\n';
-	std::cout << "\t\theight: " << capabilities.minImageExtent.height << '\n';
+		std::cout << "\tminimum supported extent: \n";
+		std::cout << "\t\twidth: " << output.capabilities.minImageExtent.width << '\n';
+		std::cout << "\t\theight: " << output.capabilities.minImageExtent.height << '\n';
 
-	std::cout << "\tmaximum supported extent: \n";
-	std::cout << "\t\twidth: " << capabilities.maxImageExtent.width << '\n';
-	std::cout << "\t\theight: " << capabilities.maxImageExtent.height << '\n';
+		std::cout << "\tmaximum supported extent: \n";
+		std::cout << "\t\twidth: " << output.capabilities.maxImageExtent.width << '\n';
+		std::cout << "\t\theight: " << output.capabilities.maxImageExtent.height << '\n';
 
-	std::cout << "\tmaximum image array layers: " << capabilities.maxImageArrayLayers << '\n';
+		std::cout << "\tmaximum image array layers: " << output.capabilities.maxImageArrayLayers << '\n';
 
-	std::cout << "\tsupported transforms:\n";
-	std::vector<std::string> stringList = getTransformBits(capabilities.supportedTransforms);
-	for (std::string line : stringList) {
-		std::cout << "\t\t" << line << '\n';
-	}
+		std::cout << "\tsupported transforms:\n";
+		std::vector<std::string> stringList = getTransformBits(output.capabilities.supportedTransforms);
+		for (std::string line : stringList) {
+			std::cout << "\t\t" << line << '\n';
+		}
 
-	std::cout << "\tcurrent transform:\n";
-	stringList = getTransformBits(capabilities.currentTransform);
-	for (std::string line : stringList) {
-		std::cout << "\t\t" << line << '\n';
-	}
+		std::cout << "\tcurrent transform:\n";
+		stringList = getTransformBits(output.capabilities.currentTransform);
+		for (std::string line : stringList) {
+			std::cout << "\t\t" << line << '\n';
+		}
 
-	std::cout << "\tsupported alpha operations:\n";
-	stringList = getAlphaCompositeBits(capabilities.supportedCompositeAlpha);
-	for (std::string line : stringList) {
-		std::cout << "\t\t" << line << '\n';
-	}
+		std::cout << "\tsupported alpha operations:\n";
+		stringList = getAlphaCompositeBits(output.capabilities.supportedCompositeAlpha);
+		for (std::string line : stringList) {
+			std::cout << "\t\t" << line << '\n';
+		}
 
-	std::cout << "\tsupported image usage:\n";
-	stringList = getImageUsageBits(capabilities.supportedUsageFlags);
-	for (std::string line : stringList) {
-		std::cout << "\t\t" << line << '\n';
-	}
+		std::cout << "\tsupported image usage:\n";
+		stringList = getImageUsageBits(output.capabilities.supportedUsageFlags);
+		for (std::string line : stringList) {
+			std::cout << "\t\t" << line << '\n';
+		}
 #endif // DEBUG_MODE
 
-	formats = physicalDevice.getSurfaceFormatsKHR(surface);
+		output.formats = physicalDevice.getSurfaceFormatsKHR(output.surface);
 
 #ifdef DEBUG_MODE
-	for (vk::SurfaceFormatKHR supportedFormat : formats) {
-		std::cout << "supported pixel format: " << vk::to_string(supportedFormat.format) << '\n';
-		std::cout << "supported color space: " << vk::to_string(supportedFormat.colorSpace) << '\n';
-	}
+		for (vk::SurfaceFormatKHR supportedFormat : output.formats) {
+			std::cout << "supported pixel format: " << vk::to_string(supportedFormat.format) << '\n';
+			std::cout << "supported color space: " << vk::to_string(supportedFormat.colorSpace) << '\n';
+		}
 #endif 
 
-	presentModes = physicalDevice.getSurfacePresentModesKHR(surface);
+		output.presentModes = physicalDevice.getSurfacePresentModesKHR(output.surface);
 #ifdef DEBUG_MODE
-	for (vk::PresentModeKHR presentMode : presentModes) {
-		std::cout << '\t' << getPresentMode(presentMode) << '\n';
-	}
+		for (vk::PresentModeKHR presentMode : output.presentModes) {
+			std::cout << '\t' << getPresentMode(presentMode) << '\n';
+		}
 #endif 
 
-	vk::SurfaceFormatKHR format = chooseSwapchainSurfaceFormat(formats);
-
-	vk::PresentModeKHR presentMode = chooseSwapchainPresentMode(presentModes);
-
-	vk::Extent2D extent = chooseSwapchainExtent(width, height, capabilities);
+		makeSwapchain(output, nullptr);
+	}
 
-	uint32_t imageCount = std::min(
-		capabilities.maxImageCount,
-		capabilities.minImageCount + 1
-	);
+	//The first window sets the frames in flight, and the offscreen target and depth buffer match its swapchain
+	swapchainSettings = chooseSwapchainSettings(swapchainProfile, outputs[0].presentModes, outputs[0].capabilities);
+	swapchainFormat = outputs[0].format;
+	swapchainExtent = outputs[0].extent;
+}
 
-	vk::SwapchainCreateInfoKHR createInfo = vk::SwapchainCreateInfoKHR(
-		vk::SwapchainCreateFlagsKHR(), surface, imageCount, format.format, format.colorSpace,
-		extent, 1, vk::ImageUsageFlagBits::eColorAttachment
-	);
+void Application::makeSwapchain(OutputWindow& output, vk::SwapchainKHR oldSwapchain)
+{
+	vk::SurfaceFormatKHR format = chooseSwapchainSurfaceFormat(output.formats);
 
-	QueueFamilyIndices indices;
-	findQueueFamilies(physicalDevice, indices);
+	//Present mode and image count come from the profile, every window's surface may support different ones
+	SwapchainSettings settings = chooseSwapchainSettings(swapchainProfile, output.presentModes, output.capabilities);
+	vk::PresentModeKHR presentMode = settings.presentMode;
+	uint32_t imageCount = settings.imageCount;
 
-	if (physicalDevice.getSurfaceSupportKHR(indices.presentFamily.value(), surface))
-	{
+	vk::Extent2D extent = chooseSwapchainExtent(width, height, output.capabilities);
 #ifdef DEBUG_MODE
-		std::cout << "Queue Family " << indices.presentFamily.value() << " is suitable for presenting\n";
+	std::cout << "Swapchain profile " << getSwapchainProfileName(swapchainProfile) << ": " << getPresentMode(presentMode)
+		<< ", " << imageCount << " images, " << settings.framesInFlight << " frames in flight\n";
 #endif
-	}
 
+	vk::SwapchainCreateInfoKHR createInfo = vk::SwapchainCreateInfoKHR(
+		vk::SwapchainCreateFlagsKHR(), output.surface, imageCount, format.format, format.colorSpace,
+		extent, 1, vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst
+	);
+
+	//The present family was chosen to support every window's surface
+	const QueueFamilies& indices = queueFamilies;
 	uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
 
 	if (indices.graphicsFamily != indices.presentFamily)
@@ -798,30 +840,30 @@ void Application::createSwapChain()
 		createInfo.imageSharingMode = vk::SharingMode::eExclusive;
 	}
 
-	createInfo.preTransform = capabilities.currentTransform;
+	createInfo.preTransform = output.capabilities.currentTransform;
 	createInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = vk::SwapchainKHR(nullptr);
+	createInfo.oldSwapchain = oldSwapchain;
 
 	try
 	{
-		swapchain = logicalDevice.createSwapchainKHR(createInfo);
+		output.swapchain = logicalDevice.createSwapchainKHR(createInfo);
 	}
 	catch (vk::SystemError err)
 	{
 		throw std::runtime_error("Failed to create swap chain!");
 	}
-	swapchainImages = logicalDevice.getSwapchainImagesKHR(swapchain);
-	swapchainFormat = format.format;
-	swapchainExtent = extent;
+	output.images = logicalDevice.getSwapchainImagesKHR(output.swapchain);
+	output.format = format.format;
+	output.extent = extent;
 
-	swapchainFrames.resize(swapchainImages.size());
+	output.views.resize(output.images.size());
 
-	for (size_t i = 0; i < swapchainImages.size(); ++i)
+	for (size_t i = 0; i < output.images.size(); ++i)
 	{
 		vk::ImageViewCreateInfo createInfo = {};
-		createInfo.image = swapchainImages[i];
+		createInfo.image = output.images[i];
 		createInfo.viewType = vk::ImageViewType::e2D;
 		createInfo.format = format.format;
 		createInfo.components.r = vk::ComponentSwizzle::eIdentity;
@@ -834,52 +876,45 @@ void Application::createSwapChain()
 		createInfo.subresourceRange.baseArrayLayer = 0;
 		createInfo.subresourceRange.layerCount = 1;
 
-		swapchainFrames[i] = logicalDevice.createImageView(createInfo);
+		output.views[i] = logicalDevice.createImageView(createInfo);
 	}
 }
 
-static std::vector<char> readFile(std::string filename)
+void Application::createDepthBuffer()
 {
-	auto path = getExecutableDir();
-	std::ifstream file(path.string() + "/" + filename, std::ios::ate | std::ios::binary);
-
-#ifdef DEBUG_MODE
-	if (!file.is_open())
+	//The depth buffer is sampled to build the occlusion culling pyramid
+	std::vector<vk::Format> candidates = { vk::Format::eD32Sfloat, vk::Format::eD16Unorm };
+	vk::FormatFeatureFlags features = vk::FormatFeatureFlagBits::eDepthStencilAttachment | vk::FormatFeatureFlagBits::eSampledImage;
+	for (vk::Format candidate : candidates)
 	{
-		std::cout << "Failed to load \"" << filename << "\"" << std::endl;
+		if ((physicalDevice.getFormatProperties(candidate).optimalTilingFeatures & features) == features)
+		{
+			depthFormat = candidate;
+			break;
+		}
 	}
-#endif
-
-	size_t filesize{ static_cast<size_t>(file.tellg()) };
-
-	std::vector<char> buffer(filesize);
-	file.seekg(0);
-	file.read(buffer.data(), filesize);
-
-	file.close();
-	return buffer;
-}
-
-vk::ShaderModule Application::createModule(std::string filename)
-{
-	std::vector<char> sourceCode = readFile(filename);
-	vk::ShaderModuleCreateInfo moduleInfo = {};
-	moduleInfo.flags = vk::ShaderModuleCreateFlags();
-	moduleInfo.codeSize = sourceCode.size();
-	moduleInfo.pCode = reinterpret_cast<const uint32_t*>(sourceCode.data());
 
-	try {
-		return logicalDevice.createShaderModule(moduleInfo);
-	}
-	catch (vk::SystemError err)
+	//The compute queue samples it for the depth pyramid
+	std::vector<uint32_t> sharingFamilies;
+	if (queueFamilies.hasAsyncCompute())
 	{
+		sharingFamilies = { queueFamilies.graphicsFamily.value(), queueFamilies.computeFamily };
+	}
+	depthBuffer = createImage(physicalDevice, logicalDevice, swapchainExtent, depthFormat,
+		vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled, vk::ImageAspectFlagBits::eDepth,
+		1, sharingFamilies);
 #ifdef DEBUG_MODE
-		std::cout << "Failed to create shader module for \"" << filename << "\"" << std::endl;
-#endif
+	if (depthBuffer.image)
+	{
+		std::cout << "Created depth buffer: " << vk::to_string(depthFormat) << std::endl;
+	}
+	else
+	{
+		std::cout << "Failed to create depth buffer!" << std::endl;
 	}
+#endif
 }
 
-
 std::string Application::getVertexFilepath()
 {
 	return "media/shaders/vertex.spv";
@@ -890,32 +925,20 @@ std::string Application::getFragmentFilepath()
 	return "media/shaders/fragment.spv";
 }
 
-void Application::makePipelineLayout()
+GraphicsPipelineKey Application::getPipelineKey()
 {
-#ifdef DEBUG_MODE
-	std::cout << "Create Pipeline Layout" << std::endl;
-#endif 
-	vk::PipelineLayoutCreateInfo layoutInfo;
-	layoutInfo.flags = vk::PipelineLayoutCreateFlags();
-	layoutInfo.setLayoutCount = 0;
-	layoutInfo.pushConstantRangeCount = 1;
-
-	vk::PushConstantRange pushConstantInfo;
-	pushConstantInfo.offset = 0; 
-	pushConstantInfo.size = sizeof(glm::mat4);
-	pushConstantInfo.stageFlags = vk::ShaderStageFlagBits::eVertex;
-	layoutInfo.pPushConstantRanges = &pushConstantInfo;
+	GraphicsPipelineKey key;
+	key.vertexShader = getVertexFilepath();
+	key.fragmentShader = getFragmentFilepath();
+	//constant_id = 0 in vertex.vert, specializations of the same shaders get their own pipeline
+	key.vertexConstants.set(0, TriangleScale);
+	return key;
+}
 
-	try
-	{
-		pipelineLayout = logicalDevice.createPipelineLayout(layoutInfo);
-	}
-	catch (vk::SystemError err)
-	{
-#ifdef DEBUG_MODE
-		std::cout << "Failed to create pipeline layout!" << std::endl;
-#endif 
-	}
+vk::PipelineLayout Application::makePipelineLayout(const std::vector<ShaderReflection>& stages)
+{
+	//Layouts are derived from the shaders themselves and shared between pipelines with the same interface
+	return pipelineLayouts.get(logicalDevice, makeLayoutSignature(stages));
 }
 
 void Application::makeRenderpass()
@@ -933,27 +956,70 @@ void Application::makeRenderpass()
 	colorAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
 	colorAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
 	colorAttachment.initialLayout = vk::ImageLayout::eUndefined;
-	colorAttachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+	//Blitted into the swapchain image after the render pass
+	colorAttachment.finalLayout = vk::ImageLayout::eTransferSrcOptimal;
 
 	//Declare that attachment to be color buffer 0 of the framebuffer
 	vk::AttachmentReference colorAttachmentRef = {};
 	colorAttachmentRef.attachment = 0;
 	colorAttachmentRef.layout = vk::ImageLayout::eColorAttachmentOptimal;
 
+	//Depth is kept and left readable for the occlusion culling pyramid
+	vk::AttachmentDescription depthAttachment = {};
+	depthAttachment.flags = vk::AttachmentDescriptionFlags();
+	depthAttachment.format = depthFormat;
+	depthAttachment.samples = vk::SampleCountFlagBits::e1;
+	depthAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+	depthAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+	depthAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+	depthAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+	depthAttachment.initialLayout = vk::ImageLayout::eUndefined;
+	depthAttachment.finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+	vk::AttachmentReference depthAttachmentRef = {};
+	depthAttachmentRef.attachment = 1;
+	depthAttachmentRef.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
 	//Renderpasses are broken down into subpasses, there's always at least one.
 	vk::SubpassDescription subpass = {};
 	subpass.flags = vk::SubpassDescriptionFlags();
 	subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
+	subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+	//The previous frame's pyramid build and blit read depth and color before this frame clears them,
+	//and this frame's pyramid build and blit read what the subpass wrote. With the pyramid on the
+	//compute queue the semaphore wait at the fragment tests stands in for the compute stage.
+	vk::SubpassDependency dependencies[2] = {};
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer |
+		vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+	dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests |
+		vk::PipelineStageFlagBits::eColorAttachmentOutput;
+	dependencies[0].srcAccessMask = vk::AccessFlags();
+	dependencies[0].dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+		vk::AccessFlagBits::eColorAttachmentWrite;
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests |
+		vk::PipelineStageFlagBits::eColorAttachmentOutput;
+	dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer;
+	dependencies[1].srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eColorAttachmentWrite;
+	dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead;
+
+	vk::AttachmentDescription attachments[2] = { colorAttachment, depthAttachment };
 
 	//Now create the renderpass
 	vk::RenderPassCreateInfo renderpassInfo = {};
 	renderpassInfo.flags = vk::RenderPassCreateFlags();
-	renderpassInfo.attachmentCount = 1;
-	renderpassInfo.pAttachments = &colorAttachment;
+	renderpassInfo.attachmentCount = 2;
+	renderpassInfo.pAttachments = attachments;
 	renderpassInfo.subpassCount = 1;
 	renderpassInfo.pSubpasses = &subpass;
+	renderpassInfo.dependencyCount = 2;
+	renderpassInfo.pDependencies = dependencies;
 	try
 	{
 		renderpass = logicalDevice.createRenderPass(renderpassInfo);
@@ -968,116 +1034,171 @@ void Application::makeRenderpass()
 
 void Application::createPipeline()
 {
-	vk::GraphicsPipelineCreateInfo pipelineInfo = {};
-	pipelineInfo.flags = vk::PipelineCreateFlags();
+	//Pipelines are made for the scene's attachments, through a render pass only when dynamic rendering isn't there
+	sceneTarget.colorFormat = swapchainFormat;
+	sceneTarget.depthFormat = depthFormat;
+	if (!dynamicRenderingSupported)
+	{
+		makeRenderpass();
+		sceneTarget.renderPass = renderpass;
+	}
+
+	if (pipelineLibrarySupported)
+	{
+		pipelineLibrary.init(logicalDevice, sceneTarget);
+	}
+
+	defaultPipelineKey = getPipelineKey();
+	GraphicsPipeline defaultPipeline = getPipeline(defaultPipelineKey);
+	pipeline = defaultPipeline.pipeline;
+	pipelineLayout = defaultPipeline.layout;
+}
+
+void Application::createMesh()
+{
+	//A disc with a level of detail per segment count, the coarsest being a plain triangle.
+	//The error of a regular n-gon against its circle is radius * (1 - cos(pi / n)).
+	const float radius = 0.06f;
+	const uint32_t segmentCounts[] = { 48, 16, 6, 3 };
+	const float pi = glm::pi<float>();
+
+	//Same colors as the original triangle, red at the top, then green and blue a third of the way around
+	auto colorAt = [pi](float angle) {
+		float t = std::fmod(angle + 0.5f * pi + 2.0f * pi, 2.0f * pi) / (2.0f * pi) * 3.0f;
+		const glm::vec3 corners[] = { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) };
+		int corner = std::min(2, int(t));
+		return glm::mix(corners[corner], corners[(corner + 1) % 3], t - corner);
+	};
 
-	//Shader stages, to be populated later
-	std::vector<vk::PipelineShaderStageCreateInfo> shaderStages;
+	std::vector<Vertex> vertices;
+	objectMesh.levels.clear();
+	objectMesh.radius = radius;
+	for (uint32_t segments : segmentCounts)
+	{
+		MeshLod lod;
+		lod.firstVertex = static_cast<uint32_t>(vertices.size());
+		lod.geometricError = radius * (1.0f - std::cos(pi / segments));
+
+		//Fan from the first corner, clockwise on screen like the pipeline expects
+		std::vector<Vertex> corners(segments);
+		for (uint32_t i = 0; i < segments; ++i)
+		{
+			float angle = -0.5f * pi + 2.0f * pi * i / segments;
+			corners[i].position = radius * glm::vec2(std::cos(angle), std::sin(angle));
+			corners[i].color = colorAt(angle);
+		}
+		for (uint32_t i = 1; i + 1 < segments; ++i)
+		{
+			vertices.push_back(corners[0]);
+			vertices.push_back(corners[i]);
+			vertices.push_back(corners[i + 1]);
+		}
+
+		lod.vertexCount = static_cast<uint32_t>(vertices.size()) - lod.firstVertex;
+		objectMesh.levels.push_back(lod);
+	}
 
-	//Vertex Input
-	vk::PipelineVertexInputStateCreateInfo vertexInputInfo = {};
-	vertexInputInfo.flags = vk::PipelineVertexInputStateCreateFlags();
-	vertexInputInfo.vertexBindingDescriptionCount = 0;
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	vertexBuffer = createBuffer(physicalDevice, logicalDevice, vertices.size() * sizeof(Vertex), vk::BufferUsageFlagBits::eVertexBuffer,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+	if (vertexBuffer.mapped)
+	{
+		std::memcpy(vertexBuffer.mapped, vertices.data(), vertices.size() * sizeof(Vertex));
+	}
+}
+
+void Application::createCulling()
+{
+	//Same pipeline, but instances come from the buffers written by the culling shader
+	instancedPipelineKey = defaultPipelineKey;
+	instancedPipelineKey.vertexShader = "media/shaders/instanced.spv";
+	instancedPipeline = getPipeline(instancedPipelineKey);
+
+	const ShaderModule* vertexShader = shaderModules.get(logicalDevice, instancedPipelineKey.vertexShader);
+	const ShaderModule* fragmentShader = shaderModules.get(logicalDevice, instancedPipelineKey.fragmentShader);
+	if (!instancedPipeline.pipeline || !vertexShader || !fragmentShader || !depthBuffer.image)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "GPU culling unavailable, culling on the CPU" << std::endl;
+#endif
+		return;
+	}
 
-	//Input Assembly
-	vk::PipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {};
-	inputAssemblyInfo.flags = vk::PipelineInputAssemblyStateCreateFlags();
-	inputAssemblyInfo.topology = vk::PrimitiveTopology::eTriangleList;
-	pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+	PipelineLayoutSignature signature = makeLayoutSignature({ vertexShader->reflection, fragmentShader->reflection });
+	vk::DescriptorSetLayout drawSetLayout = signature.sets.empty() ? nullptr : pipelineLayouts.getSetLayout(logicalDevice, signature.sets[0]);
 
-	//Vertex Shader
+	//Culling on its own queue needs a compute pool, the buffers the draws read are shared with graphics
+	std::vector<uint32_t> sharingFamilies;
+	if (queueFamilies.hasAsyncCompute() && computeCmdPool)
+	{
+		sharingFamilies = { queueFamilies.graphicsFamily.value(), queueFamilies.computeFamily };
+	}
+	if (!gpuCulling.init(physicalDevice, logicalDevice, shaderModules, pipelineLayouts, drawSetLayout, depthBuffer, objectMesh,
+		static_cast<uint32_t>(maxFramesInFlight), sharingFamilies))
+	{
 #ifdef DEBUG_MODE
-	std::cout << "Create vertex shader module" << std::endl;
+		std::cout << "GPU culling unavailable, culling on the CPU" << std::endl;
 #endif
-	vk::ShaderModule vertexShader = createModule(getVertexFilepath());
-	vk::PipelineShaderStageCreateInfo vertexShaderInfo = {};
-	vertexShaderInfo.flags = vk::PipelineShaderStageCreateFlags();
-	vertexShaderInfo.stage = vk::ShaderStageFlagBits::eVertex;
-	vertexShaderInfo.module = vertexShader;
-	vertexShaderInfo.pName = "main";
-	shaderStages.push_back(vertexShaderInfo);
-
-	//Viewport and Scissor
-	vk::Viewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)swapchainExtent.width;
-	viewport.height = (float)swapchainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	vk::Rect2D scissor = {};
-	scissor.offset.x = 0.0f;
-	scissor.offset.y = 0.0f;
-	scissor.extent = swapchainExtent;
-	vk::PipelineViewportStateCreateInfo viewportState = {};
-	viewportState.flags = vk::PipelineViewportStateCreateFlags();
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
-	pipelineInfo.pViewportState = &viewportState;
-
-	//Rasterizer
-	vk::PipelineRasterizationStateCreateInfo rasterizer = {};
-	rasterizer.flags = vk::PipelineRasterizationStateCreateFlags();
-	rasterizer.depthClampEnable = VK_FALSE; //discard out of bounds fragments, don't clamp them
-	rasterizer.rasterizerDiscardEnable = VK_FALSE; //This flag would disable fragment output
-	rasterizer.polygonMode = vk::PolygonMode::eFill;
-	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = vk::CullModeFlagBits::eBack;
-	rasterizer.frontFace = vk::FrontFace::eClockwise;
-	rasterizer.depthBiasEnable = VK_FALSE; //Depth bias can be useful in shadow maps.
-	pipelineInfo.pRasterizationState = &rasterizer;
-
-	//Fragment Shader
+	}
+	asyncCompute = gpuCulling.isEnabled() && !sharingFamilies.empty();
+	depthPending = false;
 #ifdef DEBUG_MODE
-	std::cout << "Create fragment shader module" << std::endl;
+	if (gpuCulling.isEnabled())
+	{
+		std::cout << "GPU culling on the " << (asyncCompute ? "compute" : "graphics") << " queue" << std::endl;
+	}
 #endif
-	vk::ShaderModule fragmentShader = createModule(getFragmentFilepath());
-	vk::PipelineShaderStageCreateInfo fragmentShaderInfo = {};
-	fragmentShaderInfo.flags = vk::PipelineShaderStageCreateFlags();
-	fragmentShaderInfo.stage = vk::ShaderStageFlagBits::eFragment;
-	fragmentShaderInfo.module = fragmentShader;
-	fragmentShaderInfo.pName = "main";
-	shaderStages.push_back(fragmentShaderInfo);
-
-	//Now both shaders have been made, we can declare them to the pipeline info
-	pipelineInfo.stageCount = shaderStages.size();
-	pipelineInfo.pStages = shaderStages.data();
-
-	//Multisampling
-	vk::PipelineMultisampleStateCreateInfo multisampling = {};
-	multisampling.flags = vk::PipelineMultisampleStateCreateFlags();
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
-	pipelineInfo.pMultisampleState = &multisampling;
-
-	//Color Blend
-	vk::PipelineColorBlendAttachmentState colorBlendAttachment = {};
-	colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
-	colorBlendAttachment.blendEnable = VK_FALSE;
-	vk::PipelineColorBlendStateCreateInfo colorBlending = {};
-	colorBlending.flags = vk::PipelineColorBlendStateCreateFlags();
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = vk::LogicOp::eCopy;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f;
-	colorBlending.blendConstants[1] = 0.0f;
-	colorBlending.blendConstants[2] = 0.0f;
-	colorBlending.blendConstants[3] = 0.0f;
-	pipelineInfo.pColorBlendState = &colorBlending;
+}
+
+GraphicsPipeline Application::getPipeline(const GraphicsPipelineKey& key)
+{
+	auto cached = pipelines.find(key);
+	if (cached != pipelines.end())
+	{
+		return cached->second;
+	}
+
+	GraphicsPipeline newPipeline = makePipeline(key);
+	if (newPipeline.pipeline)
+	{
+		pipelines.emplace(key, newPipeline);
+	}
+	return newPipeline;
+}
+
+GraphicsPipeline Application::makePipeline(const GraphicsPipelineKey& key)
+{
+	//Modules are shared by every pipeline that uses the same SPIR-V and live until shutdown
+	const ShaderModule* vertexShader = shaderModules.get(logicalDevice, key.vertexShader);
+	const ShaderModule* fragmentShader = shaderModules.get(logicalDevice, key.fragmentShader);
+	if (!vertexShader || !fragmentShader)
+	{
+		return GraphicsPipeline();
+	}
+	std::vector<ShaderReflection> reflections = { vertexShader->reflection, fragmentShader->reflection };
 
 	//Pipeline Layout
-	makePipelineLayout();
-	pipelineInfo.layout = pipelineLayout;
+	GraphicsPipeline newPipeline;
+	newPipeline.layout = makePipelineLayout(reflections);
+
+	//Shader stages and fixed function state
+	GraphicsPipelineState state(key, *vertexShader, *fragmentShader, swapchainExtent);
+
+	if (pipelineLibrary.isEnabled())
+	{
+		//Fast link from cached libraries, swapOptimizedPipelines() later replaces it with the optimized link
+		newPipeline.pipeline = pipelineLibrary.link(key, state, newPipeline.layout);
+		return newPipeline;
+	}
+
+	vk::GraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.flags = vk::PipelineCreateFlags();
+	state.fill(pipelineInfo);
 
-	//Renderpass
-	makeRenderpass();
-	pipelineInfo.renderPass = renderpass;
-	pipelineInfo.subpass = 0;
+	pipelineInfo.layout = newPipeline.layout;
+
+	//Renderpass, or the attachment formats with dynamic rendering
+	vk::PipelineRenderingCreateInfo rendering;
+	sceneTarget.fill(pipelineInfo, rendering);
 
 	//Extra stuff
 	pipelineInfo.basePipelineHandle = nullptr;
@@ -1087,7 +1208,7 @@ void Application::createPipeline()
 	std::cout << "Create Graphics Pipeline" << std::endl;
 #endif
 	try {
-		pipeline = (logicalDevice.createGraphicsPipeline(nullptr, pipelineInfo)).value;
+		newPipeline.pipeline = (logicalDevice.createGraphicsPipeline(nullptr, pipelineInfo)).value;
 	}
 	catch (vk::SystemError err)
 	{
@@ -1096,52 +1217,115 @@ void Application::createPipeline()
 #endif
 	}
 
-	logicalDevice.destroyShaderModule(vertexShader);
-	logicalDevice.destroyShaderModule(fragmentShader);
+	return newPipeline;
 }
 
-void Application::createFramebuffer()
+void Application::swapOptimizedPipelines()
 {
-	swapchainFramebuffers.resize(swapchainFrames.size());
-	for (int i = 0; i < swapchainFrames.size(); ++i) {
-
-		std::vector<vk::ImageView> attachments = {
-			swapchainFrames[i]
-		};
+	//The fence of this frame slot was just waited on, so every frame recorded
+	//maxFramesInFlight frames ago or earlier is finished with its pipelines
+	for (auto retired = retiredPipelines.begin(); retired != retiredPipelines.end();)
+	{
+		if (frameCount >= retired->second + maxFramesInFlight)
+		{
+			logicalDevice.destroyPipeline(retired->first);
+			retired = retiredPipelines.erase(retired);
+		}
+		else
+		{
+			++retired;
+		}
+	}
 
-		vk::FramebufferCreateInfo framebufferInfo;
-		framebufferInfo.flags = vk::FramebufferCreateFlags();
-		framebufferInfo.renderPass = renderpass;
-		framebufferInfo.attachmentCount = attachments.size();
-		framebufferInfo.pAttachments = attachments.data();
-		framebufferInfo.width = swapchainExtent.width;
-		framebufferInfo.height = swapchainExtent.height;
-		framebufferInfo.layers = 1;
+	for (auto& optimized : pipelineLibrary.takeOptimized())
+	{
+		auto cached = pipelines.find(optimized.first);
+		if (cached == pipelines.end())
+		{
+			logicalDevice.destroyPipeline(optimized.second);
+			continue;
+		}
+		retiredPipelines.emplace_back(cached->second.pipeline, frameCount);
+		cached->second.pipeline = optimized.second;
+	}
 
-		try {
-			swapchainFramebuffers[i] = logicalDevice.createFramebuffer(framebufferInfo);
+	auto current = pipelines.find(defaultPipelineKey);
+	if (current != pipelines.end())
+	{
+		pipeline = current->second.pipeline;
+	}
+	auto instanced = pipelines.find(instancedPipelineKey);
+	if (instanced != pipelines.end())
+	{
+		instancedPipeline = instanced->second;
+	}
+}
+
+void Application::createFramebuffer()
+{
+	//The offscreen color target itself is a transient of the frame graph, see buildFrameGraph().
+	//Scaling up with a linear filter needs the format to support it.
+	vk::FormatFeatureFlags features = physicalDevice.getFormatProperties(swapchainFormat).optimalTilingFeatures;
+	blitFilter = (features & vk::FormatFeatureFlagBits::eSampledImageFilterLinear) ? vk::Filter::eLinear : vk::Filter::eNearest;
+
+	renderExtent = swapchainExtent;
+}
+
+void Application::updateOffscreenFramebuffer()
+{
+	//Dynamic rendering begins on the image views themselves
+	if (sceneTarget.usesDynamicRendering() || frameGraph.getTransientVersion() == offscreenFramebufferVersion)
+	{
+		return;
+	}
 
-#ifdef DEBUG_MODE			
-			std::cout << "Created framebuffer for frame " << i << std::endl;
+	//The graph only makes new transients after waiting for the device, nothing uses the old framebuffer anymore
+	if (offscreenFramebuffer)
+	{
+		logicalDevice.destroyFramebuffer(offscreenFramebuffer);
+		offscreenFramebuffer = nullptr;
+	}
+	offscreenFramebufferVersion = frameGraph.getTransientVersion();
+	vk::ImageView colorView = frameGraph.getView(offscreenColor);
+	if (!colorView)
+	{
+		return;
+	}
+
+	std::vector<vk::ImageView> attachments = {
+		colorView,
+		depthBuffer.view
+	};
+
+	vk::FramebufferCreateInfo framebufferInfo;
+	framebufferInfo.flags = vk::FramebufferCreateFlags();
+	framebufferInfo.renderPass = renderpass;
+	framebufferInfo.attachmentCount = attachments.size();
+	framebufferInfo.pAttachments = attachments.data();
+	framebufferInfo.width = swapchainExtent.width;
+	framebufferInfo.height = swapchainExtent.height;
+	framebufferInfo.layers = 1;
+
+	try {
+		offscreenFramebuffer = logicalDevice.createFramebuffer(framebufferInfo);
+
+#ifdef DEBUG_MODE
+		std::cout << "Created offscreen framebuffer, blit filter " << vk::to_string(blitFilter) << std::endl;
 #endif
-		}
-		catch (vk::SystemError err) 
-		{
+	}
+	catch (vk::SystemError err)
+	{
 #ifdef DEBUG_MODE
-			std::cout << "Failed to create framebuffer for frame " << i << std::endl;
+		std::cout << "Failed to create offscreen framebuffer" << std::endl;
 #endif
-		}
 	}
 }
 
 void Application::createCommandPool()
 {
-	QueueFamilyIndices indices;
-	findQueueFamilies(physicalDevice, indices);
-
 	vk::CommandPoolCreateInfo poolInfo;
 	poolInfo.flags = vk::CommandPoolCreateFlags() | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
-	poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
+	poolInfo.queueFamilyIndex = queueFamilies.graphicsFamily.value();
 
 	try 
 	{
@@ -1154,6 +1338,23 @@ void Application::createCommandPool()
 		cmdPool = nullptr;
 #endif 
 	}
+
+	if (!queueFamilies.hasAsyncCompute())
+	{
+		return;
+	}
+	poolInfo.queueFamilyIndex = queueFamilies.computeFamily;
+	try
+	{
+		computeCmdPool = logicalDevice.createCommandPool(poolInfo);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create compute Command Pool, culling on the graphics queue" << std::endl;
+#endif
+		computeCmdPool = nullptr;
+	}
 }
 
 void Application::createCommandBuffer()
@@ -1163,22 +1364,7 @@ void Application::createCommandBuffer()
 	allocInfo.level = vk::CommandBufferLevel::ePrimary;
 	allocInfo.commandBufferCount = 1;
 
-	swapchainCmdBuffers.resize(swapchainFrames.size());
-	//Make a command buffer for each frame
-	for (int i = 0; i < swapchainFrames.size(); ++i) {
-		try {
-			swapchainCmdBuffers[i] = logicalDevice.allocateCommandBuffers(allocInfo)[0];
-#ifdef DEBUG_MODE
-				std::cout << "Allocated command buffer for frame " << i << std::endl;
-#endif
-		}
-		catch (vk::SystemError err) 
-		{
-#ifdef DEBUG_MODE
-			std::cout << "Failed to allocate command buffer for frame " << i << std::endl;
-#endif
-		}
-	}
+	createFrameCommandBuffers();
 
 	//Make a "main" command buffer for the engine
 	try {
@@ -1198,6 +1384,194 @@ void Application::createCommandBuffer()
 	}
 }
 
+void Application::createFrameCommandBuffers()
+{
+	vk::CommandBufferAllocateInfo allocInfo = {};
+	allocInfo.commandPool = cmdPool;
+	allocInfo.level = vk::CommandBufferLevel::ePrimary;
+	allocInfo.commandBufferCount = 1;
+
+	//Make command buffers for each frame in flight, the fence of the slot guards them.
+	//The fence comes after the scene, which waited for the culling, so it guards the compute one too.
+	swapchainCmdBuffers.resize(maxFramesInFlight);
+	outputCmdBuffers.resize(maxFramesInFlight);
+	computeCmdBuffers.resize(computeCmdPool ? maxFramesInFlight : 0);
+	vk::CommandBufferAllocateInfo computeAllocInfo = allocInfo;
+	computeAllocInfo.commandPool = computeCmdPool;
+	for (int i = 0; i < maxFramesInFlight; ++i) {
+		try {
+			swapchainCmdBuffers[i] = logicalDevice.allocateCommandBuffers(allocInfo)[0];
+			outputCmdBuffers[i] = logicalDevice.allocateCommandBuffers(allocInfo)[0];
+			if (computeCmdPool)
+			{
+				computeCmdBuffers[i] = logicalDevice.allocateCommandBuffers(computeAllocInfo)[0];
+			}
+#ifdef DEBUG_MODE
+				std::cout << "Allocated command buffers for frame " << i << std::endl;
+#endif
+		}
+		catch (vk::SystemError err) 
+		{
+#ifdef DEBUG_MODE
+			std::cout << "Failed to allocate command buffers for frame " << i << std::endl;
+#endif
+		}
+	}
+}
+
+void Application::freeFrameCommandBuffers()
+{
+	logicalDevice.freeCommandBuffers(cmdPool, swapchainCmdBuffers);
+	logicalDevice.freeCommandBuffers(cmdPool, outputCmdBuffers);
+	if (computeCmdPool)
+	{
+		logicalDevice.freeCommandBuffers(computeCmdPool, computeCmdBuffers);
+	}
+	swapchainCmdBuffers.clear();
+	outputCmdBuffers.clear();
+	computeCmdBuffers.clear();
+}
+
+void Application::createSyncObjects()
+{
+	inFlightFence.resize(maxFramesInFlight);
+	for (auto& fence : inFlightFence)
+	{
+		fence = makeFence();
+	}
+
+	cullFinished.resize(maxFramesInFlight);
+	sceneFinished.resize(maxFramesInFlight);
+	for (int i = 0; i < maxFramesInFlight; ++i)
+	{
+		cullFinished[i] = makeSemaphore();
+		sceneFinished[i] = makeSemaphore();
+	}
+	//A new sceneFinished hasn't been signaled, the next frame mustn't wait on it
+	depthPending = false;
+
+	for (OutputWindow& output : outputs)
+	{
+		output.imageAvailable.resize(maxFramesInFlight);
+		//Presentation may still wait on the semaphore of an image after its frame slot is reused,
+		//so these belong to the swapchain images
+		output.renderFinished.resize(output.views.size());
+
+		for (auto& imageSem : output.imageAvailable)
+		{
+			imageSem = makeSemaphore();
+		}
+
+		for (auto& renderSem : output.renderFinished)
+		{
+			renderSem = makeSemaphore();
+		}
+	}
+}
+
+void Application::destroySyncObjects()
+{
+	for (auto fence : inFlightFence)
+	{
+		logicalDevice.destroyFence(fence);
+	}
+	inFlightFence.clear();
+
+	for (int i = 0; i < static_cast<int>(cullFinished.size()); ++i)
+	{
+		logicalDevice.destroySemaphore(cullFinished[i]);
+		logicalDevice.destroySemaphore(sceneFinished[i]);
+	}
+	cullFinished.clear();
+	sceneFinished.clear();
+
+	for (OutputWindow& output : outputs)
+	{
+		for (auto imageSem : output.imageAvailable)
+		{
+			logicalDevice.destroySemaphore(imageSem);
+		}
+
+		for (auto renderSem : output.renderFinished)
+		{
+			logicalDevice.destroySemaphore(renderSem);
+		}
+		output.imageAvailable.clear();
+		output.renderFinished.clear();
+	}
+}
+
+void Application::setSwapchainProfile(SwapchainProfile profile)
+{
+	RenderCommand command;
+	command.type = RenderCommand::Type::SwapchainProfile;
+	command.profile = profile;
+	sendRenderCommand(command);
+}
+
+void Application::recreateSwapchain()
+{
+	logicalDevice.waitIdle();
+	//The latency tracker may still be waiting on a present of the old swapchain
+	latency.flush();
+	swapchainProfile = requestedSwapchainProfile;
+
+	freeFrameCommandBuffers();
+	destroySyncObjects();
+
+	//The old swapchains are handed over so presentation can switch without a gap.
+	//The windows can't be resized, so the extents, the depth buffer and the offscreen target stay the same.
+	for (OutputWindow& output : outputs)
+	{
+		for (auto view : output.views)
+		{
+			logicalDevice.destroyImageView(view);
+		}
+		vk::SwapchainKHR oldSwapchain = output.swapchain;
+		output.capabilities = physicalDevice.getSurfaceCapabilitiesKHR(output.surface);
+		makeSwapchain(output, oldSwapchain);
+		logicalDevice.destroySwapchainKHR(oldSwapchain);
+	}
+	swapchainSettings = chooseSwapchainSettings(swapchainProfile, outputs[0].presentModes, outputs[0].capabilities);
+
+	int oldFramesInFlight = maxFramesInFlight;
+	maxFramesInFlight = static_cast<int>(swapchainSettings.framesInFlight);
+	frameNumber = 0;
+
+	createFrameCommandBuffers();
+	createSyncObjects();
+
+	//Everything kept per frame in flight has to follow the new count
+	if (maxFramesInFlight != oldFramesInFlight)
+	{
+		gpuCulling.destroy();
+		createCulling();
+		commandRecorder.destroy();
+		createCommandRecorder();
+		dynamicResolution.destroy();
+		createDynamicResolution();
+	}
+}
+
+void Application::createCommandRecorder()
+{
+	commandRecorder.init(logicalDevice, queueFamilies.graphicsFamily.value(), static_cast<uint32_t>(maxFramesInFlight), jobs);
+}
+
+void Application::createDynamicResolution()
+{
+	//Without timestamps the scene keeps rendering at full resolution
+	dynamicResolution.init(physicalDevice, logicalDevice, queueFamilies.graphicsFamily.value(), static_cast<uint32_t>(maxFramesInFlight));
+}
+
+void Application::setDynamicResolution(const DynamicResolutionSettings& settings)
+{
+	RenderCommand command;
+	command.type = RenderCommand::Type::DynamicResolution;
+	command.resolution = settings;
+	sendRenderCommand(command);
+}
+
 vk::Fence Application::makeFence()
 {
 	vk::FenceCreateInfo fenceInfo = {};
@@ -1233,7 +1607,7 @@ vk::Semaphore Application::makeSemaphore()
 	}
 }
 
-void Application::recordDrawCommands(vk::CommandBuffer commandBuffer, uint32_t imageIndex)
+bool Application::beginCommands(vk::CommandBuffer commandBuffer)
 {
 	vk::CommandBufferBeginInfo beginInfo = {};
 
@@ -1244,97 +1618,620 @@ void Application::recordDrawCommands(vk::CommandBuffer commandBuffer, uint32_t i
 	{
 #ifdef DEBUG_MODE
 		std::cout << "Failed to begin recording command buffer!" << std::endl;
+#endif 
+		return false;
+	}
+	return true;
+}
+
+void Application::endCommands(vk::CommandBuffer commandBuffer)
+{
+	try {
+		commandBuffer.end();
+	}
+	catch (vk::SystemError err) 
+	{
+#ifdef DEBUG_MODE
+		std::cout << "failed to record command buffer!" << std::endl;
 #endif 
 	}
+}
+
+void Application::recordComputeCommands(vk::CommandBuffer commandBuffer)
+{
+	beginCommands(commandBuffer);
 
-	vk::RenderPassBeginInfo renderPassInfo = {};
-	renderPassInfo.renderPass = renderpass;
-	renderPassInfo.framebuffer = swapchainFramebuffers[imageIndex];
-	renderPassInfo.renderArea.offset.x = 0;
-	renderPassInfo.renderArea.offset.y = 0;
-	renderPassInfo.renderArea.extent = swapchainExtent;
+	//The previous frame's scene is done with the depth buffer once its semaphore was waited on,
+	//this frame's scene only starts writing it again after this command buffer
+	if (depthPending)
+	{
+		gpuCulling.recordDepthPyramid(commandBuffer, depthRenderScale);
+	}
 
-	vk::ClearValue clearColor = { std::array<float, 4>{0.2f, 0.3f, 0.3f, 1.0f} };
-	renderPassInfo.clearValueCount = 1;
-	renderPassInfo.pClearValues = &clearColor;
+	const std::vector<glm::mat4>& models = frameScene.worldMatrices;
+	gpuCulling.upload(frameNumber, models.data(), models.size());
+	gpuCulling.recordCull(commandBuffer, frameNumber, frameScene.viewProjection, objectMesh.radius * TriangleScale,
+		lodSettings, float(renderExtent.height));
 
-	commandBuffer.beginRenderPass(&renderPassInfo, vk::SubpassContents::eInline);
+	endCommands(commandBuffer);
+}
 
-	commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+void Application::buildFrameGraph()
+{
+	frameGraph.reset();
+
+	//Color only lives from the scene to the blits, so the graph owns it. It is allocated at the full extent,
+	//dynamic resolution only changes how much of it is rendered to. Its first use waits for the previous
+	//frame's blits, which read the same memory.
+	RenderGraphImageDesc colorDesc;
+	colorDesc.extent = swapchainExtent;
+	colorDesc.format = swapchainFormat;
+	colorDesc.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+	colorDesc.aspect = vk::ImageAspectFlagBits::eColor;
+	RenderGraph::Resource color = frameGraph.createImage("offscreen color", colorDesc);
+	offscreenColor = color;
+	//Depth was last read by the previous frame's pyramid build, on this queue or on the compute queue
+	//before the semaphore the scene waits on. The scene clears it, so nothing is kept.
+	RenderGraph::Resource depth = frameGraph.importImage("depth", depthBuffer.image, depthBuffer.view,
+		vk::ImageAspectFlagBits::eDepth, RenderGraphAccess::SampledCompute, RenderGraphAccess::SampledCompute);
+	std::vector<RenderGraph::Resource> windowImages;
+	for (size_t i = 0; i < outputs.size(); ++i)
+	{
+		const OutputWindow& output = outputs[i];
+		windowImages.push_back(frameGraph.importImage("window " + std::to_string(i), output.images[output.imageIndex],
+			output.views[output.imageIndex], vk::ImageAspectFlagBits::eColor, RenderGraphAccess::Present, RenderGraphAccess::Present));
+	}
+
+	//Without a compute queue culling and the pyramid build run around the scene. They synchronize the
+	//buffers and the pyramid they own themselves, the graph only sees the depth buffer.
+	bool cullHere = gpuCulling.isEnabled() && !asyncCompute;
+	if (cullHere)
+	{
+		frameGraph.addPass("cull", SceneBatch, [](RenderGraph::PassBuilder& pass) { pass.sideEffects(); },
+			[this](vk::CommandBuffer commandBuffer) {
+				const std::vector<glm::mat4>& models = frameScene.worldMatrices;
+				gpuCulling.upload(frameNumber, models.data(), models.size());
+				gpuCulling.recordCull(commandBuffer, frameNumber, frameScene.viewProjection, objectMesh.radius * TriangleScale,
+					lodSettings, float(renderExtent.height));
+			});
+	}
+
+	frameGraph.addPass("scene", SceneBatch, [&](RenderGraph::PassBuilder& pass) {
+		if (sceneTarget.usesDynamicRendering())
+		{
+			pass.write(color, RenderGraphAccess::ColorAttachment, true);
+			pass.write(depth, RenderGraphAccess::DepthAttachment, true);
+		}
+		else
+		{
+			//The final layouts of makeRenderpass()
+			pass.renderPassAttachment(color, RenderGraphAccess::TransferSrc);
+			pass.renderPassAttachment(depth, RenderGraphAccess::SampledCompute);
+		}
+	}, [this](vk::CommandBuffer commandBuffer) { recordScene(commandBuffer); });
 
-	for (glm::vec3 position : trianglePositions)
+	if (cullHere)
 	{
-		glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
-		commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &model);
-		commandBuffer.draw(3, 1, 0, 0);
+		frameGraph.addPass("depth pyramid", SceneBatch, [&](RenderGraph::PassBuilder& pass) {
+			pass.read(depth, RenderGraphAccess::SampledCompute);
+			//The pyramid is for the next frame
+			pass.sideEffects();
+		}, [this](vk::CommandBuffer commandBuffer) { gpuCulling.recordDepthPyramid(commandBuffer, dynamicResolution.getScale()); });
 	}
 
-	commandBuffer.endRenderPass();
+	//Every window is written by the same pass, so their transitions go in one barrier before and one after the blits
+	frameGraph.addPass("blit to windows", OutputBatch, [&](RenderGraph::PassBuilder& pass) {
+		pass.read(color, RenderGraphAccess::TransferSrc);
+		for (RenderGraph::Resource windowImage : windowImages)
+		{
+			pass.write(windowImage, RenderGraphAccess::TransferDst, true);
+		}
+	}, [this](vk::CommandBuffer commandBuffer) { recordBlits(commandBuffer); });
 
-	try {
-		commandBuffer.end();
-	}
-	catch (vk::SystemError err) 
+	if (!frameGraph.compile())
 	{
 #ifdef DEBUG_MODE
-		std::cout << "failed to record command buffer!" << std::endl;
-#endif 
+		std::cout << "Failed to compile the frame graph!" << std::endl;
+#endif
+	}
+	updateOffscreenFramebuffer();
+}
+
+void Application::recordSceneCommands(vk::CommandBuffer commandBuffer)
+{
+	//Only the work that scales with the render resolution is timed. The blits wait for the swapchain
+	//image, with vsync that wait would count as render cost and push the scale down on an idle GPU.
+	dynamicResolution.recordBegin(commandBuffer, frameNumber);
+	frameGraph.execute(commandBuffer, SceneBatch);
+	dynamicResolution.recordEnd(commandBuffer, frameNumber);
+	depthRenderScale = dynamicResolution.getScale();
+}
+
+void Application::recordOutputCommands(vk::CommandBuffer commandBuffer)
+{
+	frameGraph.execute(commandBuffer, OutputBatch);
+}
+
+void Application::recordScene(vk::CommandBuffer commandBuffer)
+{
+	//Split long draw lists over threads, each thread records a secondary that continues the render pass
+	bool parallel = !gpuCulling.isEnabled() && commandRecorder.isEnabled() &&
+		drawPackets.size() >= 2 * commandRecorder.getMinDrawsPerThread();
+
+	if (parallel)
+	{
+		beginScene(commandBuffer, vk::SubpassContents::eSecondaryCommandBuffers);
+		const std::vector<vk::CommandBuffer>& secondaries = commandRecorder.record(frameNumber, sceneTarget,
+			offscreenFramebuffer, drawPackets.size(),
+			[this](vk::CommandBuffer secondary, size_t first, size_t count) { recordObjects(secondary, first, count); });
+		commandBuffer.executeCommands(secondaries);
+	}
+	else if (gpuCulling.isEnabled())
+	{
+		//One draw per level of detail, their instance counts were written by the culling shader
+		beginScene(commandBuffer, vk::SubpassContents::eInline);
+		setRenderViewport(commandBuffer);
+		vk::DeviceSize vertexOffset = 0;
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, instancedPipeline.pipeline);
+		commandBuffer.bindVertexBuffers(0, 1, &vertexBuffer.buffer, &vertexOffset);
+		gpuCulling.recordDraws(commandBuffer, instancedPipeline.layout, frameNumber);
+	}
+	else
+	{
+		beginScene(commandBuffer, vk::SubpassContents::eInline);
+		recordObjects(commandBuffer, 0, drawPackets.size());
+	}
+
+	endScene(commandBuffer);
+}
+
+void Application::beginScene(vk::CommandBuffer commandBuffer, vk::SubpassContents contents)
+{
+	//The whole target is cleared even when only renderExtent of it is drawn to. Depth outside of it
+	//stays at far, so the occlusion pyramid built from the whole depth buffer remains conservative.
+	vk::ClearValue clearValues[2];
+	clearValues[0].color = vk::ClearColorValue(std::array<float, 4>{0.2f, 0.3f, 0.3f, 1.0f});
+	clearValues[1].depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
+	vk::Rect2D renderArea(vk::Offset2D(0, 0), swapchainExtent);
+
+	if (!sceneTarget.usesDynamicRendering())
+	{
+		vk::RenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.renderPass = renderpass;
+		renderPassInfo.framebuffer = offscreenFramebuffer;
+		renderPassInfo.renderArea = renderArea;
+		renderPassInfo.clearValueCount = 2;
+		renderPassInfo.pClearValues = clearValues;
+		commandBuffer.beginRenderPass(&renderPassInfo, contents);
+		return;
+	}
+
+	//The frame graph made the layout transitions the render pass would have made
+	vk::RenderingAttachmentInfo colorAttachment = {};
+	colorAttachment.imageView = frameGraph.getView(offscreenColor);
+	colorAttachment.imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+	colorAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+	colorAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+	colorAttachment.clearValue = clearValues[0];
+
+	vk::RenderingAttachmentInfo depthAttachment = {};
+	depthAttachment.imageView = depthBuffer.view;
+	depthAttachment.imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+	depthAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+	depthAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+	depthAttachment.clearValue = clearValues[1];
+
+	vk::RenderingInfo renderingInfo = {};
+	renderingInfo.flags = contents == vk::SubpassContents::eSecondaryCommandBuffers ?
+		vk::RenderingFlagBits::eContentsSecondaryCommandBuffers : vk::RenderingFlags();
+	renderingInfo.renderArea = renderArea;
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachments = &colorAttachment;
+	renderingInfo.pDepthAttachment = &depthAttachment;
+	//The loader resolves the core or the KHR entry point, whichever the device has
+	commandBuffer.beginRendering(renderingInfo, dynamicloader);
+}
+
+void Application::endScene(vk::CommandBuffer commandBuffer)
+{
+	if (!sceneTarget.usesDynamicRendering())
+	{
+		commandBuffer.endRenderPass();
+		return;
+	}
+	commandBuffer.endRendering(dynamicloader);
+}
+
+void Application::recordBlits(vk::CommandBuffer commandBuffer)
+{
+	//Scale the rendered part up to the whole of every window's swapchain image
+	for (const OutputWindow& output : outputs)
+	{
+		vk::ImageBlit blit = {};
+		blit.srcSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+		blit.srcOffsets[1] = vk::Offset3D(int32_t(renderExtent.width), int32_t(renderExtent.height), 1);
+		blit.dstSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+		blit.dstOffsets[1] = vk::Offset3D(int32_t(output.extent.width), int32_t(output.extent.height), 1);
+		commandBuffer.blitImage(frameGraph.getImage(offscreenColor), vk::ImageLayout::eTransferSrcOptimal,
+			output.images[output.imageIndex], vk::ImageLayout::eTransferDstOptimal, blit, blitFilter);
+	}
+}
+
+void Application::setRenderViewport(vk::CommandBuffer commandBuffer) const
+{
+	vk::Viewport viewport(0.0f, 0.0f, float(renderExtent.width), float(renderExtent.height), 0.0f, 1.0f);
+	vk::Rect2D scissor(vk::Offset2D(0, 0), renderExtent);
+	commandBuffer.setViewport(0, viewport);
+	commandBuffer.setScissor(0, scissor);
+}
+
+void Application::recordObjects(vk::CommandBuffer commandBuffer, size_t first, size_t count)
+{
+	//Only reads state that doesn't change while recording, so it's safe to call from several threads
+	if (count == 0)
+	{
+		return;
+	}
+	//Secondaries don't inherit dynamic state from the primary
+	setRenderViewport(commandBuffer);
+	vk::DeviceSize vertexOffset = 0;
+	commandBuffer.bindVertexBuffers(0, 1, &vertexBuffer.buffer, &vertexOffset);
+
+	//Indexed by the pipeline field of the sort keys
+	const vk::Pipeline pipelines[] = { pipeline };
+	uint32_t boundPipeline = UINT32_MAX;
+
+	//The range may start in the middle of a batch
+	auto batch = std::upper_bound(drawBatches.begin(), drawBatches.end(), first,
+		[](size_t index, const DrawBatch& candidate) { return index < candidate.first; }) - 1;
+
+	const std::vector<glm::mat4>& models = frameScene.worldMatrices;
+	size_t end = first + count;
+	for (size_t i = first; i < end; ++batch)
+	{
+		uint64_t key = drawPackets[i].key;
+		if (sortKeyPipeline(key) != boundPipeline)
+		{
+			boundPipeline = sortKeyPipeline(key);
+			commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines[boundPipeline]);
+		}
+
+		const MeshLod& lod = objectMesh.levels[sortKeyMesh(key)];
+		size_t batchEnd = std::min(end, size_t(batch->first) + batch->count);
+		for (; i < batchEnd; ++i)
+		{
+			commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &models[drawPackets[i].object]);
+			commandBuffer.draw(lod.vertexCount, 1, lod.firstVertex, 0);
+		}
 	}
 }
 
 void Application::createScene()
 {
-	for (float x = -1.0f; x < 1.0f; x += 0.2f)
+	//The first triangle of every row is the parent of the rest of it,
+	//so moving a row only touches that subtree
+	for (float y = -1.0f; y < 1.0f; y += 0.2f)
 	{
-		for (float y = -1.0f; y < 1.0f; y += 0.2f)
+		uint32_t row = scene.addNode(SceneGraph::NoParent, glm::vec3(-1.0f, y, 0.0f));
+		entities.create(SceneNode{ row });
+		for (int column = 1; column < 10; ++column)
 		{
-			trianglePositions.push_back(glm::vec3(x, y, 0.0f));
+			uint32_t node = scene.addNode(row, glm::vec3(column * 0.2f, 0.0f, 0.0f));
+			entities.create(SceneNode{ node }, Spin{ 0.0f, 0.25f * column });
 		}
 	}
 }
 
 void Application::update()
 {
+	//Input is sampled here, the snapshot carries the timestamps to the frame that draws it
+	FrameLatency stepLatency = latency.sampleInput();
+
+	double now = glfwGetTime();
+	float deltaTime = lastUpdateTime > 0.0 ? float(now - lastUpdateTime) : 0.0f;
+	lastUpdateTime = now;
+
+	//Walks the Spin arrays chunk by chunk, the angle update vectorizes
+	entities.forEachChunk<SceneNode, Spin>([&](size_t count, Entity*, SceneNode* nodes, Spin* spins) {
+		for (size_t i = 0; i < count; ++i)
+		{
+			spins[i].angle += spins[i].speed * deltaTime;
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			scene.setRotation(nodes[i].node, glm::angleAxis(spins[i].angle, glm::vec3(0.0f, 0.0f, 1.0f)));
+		}
+	});
+
+	//Only subtrees whose local transforms changed since the last step are recomputed
+	size_t moved = scene.update(&jobs);
+	if (moved > 0)
+	{
+		++transformVersion;
+	}
+
+	//Input is read from the first window, the others only mirror it
+	GLFWwindow* window = outputs[0].window;
+
+	//Picking needs the hierarchy, which the render thread keeps
+	bool pick = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+	if (pick && !pickPressed)
+	{
+		RenderCommand command;
+		command.type = RenderCommand::Type::Pick;
+		glfwGetCursorPos(window, &command.cursorX, &command.cursorY);
+		sendRenderCommand(command);
+	}
+	pickPressed = pick;
+
+	//1, 2 and 3 pick the swapchain profile, it's applied before the next frame
+	if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
+	{
+		setSwapchainProfile(SwapchainProfile::LowestLatency);
+	}
+	else if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
+	{
+		setSwapchainProfile(SwapchainProfile::VsyncThroughput);
+	}
+	else if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
+	{
+		setSwapchainProfile(SwapchainProfile::TearAllowed);
+	}
+
+	//Written into the buffer the render thread isn't reading, it picks the snapshot up with its next frame
+	SceneSnapshot& snapshot = sceneSnapshots.beginWrite();
+	snapshot.worldMatrices = scene.getWorldMatrices();
+	snapshot.viewProjection = viewProjection;
+	snapshot.transformVersion = transformVersion;
+	snapshot.latency = stepLatency;
+	sceneSnapshots.publish();
+}
+
+void Application::prepareFrame()
+{
+	//Copied out right away, so the window thread can reuse the buffer while this frame is built.
+	//Only the first frame to draw a snapshot is measured, it carries the timestamps until it is presented.
+	frameLatency = FrameLatency();
+	if (const SceneSnapshot* snapshot = sceneSnapshots.acquire())
+	{
+		if (snapshot->sequence != frameScene.sequence)
+		{
+			frameScene = *snapshot;
+			frameLatency = latency.beginFrame(frameScene.latency);
+		}
+		sceneSnapshots.release();
+	}
+
+	//The hierarchy is refit when something moved and rebuilt when objects were added or removed
+	const std::vector<glm::mat4>& worlds = frameScene.worldMatrices;
+	if (frameScene.transformVersion != boundsVersion || sceneBvh.size() != worlds.size())
+	{
+		objectBounds.fromWorldMatrices(worlds.data(), worlds.size(), objectMesh.radius * TriangleScale);
+		if (sceneBvh.size() != worlds.size())
+		{
+			sceneBvh.build(objectBounds, &jobs);
+		}
+		else
+		{
+			sceneBvh.refit(objectBounds);
+		}
+		boundsVersion = frameScene.transformVersion;
+	}
+
+	RenderCommand command;
+	while (renderCommands.pop(command))
+	{
+		executeRenderCommand(command);
+	}
 
+	//The GPU path culls while recording, see recordSceneCommands() and recordComputeCommands()
+	if (gpuCulling.isEnabled())
+	{
+		return;
+	}
+
+	//Only what is inside the view frustum gets recorded, at the detail its size on screen needs
+	sceneBvh.cullFrustum(Frustum::fromMatrix(frameScene.viewProjection), visibleObjects);
+	lodSelector.select(objectMesh, lodSettings, frameScene.viewProjection, float(renderExtent.height),
+		worlds, visibleObjects, visibleLevels, &jobs);
+
+	//Every visible object becomes a packet keyed by its state and depth. Sorting groups draws that
+	//share a pipeline and mesh, so recording only binds when the batch changes.
+	drawPackets.resize(visibleObjects.size());
+	jobs.parallelFor(visibleObjects.size(), 4096, [&](size_t first, size_t end) {
+		for (size_t i = first; i < end; ++i)
+		{
+			uint32_t object = visibleObjects[i];
+			glm::vec4 clip = frameScene.viewProjection * worlds[object][3];
+			float depth = clip.w > 0.0f ? clip.z / clip.w : 0.0f;
+			drawPackets[i] = { makeSortKey(0, 0, 0, visibleLevels[i], depth), object, visibleLevels[i] };
+		}
+	});
+	sortDrawPackets(drawPackets, drawPacketScratch, &jobs);
+	buildDrawBatches(drawPackets, drawBatches);
+}
+
+void Application::sendRenderCommand(const RenderCommand& command)
+{
+	//The window thread must never wait on the render thread, a full queue drops the command
+	if (!renderCommands.push(command))
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Render command queue is full, dropped a command" << std::endl;
+#endif
+	}
+}
+
+void Application::executeRenderCommand(const RenderCommand& command)
+{
+	switch (command.type)
+	{
+	case RenderCommand::Type::Pick:
+	{
+		uint32_t picked = pickObject(command.cursorX, command.cursorY);
+#ifdef DEBUG_MODE
+		if (picked != UINT32_MAX)
+		{
+			std::cout << "Picked object " << picked << std::endl;
+		}
+#endif
+		break;
+	}
+	case RenderCommand::Type::SwapchainProfile:
+		requestedSwapchainProfile = command.profile;
+		break;
+	case RenderCommand::Type::FrameRateLimit:
+		frameLimiter.setTargetFrameRate(command.framesPerSecond);
+		break;
+	case RenderCommand::Type::DynamicResolution:
+		dynamicResolution.setSettings(command.resolution);
+		break;
+	}
+}
+
+uint32_t Application::pickObject(double cursorX, double cursorY) const
+{
+	//Unproject the cursor at the near and far plane, Vulkan clip depth is [0, 1]
+	glm::vec2 ndc(2.0f * float(cursorX) / swapchainExtent.width - 1.0f, 2.0f * float(cursorY) / swapchainExtent.height - 1.0f);
+	glm::mat4 inverse = glm::inverse(frameScene.viewProjection);
+	glm::vec4 nearPoint = inverse * glm::vec4(ndc, 0.0f, 1.0f);
+	glm::vec4 farPoint = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+	return sceneBvh.raycast(origin, direction);
 }
 
 void Application::render()
 {
+	//Switching profiles waits for the GPU, so it only happens between frames
+	if (requestedSwapchainProfile != swapchainProfile)
+	{
+		recreateSwapchain();
+	}
+
 	//ȴһύGPUִ
 	logicalDevice.waitForFences(1, &inFlightFence[frameNumber], VK_TRUE, UINT64_MAX);
 	//ã׼һύ
 	logicalDevice.resetFences(1, &inFlightFence[frameNumber]);
 
+	//The frame that last used this slot is finished, so its GPU time is known
+	dynamicResolution.update(frameNumber);
+	renderExtent = dynamicResolution.getRenderExtent(swapchainExtent);
+
+	swapOptimizedPipelines();
+
 	//ȡǰõĽͼ
-	uint32_t imageIndex{ logicalDevice.acquireNextImageKHR(swapchain, UINT64_MAX, imageAvailable[frameNumber], nullptr).value};
+	//Every window's image is acquired before anything is recorded, the frame goes to all of them at once
+	{
+		std::lock_guard<std::mutex> swapchainLock(latency.getSwapchainMutex());
+		for (OutputWindow& output : outputs)
+		{
+			output.imageIndex = logicalDevice.acquireNextImageKHR(output.swapchain, UINT64_MAX,
+				output.imageAvailable[frameNumber], nullptr).value;
+		}
+	}
 	//commandbuffer
-	vk::CommandBuffer commandBuffer = swapchainCmdBuffers[imageIndex];
+	vk::CommandBuffer commandBuffer = swapchainCmdBuffers[frameNumber];
+	vk::CommandBuffer outputBuffer = outputCmdBuffers[frameNumber];
 	commandBuffer.reset();
+	outputBuffer.reset();
+
+	//Culling for this frame starts on the compute queue while the previous frame's blits may still run.
+	//Its wait on the previous scene is what lets the depth pyramid read that frame's depth buffer.
+	if (asyncCompute)
+	{
+		vk::CommandBuffer computeBuffer = computeCmdBuffers[frameNumber];
+		computeBuffer.reset();
+		recordComputeCommands(computeBuffer);
+
+		int previousFrame = (frameNumber + maxFramesInFlight - 1) % maxFramesInFlight;
+		vk::PipelineStageFlags depthWaitStage = vk::PipelineStageFlagBits::eComputeShader;
+		vk::SubmitInfo computeSubmit = {};
+		if (depthPending)
+		{
+			computeSubmit.waitSemaphoreCount = 1;
+			computeSubmit.pWaitSemaphores = &sceneFinished[previousFrame];
+			computeSubmit.pWaitDstStageMask = &depthWaitStage;
+		}
+		computeSubmit.commandBufferCount = 1;
+		computeSubmit.pCommandBuffers = &computeBuffer;
+		computeSubmit.signalSemaphoreCount = 1;
+		computeSubmit.pSignalSemaphores = &cullFinished[frameNumber];
+		try
+		{
+			computeQueue.submit(computeSubmit, nullptr);
+		}
+		catch (vk::SystemError err)
+		{
+#ifdef DEBUG_MODE
+			std::cout << "failed to submit compute command buffer!" << std::endl;
+#endif
+		}
+	}
 
 	//¼
-	recordDrawCommands(commandBuffer, imageIndex);
+	buildFrameGraph();
+	beginCommands(commandBuffer);
+	recordSceneCommands(commandBuffer);
+	endCommands(commandBuffer);
+	beginCommands(outputBuffer);
+	recordOutputCommands(outputBuffer);
+	endCommands(outputBuffer);
 
 	//ύGPU
 	vk::SubmitInfo submitInfo = {};
 	//õȴȷͼúִл
-	vk::Semaphore waitSemaphores[] = { imageAvailable[frameNumber]};
+	std::vector<vk::Semaphore> waitSemaphores;
+	std::vector<vk::PipelineStageFlags> waitStages;
+	std::vector<vk::Semaphore> signalSemaphores;
+	std::vector<vk::SwapchainKHR> swapChains;
+	std::vector<uint32_t> imageIndices;
+	for (const OutputWindow& output : outputs)
+	{
+		waitSemaphores.push_back(output.imageAvailable[frameNumber]);
+		//Nothing touches the swapchain images before the blits
+		waitStages.push_back(vk::PipelineStageFlagBits::eTransfer);
+		signalSemaphores.push_back(output.renderFinished[output.imageIndex]);
+		swapChains.push_back(output.swapchain);
+		imageIndices.push_back(output.imageIndex);
+	}
 	//ColorAttachmentoutput׶ε
-	vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
 
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.pCommandBuffers = &outputBuffer;
 
 	//ź
-	vk::Semaphore signalSemaphores[] = { renderFinished[frameNumber]};
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
+	submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+	submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+	//The scene batch goes first. With culling on the compute queue it waits for the results before
+	//anything reads them or writes depth, and tells the next frame's pyramid when the depth is done.
+	//The frame graph's barrier on the depth buffer waits for the compute stage, which the wait includes.
+	vk::PipelineStageFlags cullWaitStage = vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader |
+		vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests |
+		vk::PipelineStageFlagBits::eComputeShader;
+	vk::SubmitInfo sceneSubmit = {};
+	sceneSubmit.commandBufferCount = 1;
+	sceneSubmit.pCommandBuffers = &commandBuffer;
+	if (asyncCompute)
+	{
+		sceneSubmit.waitSemaphoreCount = 1;
+		sceneSubmit.pWaitSemaphores = &cullFinished[frameNumber];
+		sceneSubmit.pWaitDstStageMask = &cullWaitStage;
+		sceneSubmit.signalSemaphoreCount = 1;
+		sceneSubmit.pSignalSemaphores = &sceneFinished[frameNumber];
+	}
+	vk::SubmitInfo submits[] = { sceneSubmit, submitInfo };
 
 	try {
 		//inFlightFence ύЩύGPUִ
-		graphicsQueue.submit(submitInfo, inFlightFence[frameNumber]);
+		graphicsQueue.submit(submits, inFlightFence[frameNumber]);
+		depthPending = asyncCompute;
 	}
 	catch (vk::SystemError err) {
 #ifdef DEBUG_MODE
@@ -1344,30 +2241,118 @@ void Application::render()
 
 	//ͼֵĻ
 	vk::PresentInfoKHR presentInfo = {};
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;//Ⱦ
+	presentInfo.waitSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+	presentInfo.pWaitSemaphores = signalSemaphores.data();//Ⱦ
 	
-	vk::SwapchainKHR swapChains[] = { swapchain };
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = swapChains;
-	presentInfo.pImageIndices = &imageIndex;
+	//One present call for every window, so they all flip together
+	std::vector<vk::Result> presentResults(outputs.size());
+	presentInfo.swapchainCount = static_cast<uint32_t>(swapChains.size());
+	presentInfo.pSwapchains = swapChains.data();
+	presentInfo.pImageIndices = imageIndices.data();
+	presentInfo.pResults = presentResults.data();
+
+	//The id lets the latency tracker wait for this exact present, it follows the first window. 0 is no id.
+	std::vector<uint64_t> presentIds(outputs.size(), 0);
+	uint64_t presentId = latency.nextPresentId();
+	presentIds[0] = presentId;
+	vk::PresentIdKHR presentIdInfo(static_cast<uint32_t>(presentIds.size()), presentIds.data());
+	if (latency.usesPresentWait())
+	{
+		presentInfo.pNext = &presentIdInfo;
+	}
 	//ͼύ presentQueue 
-	presentQueue.presentKHR(presentInfo);
+	{
+		std::lock_guard<std::mutex> swapchainLock(latency.getSwapchainMutex());
+		presentQueue.presentKHR(presentInfo);
+	}
+#ifdef DEBUG_MODE
+	for (size_t i = 0; i < presentResults.size(); ++i)
+	{
+		if (presentResults[i] != vk::Result::eSuccess)
+		{
+			std::cout << "Present to window " << i << ": " << vk::to_string(presentResults[i]) << std::endl;
+		}
+	}
+#endif
+	latency.framePresented(outputs[0].swapchain, presentId, frameLatency);
 
 	frameNumber = (frameNumber + 1) % maxFramesInFlight;
+	++frameCount;
 }
 
 void Application::run()
 {
-	while (!glfwWindowShouldClose(window))
+	//The first frame needs a snapshot to draw
+	update();
+	rendering = true;
+	renderThread = std::thread(&Application::renderLoop, this);
+
+	//Events are handled as soon as they arrive, the simulation steps at a fixed rate in between.
+	//A slow event never holds up a frame, the render thread just draws the latest snapshot again.
+	double step = 1.0 / simulationRate;
+	double nextUpdate = glfwGetTime() + step;
+	//Closing any of the windows ends the program
+	auto anyWindowClosed = [this]() {
+		return std::any_of(outputs.begin(), outputs.end(),
+			[](const OutputWindow& output) { return glfwWindowShouldClose(output.window) != 0; });
+	};
+	while (!anyWindowClosed())
+	{
+		double timeout = nextUpdate - glfwGetTime();
+		if (timeout > 0.0)
+		{
+			glfwWaitEventsTimeout(timeout);
+		}
+		else
+		{
+			glfwPollEvents();
+		}
+
+		double now = glfwGetTime();
+		if (now >= nextUpdate)
+		{
+			update();
+			//Skips steps instead of catching up after a long stall
+			nextUpdate = std::max(nextUpdate + step, now);
+		}
+
+		FrameStatus status;
+		while (frameStatus.pop(status))
+		{
+			std::stringstream sstitle;
+			sstitle << title << " Running at " << status.framerate << " fps, " << status.presentMilliseconds << " ms to present, "
+				<< int(status.resolutionScale * 100.0f + 0.5f) << "% resolution.";
+			for (const OutputWindow& output : outputs)
+			{
+				glfwSetWindowTitle(output.window, sstitle.str().c_str());
+			}
+		}
+	}
+
+	rendering = false;
+	renderThread.join();
+}
+
+void Application::renderLoop()
+{
+	while (rendering)
 	{
-		glfwPollEvents();
-		update();
+		//Waiting before the snapshot is taken starts every frame with the freshest state
+		frameLimiter.wait();
+		prepareFrame();
 		render();
 		calculateFrameRate();
 	}
 }
 
+void Application::setFrameRateLimit(double framesPerSecond)
+{
+	RenderCommand command;
+	command.type = RenderCommand::Type::FrameRateLimit;
+	command.framesPerSecond = framesPerSecond;
+	sendRenderCommand(command);
+}
+
 void Application::calculateFrameRate()
 {
 	currentTime = glfwGetTime();
@@ -1376,60 +2361,97 @@ void Application::calculateFrameRate()
 	if (delta >= 1)
 	{
 		int framerate{ std::max(1, int(numFrames / delta)) };
-		std::stringstream sstitle;
-		sstitle << title << " Running at " << framerate << " fps.";
-		glfwSetWindowTitle(window, sstitle.str().c_str());
+		LatencyHistogram inputToPresent, frameToPresent;
+		latency.takeHistograms(inputToPresent, frameToPresent);
+
+		//Only the window thread may set the title
+		FrameStatus status;
+		status.framerate = framerate;
+		status.presentMilliseconds = float(frameToPresent.percentile(0.5));
+		status.resolutionScale = dynamicResolution.getScale();
+		frameStatus.push(status);
 		lastTime = currentTime;
 		numFrames = -1;
 		frameTime = float(1000.0 / framerate);
+
+#ifdef DEBUG_MODE
+		const LodStatistics& lodStatistics = gpuCulling.isEnabled() ? gpuCulling.getStatistics() : lodSelector.getStatistics();
+		std::cout << "LOD objects per level:";
+		for (uint32_t objects : lodStatistics.objectsPerLevel)
+		{
+			std::cout << ' ' << objects;
+		}
+		std::cout << ", triangles " << lodStatistics.triangles << " of " << lodStatistics.fullDetailTriangles << std::endl;
+
+		auto printLatency = [](const char* name, const LatencyHistogram& histogram) {
+			std::cout << name << " latency over " << histogram.count() << " frames: mean " << histogram.mean()
+				<< " ms, p50 " << histogram.percentile(0.5) << " ms, p95 " << histogram.percentile(0.95)
+				<< " ms, p99 " << histogram.percentile(0.99) << " ms, max " << histogram.max() << " ms" << std::endl;
+		};
+		printLatency("Input to present", inputToPresent);
+		printLatency("Frame to present", frameToPresent);
+#endif
 	}
 	++numFrames;
 }
 
 Application::~Application()
 {
+	if (renderThread.joinable())
+	{
+		rendering = false;
+		renderThread.join();
+	}
 	logicalDevice.waitIdle();
 #ifdef DEBUG_MODE
 	std::cout << "Destroy a graphics Application!\n";
 #endif 
+	latency.destroy();
 
 	logicalDevice.freeCommandBuffers(cmdPool, 1, &mainCmdBuffer);
-	logicalDevice.freeCommandBuffers(cmdPool, swapchainCmdBuffers);
+	freeFrameCommandBuffers();
 	logicalDevice.destroyCommandPool(cmdPool);
-
-	logicalDevice.destroyPipeline(pipeline);
-	logicalDevice.destroyPipelineLayout(pipelineLayout);
-	logicalDevice.destroyRenderPass(renderpass);
-
-	for (auto frame : swapchainFrames)
-	{
-		logicalDevice.destroyImageView(frame);
-	}
-
-	for (auto framebuffer : swapchainFramebuffers)
+	if (computeCmdPool)
 	{
-		logicalDevice.destroyFramebuffer(framebuffer);
+		logicalDevice.destroyCommandPool(computeCmdPool);
 	}
 
-	for (auto fence : inFlightFence)
+	commandRecorder.destroy();
+	gpuCulling.destroy();
+	dynamicResolution.destroy();
+	frameGraph.destroy();
+	pipelineLibrary.destroy();
+	for (auto& retired : retiredPipelines)
 	{
-		logicalDevice.destroyFence(fence);
+		logicalDevice.destroyPipeline(retired.first);
 	}
-	
-	for (auto imageSem : imageAvailable)
+	for (auto& cached : pipelines)
 	{
-		logicalDevice.destroySemaphore(imageSem);
+		logicalDevice.destroyPipeline(cached.second.pipeline);
 	}
+	pipelineLayouts.destroy(logicalDevice);
+	shaderModules.destroy(logicalDevice);
+	logicalDevice.destroyRenderPass(renderpass);
+	destroyBuffer(logicalDevice, vertexBuffer);
+	logicalDevice.destroyFramebuffer(offscreenFramebuffer);
+	destroyImage(logicalDevice, depthBuffer);
 
-	for (auto renderSem : renderFinished)
+	destroySyncObjects();
+
+	for (OutputWindow& output : outputs)
 	{
-		logicalDevice.destroySemaphore(renderSem);
+		for (auto view : output.views)
+		{
+			logicalDevice.destroyImageView(view);
+		}
+		logicalDevice.destroySwapchainKHR(output.swapchain);
 	}
-
-	logicalDevice.destroySwapchainKHR(swapchain);
 	logicalDevice.destroy();
 
-	instance.destroySurfaceKHR(surface);
+	for (OutputWindow& output : outputs)
+	{
+		instance.destroySurfaceKHR(output.surface);
+	}
 #ifdef DEBUG_MODE
 	instance.destroyDebugUtilsMessengerEXT(debugMessenger, nullptr, dynamicloader);
 #endif
@@ -5,29 +5,134 @@
 #include <vulkan/vulkan.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
 
-struct QueueFamilyIndices;
+#include "pipeline.h"
+#include "pipeline_library.h"
+#include "dynamic_rendering.h"
+#include "render_graph.h"
+#include "swapchain_profile.h"
+#include "queue_families.h"
+#include "latency.h"
+#include "frame_limiter.h"
+#include "dynamic_resolution.h"
+#include "scene_graph.h"
+#include "culling.h"
+#include "bvh.h"
+#include "lod.h"
+#include "draw_sort.h"
+#include "job_system.h"
+#include "ecs.h"
+#include "spsc_queue.h"
+#include "scene_snapshot.h"
+#include "command_recorder.h"
+#include "gpu_resources.h"
+#include "gpu_culling.h"
 
-struct ObjectData
+//Components of the demo's objects
+//Links an entity to its node in the scene graph, which owns the transforms
+struct SceneNode
 {
-	glm::mat4 model;
+	uint32_t node;
+};
+
+//Turns an object around its own z axis
+struct Spin
+{
+	float angle;
+	//Radians per second
+	float speed;
+};
+
+//Requests from the window thread to the render thread
+struct RenderCommand
+{
+	enum class Type
+	{
+		Pick,
+		SwapchainProfile,
+		FrameRateLimit,
+		DynamicResolution
+	};
+	Type type;
+	//Window position for Pick
+	double cursorX{ 0.0 };
+	double cursorY{ 0.0 };
+	SwapchainProfile profile{ SwapchainProfile::VsyncThroughput };
+	double framesPerSecond{ 0.0 };
+	DynamicResolutionSettings resolution;
+};
+
+//What the render thread reports back to the window thread once a second, for the title
+struct FrameStatus
+{
+	int framerate;
+	float presentMilliseconds;
+	float resolutionScale;
+};
+
+//A window and the swapchain presenting to it. The windows share the device, the pipelines and the
+//rendered frame, which is scaled into each of their swapchain images and presented with one call.
+struct OutputWindow
+{
+	GLFWwindow* window{ nullptr };
+	vk::SurfaceKHR surface{ nullptr };
+	vk::SurfaceCapabilitiesKHR capabilities;
+	std::vector<vk::SurfaceFormatKHR> formats;
+	std::vector<vk::PresentModeKHR> presentModes;
+	vk::SwapchainKHR swapchain{ nullptr };
+	vk::Format format{ vk::Format::eUndefined };
+	vk::Extent2D extent;
+	std::vector<vk::Image> images;
+	std::vector<vk::ImageView> views;
+	//One per frame in flight
+	std::vector<vk::Semaphore> imageAvailable;
+	//One per swapchain image, presentation may still wait on it after its frame slot is reused
+	std::vector<vk::Semaphore> renderFinished;
+	//Acquired for the frame being recorded
+	uint32_t imageIndex{ 0 };
+};
+
+//Matches the inputs of vertex.vert and instanced.vert
+struct Vertex
+{
+	glm::vec2 position;
+	glm::vec3 color;
 };
 
 
 class Application
 {
 public:
-	Application();
+	//Every window shows the same scene, the first one takes the input
+	explicit Application(uint32_t windowCount = 1);
 	~Application();
 public:
+	//Handles window events and the simulation on the calling thread while another thread renders
 	void run();
+	//Caps rendering at this many frames per second, 0 for no cap
+	void setFrameRateLimit(double framesPerSecond);
+	//Bounds and GPU time budget of the render resolution, takes effect with the next frame
+	void setDynamicResolution(const DynamicResolutionSettings& settings);
 protected:
+	//One simulation step on the window thread, ends by publishing a scene snapshot
 	virtual void update();
+	//One frame on the render thread, from the latest scene snapshot
 	virtual void render();
 
 	virtual std::string getVertexFilepath();
 	virtual std::string getFragmentFilepath();
+	virtual GraphicsPipelineKey getPipelineKey();
 	virtual void createScene();
+
+	//Depth-first scene index of the object under a window position, UINT32_MAX for none
+	uint32_t pickObject(double cursorX, double cursorY) const;
+	//Takes effect at the start of the next frame
+	void setSwapchainProfile(SwapchainProfile profile);
+	//Queued for the render thread, which runs it at the start of its next frame
+	void sendRenderCommand(const RenderCommand& command);
 private:
 	int width{ 640 };
 	int height{ 480 };
@@ -35,41 +140,140 @@ private:
 	int numFrames;
 	std::string title{ "VulkanDemo" };
 
-	GLFWwindow* window{ nullptr };
+	//Workers for update, culling and recording, the main thread is worker 0
+	JobSystem jobs;
+
+	//The window thread polls events and simulates, the render thread culls, records and presents.
+	//They only talk through the queues and the snapshots, so neither waits for the other.
+	std::thread renderThread;
+	std::atomic<bool> rendering{ false };
+	SpscQueue<RenderCommand, 256> renderCommands;
+	SpscQueue<FrameStatus, 16> frameStatus;
+	SceneSnapshotBuffer sceneSnapshots;
+	//Simulation steps per second on the window thread
+	double simulationRate{ 240.0 };
+
 	vk::Instance instance{ nullptr };
 	vk::DebugUtilsMessengerEXT debugMessenger{ nullptr };
 	vk::DispatchLoaderDynamic dynamicloader;
+	uint32_t apiVersion{ VK_API_VERSION_1_0 };
 
 	vk::PhysicalDevice physicalDevice{ nullptr };
 	vk::Device logicalDevice{ nullptr };
+	QueueFamilies queueFamilies;
 	vk::Queue graphicsQueue{ nullptr };
 	vk::Queue presentQueue{ nullptr };
+	//The same queue as graphicsQueue when the device has no family of their own for them
+	vk::Queue computeQueue{ nullptr };
+	vk::Queue transferQueue{ nullptr };
 
-	vk::SwapchainKHR swapchain{ nullptr };
+	std::vector<OutputWindow> outputs;
+	//Of the first window's swapchain, the depth buffer and the offscreen target match it
 	vk::Format swapchainFormat;
 	vk::Extent2D swapchainExtent;
-	vk::SurfaceKHR surface;
-	vk::SurfaceCapabilitiesKHR capabilities;
-	std::vector<vk::SurfaceFormatKHR> formats; 
-	std::vector<vk::PresentModeKHR> presentModes;
-	std::vector<vk::Image> swapchainImages{ nullptr };
-	std::vector<vk::ImageView> swapchainFrames;
-	std::vector<vk::Framebuffer> swapchainFramebuffers;
+	//Per frame in flight: the scene goes in the first, the blits to the windows in the second.
+	//They are two batches of one submit, so the compute queue can start on the next frame in between.
 	std::vector<vk::CommandBuffer> swapchainCmdBuffers;
+	std::vector<vk::CommandBuffer> outputCmdBuffers;
 	std::vector<vk::Fence> inFlightFence;
-	std::vector<vk::Semaphore> imageAvailable;
-	std::vector<vk::Semaphore> renderFinished;
+	//The frame as passes over the images they use, described again every frame by buildFrameGraph().
+	//Its passes are recorded into the scene and the output command buffer as these two batches.
+	static const uint32_t SceneBatch = 0;
+	static const uint32_t OutputBatch = 1;
+	RenderGraph frameGraph;
+	SwapchainProfile swapchainProfile{ SwapchainProfile::VsyncThroughput };
+	SwapchainProfile requestedSwapchainProfile{ SwapchainProfile::VsyncThroughput };
+	//Chosen for the first window, its frames in flight apply to every window
+	SwapchainSettings swapchainSettings;
+
+	//Input and frame to present latency, sampled in update() and finished after the present
+	bool presentWaitSupported{ false };
+	LatencyTracker latency;
+	FrameLatency frameLatency;
+	FrameLimiter frameLimiter;
+
+	vk::Format depthFormat{ vk::Format::eUndefined };
+	//Shared by every frame in flight, the render pass dependencies order the frames' accesses.
+	//Shared with the compute family as well when the depth pyramid is built on the compute queue.
+	Image depthBuffer;
+	//The scene renders into the top left renderExtent of these and is scaled up into the swapchain image.
+	//The color target is a transient of frameGraph, offscreenFramebuffer is made again whenever it is.
+	RenderGraph::Resource offscreenColor{ 0 };
+	vk::Framebuffer offscreenFramebuffer{ nullptr };
+	uint64_t offscreenFramebufferVersion{ 0 };
+	vk::Filter blitFilter{ vk::Filter::eNearest };
+	vk::Extent2D renderExtent;
+	DynamicResolution dynamicResolution;
 
 	vk::PipelineLayout pipelineLayout;
 	vk::RenderPass renderpass;
 	vk::Pipeline pipeline;
+	std::unordered_map<GraphicsPipelineKey, GraphicsPipeline, GraphicsPipelineKeyHash> pipelines;
+	PipelineLayoutCache pipelineLayouts;
+	ShaderModuleCache shaderModules;
+	GraphicsPipelineKey defaultPipelineKey;
+	bool pipelineLibrarySupported{ false };
+	//Without it renderpass and offscreenFramebuffer stay null, see beginScene()
+	bool dynamicRenderingSupported{ false };
+	RenderTargetLayout sceneTarget;
+	GraphicsPipelineLibrary pipelineLibrary;
+	//Fast linked pipelines replaced by their optimized version, with the frame they were retired in
+	std::vector<std::pair<vk::Pipeline, uint64_t>> retiredPipelines;
 
 	vk::CommandPool cmdPool;
 	vk::CommandBuffer mainCmdBuffer;
+	//GPU culling runs on computeQueue when the device has a family for it, otherwise it is
+	//recorded into the scene command buffer on graphicsQueue
+	bool asyncCompute{ false };
+	vk::CommandPool computeCmdPool{ nullptr };
+	std::vector<vk::CommandBuffer> computeCmdBuffers;
+	//Per frame in flight, culling to the scene and the scene to the next frame's depth pyramid
+	std::vector<vk::Semaphore> cullFinished;
+	std::vector<vk::Semaphore> sceneFinished;
+	//The previous frame's scene signaled its sceneFinished, its depth goes into the next pyramid
+	bool depthPending{ false };
+	float depthRenderScale{ 1.0f };
+	//Long draw lists are recorded into secondaries on several threads
+	ParallelCommandRecorder commandRecorder;
 
 	int maxFramesInFlight, frameNumber;
+	uint64_t frameCount{ 0 };
+
+	//Every object draws this mesh, its levels of detail share one vertex buffer
+	LodMesh objectMesh;
+	Buffer vertexBuffer;
+
+	//Every object is an entity, the scene graph holds the transforms of those with a SceneNode.
+	//Only the window thread touches these.
+	EntityStore entities;
+	SceneGraph scene;
+	double lastUpdateTime{ 0.0 };
+	uint64_t transformVersion{ 0 };
+	//The demo shaders place objects straight in clip space, so the frustum is the clip volume
+	glm::mat4 viewProjection{ 1.0f };
+	bool pickPressed{ false };
 
-	std::vector<glm::vec3> trianglePositions;
+	//The render thread's copy of the latest snapshot, everything below is render thread only
+	SceneSnapshot frameScene;
+	//transformVersion of the snapshot objectBounds was last computed from
+	uint64_t boundsVersion{ 0 };
+	BoundingSpheres objectBounds;
+	//Over objectBounds, refit whenever the scene moves and rebuilt when objects are added
+	Bvh sceneBvh;
+	//Depth-first scene indices that passed culling this frame, only these are recorded
+	std::vector<uint32_t> visibleObjects;
+	//Level of detail of every visible object, indexed like visibleObjects
+	std::vector<uint8_t> visibleLevels;
+	//Visible objects as packets sorted by state and depth, and the runs of them that share a state
+	std::vector<DrawPacket> drawPackets;
+	std::vector<DrawPacket> drawPacketScratch;
+	std::vector<DrawBatch> drawBatches;
+	LodSettings lodSettings;
+	LodSelector lodSelector;
+	//Culling on the GPU with indirect draws, falls back to the CPU path above when unavailable
+	GpuCulling gpuCulling;
+	GraphicsPipelineKey instancedPipelineKey;
+	GraphicsPipeline instancedPipeline;
 
 	double lastTime;
 	double currentTime;
@@ -79,23 +283,61 @@ private:
 	void createValidation();
 	void choosePhysicalDevice();
 	void createLogicalDevice();
+	void createSurfaces();
 	void createSwapChain();
+	void makeSwapchain(OutputWindow& output, vk::SwapchainKHR oldSwapchain);
+	void recreateSwapchain();
+	void createDepthBuffer();
+	void createMesh();
 	void createPipeline();
+	void createCulling();
 	void createFramebuffer();
+	void updateOffscreenFramebuffer();
 	void createCommandPool();
 	void createCommandBuffer();
+	void createFrameCommandBuffers();
+	void freeFrameCommandBuffers();
+	void createSyncObjects();
+	void destroySyncObjects();
+	void createCommandRecorder();
+	void createDynamicResolution();
+	void renderLoop();
+	//Takes the latest snapshot and runs the render commands, then culls and sorts when culling on the CPU
+	void prepareFrame();
+	void executeRenderCommand(const RenderCommand& command);
 private:
+	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+	static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+	static void cursorPosCallback(GLFWwindow* window, double x, double y);
 	void calculateFrameRate();
 	bool checkValidationLayerSupport(const std::vector<const char*>& validationLayers);
 	void printDeviceProperties(const vk::PhysicalDevice& device);
 	bool checkDeviceSuitable(const vk::PhysicalDevice& device);
-	bool checkDeviceExtensionSupport(const vk::PhysicalDevice& device,
-		const std::vector<const char*>& requestedExtensions);
-	void findQueueFamilies(const vk::PhysicalDevice& device, QueueFamilyIndices& indices);
-	vk::ShaderModule createModule(std::string filename);
-	void makePipelineLayout();
+	std::vector<vk::SurfaceKHR> getSurfaces() const;
+	vk::PipelineLayout makePipelineLayout(const std::vector<ShaderReflection>& stages);
 	void makeRenderpass();
+	GraphicsPipeline getPipeline(const GraphicsPipelineKey& key);
+	GraphicsPipeline makePipeline(const GraphicsPipelineKey& key);
+	void swapOptimizedPipelines();
 	vk::Fence makeFence();
 	vk::Semaphore makeSemaphore();
-	void recordDrawCommands(vk::CommandBuffer commandBuffer, uint32_t imageIndex);
+	bool beginCommands(vk::CommandBuffer commandBuffer);
+	void endCommands(vk::CommandBuffer commandBuffer);
+	//Depth pyramid of the previous frame, then culling for this one, on the compute queue
+	void recordComputeCommands(vk::CommandBuffer commandBuffer);
+	//Declares this frame's passes, after the windows' images were acquired
+	void buildFrameGraph();
+	//The frame graph's scene batch, with culling around it when there's no compute queue
+	void recordSceneCommands(vk::CommandBuffer commandBuffer);
+	//The frame graph's output batch, into the images the windows acquired for this frame
+	void recordOutputCommands(vk::CommandBuffer commandBuffer);
+	//Bodies of the scene and the blit pass
+	void recordScene(vk::CommandBuffer commandBuffer);
+	void recordBlits(vk::CommandBuffer commandBuffer);
+	//Begin and end the scene pass on the offscreen target, as a render pass or with dynamic rendering
+	void beginScene(vk::CommandBuffer commandBuffer, vk::SubpassContents contents);
+	void endScene(vk::CommandBuffer commandBuffer);
+	//Viewport and scissor over renderExtent, they are dynamic state of every pipeline
+	void setRenderViewport(vk::CommandBuffer commandBuffer) const;
+	void recordObjects(vk::CommandBuffer commandBuffer, size_t first, size_t count);
 };
\ No newline at end of file
@@ -0,0 +1,527 @@
+#include "bvh.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+static const uint32_t MaxLeafSize = 4;
+static const int BinCount = 12;
+//Subtrees with more primitives than this build their children as separate jobs
+static const uint32_t ParallelBuildThreshold = 8192;
+//Traversal stack size, binned SAH trees stay far shallower
+static const int MaxDepth = 128;
+
+namespace
+{
+	struct Bounds
+	{
+		glm::vec3 min{ std::numeric_limits<float>::max() };
+		glm::vec3 max{ -std::numeric_limits<float>::max() };
+
+		void grow(const glm::vec3& point)
+		{
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+		void grow(const Bounds& other)
+		{
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+		float area() const
+		{
+			glm::vec3 extent = max - min;
+			if (extent.x < 0.0f)
+			{
+				return 0.0f;
+			}
+			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+	};
+
+	Bounds sphereBounds(const glm::vec4& sphere)
+	{
+		Bounds bounds;
+		bounds.min = glm::vec3(sphere) - glm::vec3(sphere.w);
+		bounds.max = glm::vec3(sphere) + glm::vec3(sphere.w);
+		return bounds;
+	}
+
+	bool isSphereInBox(const glm::vec4& sphere, const glm::vec3& min, const glm::vec3& max)
+	{
+		glm::vec3 closest = glm::clamp(glm::vec3(sphere), min, max);
+		glm::vec3 offset = closest - glm::vec3(sphere);
+		return glm::dot(offset, offset) <= sphere.w * sphere.w;
+	}
+
+	//Entry distance of the ray into the box, infinity when it misses
+	float intersectBox(const glm::vec3& origin, const glm::vec3& inverseDirection, const BvhNode& node, float closest)
+	{
+		glm::vec3 t0 = (node.min - origin) * inverseDirection;
+		glm::vec3 t1 = (node.max - origin) * inverseDirection;
+		glm::vec3 tmin = glm::min(t0, t1);
+		glm::vec3 tmax = glm::max(t0, t1);
+		float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+		float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, closest));
+		return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+	}
+
+	enum class FrustumTest
+	{
+		Outside,
+		Intersecting,
+		Inside
+	};
+
+	FrustumTest testBox(const Frustum& frustum, const glm::vec3& min, const glm::vec3& max)
+	{
+		FrustumTest result = FrustumTest::Inside;
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			//Corner farthest along the normal, and the one opposite to it
+			glm::vec3 positive(plane.x >= 0.0f ? max.x : min.x, plane.y >= 0.0f ? max.y : min.y, plane.z >= 0.0f ? max.z : min.z);
+			glm::vec3 negative(plane.x >= 0.0f ? min.x : max.x, plane.y >= 0.0f ? min.y : max.y, plane.z >= 0.0f ? min.z : max.z);
+			if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+			{
+				return FrustumTest::Outside;
+			}
+			if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f)
+			{
+				result = FrustumTest::Intersecting;
+			}
+		}
+		return result;
+	}
+
+}
+
+void Bvh::clear()
+{
+	nodes.clear();
+	allocatedNodes = 0;
+	usedNodes = 0;
+	primitives.clear();
+	spheres.clear();
+	centroids.clear();
+	orderedSpheres.clear();
+}
+
+void Bvh::updateOrderedSpheres()
+{
+	size_t count = primitives.size();
+	orderedSpheres.centerX.resize(count);
+	orderedSpheres.centerY.resize(count);
+	orderedSpheres.centerZ.resize(count);
+	orderedSpheres.radius.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const glm::vec4& sphere = spheres[primitives[i]];
+		orderedSpheres.centerX[i] = sphere.x;
+		orderedSpheres.centerY[i] = sphere.y;
+		orderedSpheres.centerZ[i] = sphere.z;
+		orderedSpheres.radius[i] = sphere.w;
+	}
+}
+
+void Bvh::updateBounds(BvhNode& node) const
+{
+	Bounds bounds;
+	for (uint32_t i = 0; i < node.count; ++i)
+	{
+		bounds.grow(sphereBounds(spheres[primitives[node.leftFirst + i]]));
+	}
+	node.min = bounds.min;
+	node.max = bounds.max;
+}
+
+void Bvh::build(const BoundingSpheres& source, JobSystem* jobs)
+{
+	clear();
+
+	uint32_t count = static_cast<uint32_t>(source.size());
+	if (count == 0)
+	{
+		return;
+	}
+
+	spheres.resize(count);
+	centroids.resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		spheres[i] = glm::vec4(source.centerX[i], source.centerY[i], source.centerZ[i], source.radius[i]);
+		centroids[i] = glm::vec3(spheres[i]);
+	}
+	primitives.resize(count);
+	std::iota(primitives.begin(), primitives.end(), 0);
+
+	//A binary tree over count leaves has at most 2 * count - 1 nodes, plus the unused node 1
+	nodes.resize(2 * static_cast<size_t>(count));
+	allocatedNodes = 2;
+
+	BvhNode& root = nodes[0];
+	root.leftFirst = 0;
+	root.count = count;
+	updateBounds(root);
+	buildJobs = jobs;
+	subdivide(0);
+	buildJobs = nullptr;
+
+	usedNodes = allocatedNodes;
+	updateOrderedSpheres();
+}
+
+void Bvh::subdivide(uint32_t nodeIndex)
+{
+	BvhNode& node = nodes[nodeIndex];
+	if (node.count <= MaxLeafSize)
+	{
+		return;
+	}
+
+	uint32_t first = node.leftFirst;
+	uint32_t last = first + node.count;
+
+	Bounds centroidBounds;
+	for (uint32_t i = first; i < last; ++i)
+	{
+		centroidBounds.grow(centroids[primitives[i]]);
+	}
+
+	//Best split over BinCount bins on every axis by the surface area heuristic
+	int bestAxis = -1;
+	int bestSplit = 0;
+	float bestCost = node.count * Bounds{ node.min, node.max }.area();
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float minCentroid = centroidBounds.min[axis];
+		float extent = centroidBounds.max[axis] - minCentroid;
+		if (extent <= 0.0f)
+		{
+			continue;
+		}
+
+		Bounds bins[BinCount];
+		uint32_t binCounts[BinCount] = {};
+		float scale = BinCount / extent;
+		for (uint32_t i = first; i < last; ++i)
+		{
+			uint32_t primitive = primitives[i];
+			int bin = std::min(BinCount - 1, static_cast<int>((centroids[primitive][axis] - minCentroid) * scale));
+			bins[bin].grow(sphereBounds(spheres[primitive]));
+			binCounts[bin]++;
+		}
+
+		//Sweep from both sides so every split plane is evaluated in linear time
+		float leftAreas[BinCount - 1];
+		uint32_t leftCounts[BinCount - 1];
+		Bounds left;
+		uint32_t leftCount = 0;
+		for (int i = 0; i < BinCount - 1; ++i)
+		{
+			left.grow(bins[i]);
+			leftCount += binCounts[i];
+			leftAreas[i] = left.area();
+			leftCounts[i] = leftCount;
+		}
+
+		Bounds right;
+		uint32_t rightCount = 0;
+		for (int i = BinCount - 1; i > 0; --i)
+		{
+			right.grow(bins[i]);
+			rightCount += binCounts[i];
+			if (leftCounts[i - 1] == 0 || rightCount == 0)
+			{
+				continue;
+			}
+			float cost = leftCounts[i - 1] * leftAreas[i - 1] + rightCount * right.area();
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	if (bestAxis < 0)
+	{
+		return;
+	}
+
+	float minCentroid = centroidBounds.min[bestAxis];
+	float scale = BinCount / (centroidBounds.max[bestAxis] - minCentroid);
+	uint32_t* middle = std::partition(&primitives[first], &primitives[first] + node.count, [&](uint32_t primitive) {
+		int bin = std::min(BinCount - 1, static_cast<int>((centroids[primitive][bestAxis] - minCentroid) * scale));
+		return bin < bestSplit;
+	});
+	uint32_t leftCount = static_cast<uint32_t>(middle - &primitives[first]);
+	if (leftCount == 0 || leftCount == node.count)
+	{
+		return;
+	}
+
+	uint32_t leftIndex = allocatedNodes.fetch_add(2);
+	BvhNode& leftChild = nodes[leftIndex];
+	BvhNode& rightChild = nodes[leftIndex + 1];
+	leftChild.leftFirst = first;
+	leftChild.count = leftCount;
+	rightChild.leftFirst = first + leftCount;
+	rightChild.count = node.count - leftCount;
+	updateBounds(leftChild);
+	updateBounds(rightChild);
+
+	uint32_t total = node.count;
+	node.leftFirst = leftIndex;
+	node.count = 0;
+
+	//The two halves touch disjoint primitives and nodes
+	if (buildJobs && total > ParallelBuildThreshold)
+	{
+		//Waiting executes other jobs, so deep recursion keeps every worker busy
+		JobCounter counter;
+		buildJobs->run(counter, [this, leftIndex]() { subdivide(leftIndex); });
+		subdivide(leftIndex + 1);
+		buildJobs->wait(counter);
+	}
+	else
+	{
+		subdivide(leftIndex);
+		subdivide(leftIndex + 1);
+	}
+}
+
+void Bvh::refit(const BoundingSpheres& source)
+{
+	for (size_t i = 0; i < spheres.size(); ++i)
+	{
+		spheres[i] = glm::vec4(source.centerX[i], source.centerY[i], source.centerZ[i], source.radius[i]);
+	}
+	updateOrderedSpheres();
+
+	//Children are always allocated after their parent, so a reverse sweep sees them first
+	for (size_t i = usedNodes; i-- > 0;)
+	{
+		if (i == 1)
+		{
+			continue;
+		}
+		BvhNode& node = nodes[i];
+		if (node.count > 0)
+		{
+			updateBounds(node);
+		}
+		else
+		{
+			const BvhNode& left = nodes[node.leftFirst];
+			const BvhNode& right = nodes[node.leftFirst + 1];
+			node.min = glm::min(left.min, right.min);
+			node.max = glm::max(left.max, right.max);
+		}
+	}
+}
+
+void Bvh::appendSubtree(uint32_t nodeIndex, std::vector<uint32_t>& result) const
+{
+	//Leaves of a subtree own one contiguous range of the index list, find its ends
+	uint32_t firstLeaf = nodeIndex;
+	while (nodes[firstLeaf].count == 0)
+	{
+		firstLeaf = nodes[firstLeaf].leftFirst;
+	}
+	uint32_t lastLeaf = nodeIndex;
+	while (nodes[lastLeaf].count == 0)
+	{
+		lastLeaf = nodes[lastLeaf].leftFirst + 1;
+	}
+	const BvhNode& last = nodes[lastLeaf];
+	result.insert(result.end(), primitives.begin() + nodes[firstLeaf].leftFirst, primitives.begin() + last.leftFirst + last.count);
+}
+
+void Bvh::cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const
+{
+	visible.clear();
+	if (usedNodes == 0)
+	{
+		return;
+	}
+
+	//Leaves the frustum cuts through are tested sphere by sphere with the SIMD kernel. Traversal visits
+	//leaves in the order of their primitive ranges, so neighbouring ones are merged into one run and
+	//tested 4 or 8 at a time instead of a leaf at a time.
+	size_t runFirst = 0;
+	size_t runCount = 0;
+	auto flushRun = [&]() {
+		if (runCount == 0)
+		{
+			return;
+		}
+		size_t start = visible.size();
+		visible.resize(start + runCount);
+		size_t passed = cullSpheres(frustum, orderedSpheres, runFirst, runCount, visible.data() + start);
+		for (size_t i = start; i < start + passed; ++i)
+		{
+			visible[i] = primitives[visible[i]];
+		}
+		visible.resize(start + passed);
+		runCount = 0;
+	};
+
+	uint32_t stack[MaxDepth];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		uint32_t nodeIndex = stack[--top];
+		const BvhNode& node = nodes[nodeIndex];
+
+		FrustumTest test = testBox(frustum, node.min, node.max);
+		if (test == FrustumTest::Outside)
+		{
+			continue;
+		}
+		if (test == FrustumTest::Inside)
+		{
+			appendSubtree(nodeIndex, visible);
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			if (runCount > 0 && runFirst + runCount != node.leftFirst)
+			{
+				flushRun();
+			}
+			if (runCount == 0)
+			{
+				runFirst = node.leftFirst;
+			}
+			runCount += node.count;
+		}
+		else
+		{
+			stack[top++] = node.leftFirst + 1;
+			stack[top++] = node.leftFirst;
+		}
+	}
+	flushRun();
+}
+
+uint32_t Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float* distance) const
+{
+	uint32_t hit = UINT32_MAX;
+	float closest = std::numeric_limits<float>::infinity();
+	if (usedNodes == 0)
+	{
+		return hit;
+	}
+
+	glm::vec3 inverseDirection = 1.0f / direction;
+	float directionLength2 = glm::dot(direction, direction);
+
+	uint32_t stack[MaxDepth];
+	int top = 0;
+	if (intersectBox(origin, inverseDirection, nodes[0], closest) < closest)
+	{
+		stack[top++] = 0;
+	}
+	while (top > 0)
+	{
+		const BvhNode& node = nodes[stack[--top]];
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; ++i)
+			{
+				uint32_t primitive = primitives[node.leftFirst + i];
+				const glm::vec4& sphere = spheres[primitive];
+
+				//Nearest non-negative root of |origin + t * direction - center| = radius
+				glm::vec3 offset = origin - glm::vec3(sphere);
+				float b = glm::dot(offset, direction);
+				float c = glm::dot(offset, offset) - sphere.w * sphere.w;
+				float discriminant = b * b - directionLength2 * c;
+				if (discriminant < 0.0f)
+				{
+					continue;
+				}
+				float root = std::sqrt(discriminant);
+				float t = (-b - root) / directionLength2;
+				if (t < 0.0f)
+				{
+					t = (-b + root) / directionLength2;
+				}
+				if (t >= 0.0f && t < closest)
+				{
+					closest = t;
+					hit = primitive;
+				}
+			}
+			continue;
+		}
+
+		//Visit the nearer child first so the far one is more likely to be skipped
+		uint32_t near = node.leftFirst;
+		uint32_t far = node.leftFirst + 1;
+		float nearDistance = intersectBox(origin, inverseDirection, nodes[near], closest);
+		float farDistance = intersectBox(origin, inverseDirection, nodes[far], closest);
+		if (farDistance < nearDistance)
+		{
+			std::swap(near, far);
+			std::swap(nearDistance, farDistance);
+		}
+		if (farDistance < closest)
+		{
+			stack[top++] = far;
+		}
+		if (nearDistance < closest)
+		{
+			stack[top++] = near;
+		}
+	}
+
+	if (distance)
+	{
+		*distance = closest;
+	}
+	return hit;
+}
+
+void Bvh::queryRange(const glm::vec3& min, const glm::vec3& max, std::vector<uint32_t>& result) const
+{
+	result.clear();
+	if (usedNodes == 0)
+	{
+		return;
+	}
+
+	uint32_t stack[MaxDepth];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const BvhNode& node = nodes[stack[--top]];
+		if (glm::any(glm::lessThan(node.max, min)) || glm::any(glm::greaterThan(node.min, max)))
+		{
+			continue;
+		}
+
+		if (node.count > 0)
+		{
+			for (uint32_t i = 0; i < node.count; ++i)
+			{
+				uint32_t primitive = primitives[node.leftFirst + i];
+				if (isSphereInBox(spheres[primitive], min, max))
+				{
+					result.push_back(primitive);
+				}
+			}
+		}
+		else
+		{
+			stack[top++] = node.leftFirst + 1;
+			stack[top++] = node.leftFirst;
+		}
+	}
+}
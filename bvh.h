@@ -0,0 +1,91 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "culling.h"
+
+class JobSystem;
+
+//32 bytes. Leaves (count > 0) own primitives [leftFirst, leftFirst + count) of the index list,
+//inner nodes have their children at leftFirst and leftFirst + 1.
+struct alignas(32) BvhNode
+{
+	glm::vec3 min;
+	uint32_t leftFirst;
+	glm::vec3 max;
+	uint32_t count;
+};
+
+template <typename T, size_t Alignment>
+struct AlignedAllocator
+{
+	using value_type = T;
+
+	template <typename U>
+	struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+	AlignedAllocator() = default;
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+	}
+	void deallocate(T* pointer, size_t)
+	{
+		::operator delete(pointer, std::align_val_t(Alignment));
+	}
+
+	template <typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+	template <typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+//Bounding volume hierarchy over bounding spheres, addressed by the same object indices.
+//Nodes live in one flat array aligned to cache lines; the root is node 0, node 1 is unused,
+//so every pair of siblings shares a single 64 byte line.
+class Bvh
+{
+public:
+	//Binned SAH build, large subtrees are built as parallel jobs when a job system is given
+	void build(const BoundingSpheres& spheres, JobSystem* jobs = nullptr);
+	//Refreshes bounds after objects moved without changing the tree, spheres must have the same count
+	void refit(const BoundingSpheres& spheres);
+
+	size_t size() const { return primitives.size(); }
+	size_t nodeCount() const { return usedNodes; }
+	void clear();
+
+	//Objects intersecting the frustum, in no particular order
+	void cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+	//Closest object whose sphere the ray hits, UINT32_MAX when nothing is hit
+	uint32_t raycast(const glm::vec3& origin, const glm::vec3& direction, float* distance = nullptr) const;
+	//Objects whose sphere overlaps the box
+	void queryRange(const glm::vec3& min, const glm::vec3& max, std::vector<uint32_t>& result) const;
+private:
+	void subdivide(uint32_t nodeIndex);
+	void updateBounds(BvhNode& node) const;
+	void appendSubtree(uint32_t nodeIndex, std::vector<uint32_t>& result) const;
+	void updateOrderedSpheres();
+
+	std::vector<BvhNode, AlignedAllocator<BvhNode, 64>> nodes;
+	std::atomic<uint32_t> allocatedNodes{ 0 };
+	//Only set during build()
+	JobSystem* buildJobs{ nullptr };
+	size_t usedNodes{ 0 };
+
+	//Object indices, reordered so every leaf owns a contiguous range
+	std::vector<uint32_t> primitives;
+	//Per object, xyz center and w radius
+	std::vector<glm::vec4> spheres;
+	std::vector<glm::vec3> centroids;
+	//spheres in the order of primitives, so the leaves of a range are one run for cullSpheres()
+	BoundingSpheres orderedSpheres;
+};
@@ -0,0 +1,56 @@
+# Turns a list of SPIR-V binaries into a C++ source file holding one aligned
+# uint32_t array per shader, so the modules can be linked into the executable.
+#
+# Expected variables (passed with -D):
+# SPIRV_FILES   list of .spv files, separated by "|" so it survives add_custom_command
+# SPIRV_PREFIX  name prefix used as lookup key, e.g. "media/shaders/"
+# OUTPUT        generated .cpp file
+
+if(NOT OUTPUT OR NOT SPIRV_FILES)
+	message(FATAL_ERROR "EmbedSpirv.cmake needs OUTPUT and SPIRV_FILES")
+endif()
+string(REPLACE "|" ";" SPIRV_FILES "${SPIRV_FILES}")
+
+set(_arrays "")
+set(_table "")
+
+foreach(_spirv ${SPIRV_FILES})
+	get_filename_component(_name ${_spirv} NAME)
+	get_filename_component(_symbol ${_spirv} NAME_WE)
+	string(MAKE_C_IDENTIFIER "${_symbol}_spv" _symbol)
+
+	file(READ ${_spirv} _hex HEX)
+	string(LENGTH "${_hex}" _length)
+	math(EXPR _remainder "${_length} % 8")
+	if(NOT _remainder EQUAL 0)
+		message(FATAL_ERROR "${_spirv} is not a multiple of 4 bytes, not a SPIR-V binary?")
+	endif()
+
+	# SPIR-V is little endian, swap every 4 bytes into one uint32_t literal
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])"
+		"0x\\4\\3\\2\\1u," _words "${_hex}")
+	set(_word "0x[0-9a-f]+u,")
+	string(REGEX REPLACE "(${_word}${_word}${_word}${_word}${_word}${_word}${_word}${_word})" "\\1\n\t" _words "${_words}")
+
+	string(APPEND _arrays "alignas(4) const uint32_t ${_symbol}[] = {\n\t${_words}\n};\n\n")
+	string(APPEND _table "\t{ \"${SPIRV_PREFIX}${_name}\", ${_symbol}, sizeof(${_symbol}) / sizeof(uint32_t) },\n")
+endforeach()
+
+file(WRITE ${OUTPUT}.tmp
+"// Generated by cmake/EmbedSpirv.cmake, do not edit.\n\
+#include \"shader.h\"\n\
+\n\
+namespace\n\
+{\n\
+${_arrays}\
+}\n\
+\n\
+extern const EmbeddedShader embeddedShaders[] = {\n\
+${_table}\
+};\n\
+\n\
+extern const size_t embeddedShaderCount = sizeof(embeddedShaders) / sizeof(embeddedShaders[0]);\n")
+
+# Only touch the output when the content changed to avoid needless rebuilds
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
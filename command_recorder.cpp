@@ -0,0 +1,157 @@
+#include "command_recorder.h"
+
+#include <algorithm>
+#include <iostream>
+
+ParallelCommandRecorder::~ParallelCommandRecorder()
+{
+	destroy();
+}
+
+void ParallelCommandRecorder::init(vk::Device device, uint32_t queueFamily, uint32_t framesInFlight, JobSystem& jobs)
+{
+	uint32_t shareCount = std::max(1u, jobs.getThreadCount());
+
+	//Pools are reset as a whole every frame instead of per command buffer
+	vk::CommandPoolCreateInfo poolInfo;
+	poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+	poolInfo.queueFamilyIndex = queueFamily;
+
+	shareCommands.resize(shareCount);
+	try
+	{
+		for (ShareCommands& commands : shareCommands)
+		{
+			for (uint32_t frame = 0; frame < framesInFlight; ++frame)
+			{
+				vk::CommandPool pool = device.createCommandPool(poolInfo);
+				commands.pools.push_back(pool);
+
+				vk::CommandBufferAllocateInfo allocInfo = {};
+				allocInfo.commandPool = pool;
+				allocInfo.level = vk::CommandBufferLevel::eSecondary;
+				allocInfo.commandBufferCount = 1;
+				commands.buffers.push_back(device.allocateCommandBuffers(allocInfo)[0]);
+			}
+		}
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create secondary command buffers!" << std::endl;
+#endif
+		this->device = device;
+		destroy();
+		return;
+	}
+
+	this->device = device;
+	this->jobs = &jobs;
+
+#ifdef DEBUG_MODE
+	std::cout << "Recording draw lists in up to " << shareCount << " jobs" << std::endl;
+#endif
+}
+
+void ParallelCommandRecorder::destroy()
+{
+	if (!device)
+	{
+		return;
+	}
+
+	//Destroying a pool frees its command buffers
+	for (ShareCommands& commands : shareCommands)
+	{
+		for (vk::CommandPool pool : commands.pools)
+		{
+			device.destroyCommandPool(pool);
+		}
+	}
+	shareCommands.clear();
+	recorded.clear();
+	device = nullptr;
+	jobs = nullptr;
+}
+
+const std::vector<vk::CommandBuffer>& ParallelCommandRecorder::record(uint32_t frame, const RenderTargetLayout& target,
+	vk::Framebuffer framebuffer, size_t count, const RecordRange& recordRange)
+{
+	recorded.clear();
+	if (count == 0)
+	{
+		return recorded;
+	}
+
+	uint32_t shares = static_cast<uint32_t>(std::min<size_t>(shareCommands.size(),
+		(count + minDrawsPerThread - 1) / minDrawsPerThread));
+
+	//Scheduling a job publishes everything written before it to the thread that runs it
+	jobFrame = frame;
+	jobInheritance = vk::CommandBufferInheritanceInfo();
+	jobInheritance.renderPass = target.renderPass;
+	jobInheritance.subpass = 0;
+	if (target.usesDynamicRendering())
+	{
+		//Without a render pass the secondaries inherit the attachment formats instead
+		jobColorFormat = target.colorFormat;
+		jobRendering = vk::CommandBufferInheritanceRenderingInfo();
+		jobRendering.colorAttachmentCount = 1;
+		jobRendering.pColorAttachmentFormats = &jobColorFormat;
+		jobRendering.depthAttachmentFormat = target.depthFormat;
+		jobRendering.rasterizationSamples = vk::SampleCountFlagBits::e1;
+		jobInheritance.pNext = &jobRendering;
+	}
+	else
+	{
+		jobInheritance.framebuffer = framebuffer;
+	}
+	jobCount = count;
+	jobShares = shares;
+	jobRecord = &recordRange;
+
+	//Each share has its own pools, so no two jobs ever touch the same one
+	JobCounter counter;
+	for (uint32_t shareIndex = 1; shareIndex < shares; ++shareIndex)
+	{
+		jobs->run(counter, [this, shareIndex]() { recordShare(shareIndex); });
+	}
+
+	//The calling thread takes the first share, then helps with the rest
+	recordShare(0);
+	jobs->wait(counter);
+
+	for (uint32_t shareIndex = 0; shareIndex < shares; ++shareIndex)
+	{
+		recorded.push_back(shareCommands[shareIndex].buffers[frame]);
+	}
+	return recorded;
+}
+
+void ParallelCommandRecorder::recordShare(uint32_t shareIndex)
+{
+	ShareCommands& commands = shareCommands[shareIndex];
+	device.resetCommandPool(commands.pools[jobFrame], vk::CommandPoolResetFlags());
+
+	size_t share = (jobCount + jobShares - 1) / jobShares;
+	size_t first = std::min(jobCount, shareIndex * share);
+	size_t count = std::min(jobCount - first, share);
+
+	vk::CommandBuffer commandBuffer = commands.buffers[jobFrame];
+	vk::CommandBufferBeginInfo beginInfo = {};
+	beginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+	beginInfo.pInheritanceInfo = &jobInheritance;
+
+	try
+	{
+		commandBuffer.begin(beginInfo);
+		(*jobRecord)(commandBuffer, first, count);
+		commandBuffer.end();
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to record secondary command buffer!" << std::endl;
+#endif
+	}
+}
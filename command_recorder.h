@@ -0,0 +1,58 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <functional>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "job_system.h"
+#include "pipeline.h"
+
+//Records one draw list as parallel jobs. The list is split into one share per job system thread,
+//every share owns a command pool per frame in flight and is recorded into a secondary command
+//buffer that continues the render pass (or dynamic rendering), and the primary runs them in order
+//with executeCommands.
+class ParallelCommandRecorder
+{
+public:
+	//Records draws [first, first + count) of the list into a secondary that is already begun
+	using RecordRange = std::function<void(vk::CommandBuffer commandBuffer, size_t first, size_t count)>;
+
+	~ParallelCommandRecorder();
+
+	void init(vk::Device device, uint32_t queueFamily, uint32_t framesInFlight, JobSystem& jobs);
+	bool isEnabled() const { return static_cast<bool>(device); }
+	void destroy();
+
+	//Draw lists shorter than this aren't worth splitting, record them inline
+	size_t getMinDrawsPerThread() const { return minDrawsPerThread; }
+
+	//Call for a frame slot whose fence was waited on. Returns the secondaries in draw order.
+	//framebuffer is ignored when target uses dynamic rendering.
+	const std::vector<vk::CommandBuffer>& record(uint32_t frame, const RenderTargetLayout& target, vk::Framebuffer framebuffer,
+		size_t count, const RecordRange& recordRange);
+private:
+	void recordShare(uint32_t shareIndex);
+
+	struct ShareCommands
+	{
+		//Indexed by frame in flight
+		std::vector<vk::CommandPool> pools;
+		std::vector<vk::CommandBuffer> buffers;
+	};
+
+	vk::Device device{ nullptr };
+	JobSystem* jobs{ nullptr };
+	size_t minDrawsPerThread{ 512 };
+	std::vector<ShareCommands> shareCommands;
+	std::vector<vk::CommandBuffer> recorded;
+
+	//The current list, written before its jobs are scheduled
+	uint32_t jobFrame{ 0 };
+	vk::CommandBufferInheritanceInfo jobInheritance;
+	vk::CommandBufferInheritanceRenderingInfo jobRendering;
+	vk::Format jobColorFormat{ vk::Format::eUndefined };
+	size_t jobCount{ 0 };
+	uint32_t jobShares{ 0 };
+	const RecordRange* jobRecord{ nullptr };
+};
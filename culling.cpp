@@ -0,0 +1,178 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#include <immintrin.h>
+#endif
+
+Frustum Frustum::fromMatrix(const glm::mat4& viewProjection)
+{
+	//glm is column major, row r of the matrix is (m[0][r], m[1][r], m[2][r], m[3][r])
+	glm::vec4 rows[4];
+	for (int r = 0; r < 4; ++r)
+	{
+		rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+	}
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0];
+	frustum.planes[1] = rows[3] - rows[0];
+	frustum.planes[2] = rows[3] + rows[1];
+	frustum.planes[3] = rows[3] - rows[1];
+	//Clip depth is [0, w] in Vulkan, not [-w, w]
+	frustum.planes[4] = rows[2];
+	frustum.planes[5] = rows[3] - rows[2];
+
+	for (glm::vec4& plane : frustum.planes)
+	{
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f)
+		{
+			plane /= length;
+		}
+	}
+	return frustum;
+}
+
+void BoundingSpheres::fromWorldMatrices(const glm::mat4* worlds, size_t count, float localRadius)
+{
+	centerX.resize(count);
+	centerY.resize(count);
+	centerZ.resize(count);
+	radius.resize(count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const glm::mat4& world = worlds[i];
+		centerX[i] = world[3].x;
+		centerY[i] = world[3].y;
+		centerZ[i] = world[3].z;
+
+		//The largest axis scale keeps the sphere conservative under non-uniform scaling
+		float scale = std::max(glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+			std::max(glm::dot(glm::vec3(world[1]), glm::vec3(world[1])), glm::dot(glm::vec3(world[2]), glm::vec3(world[2]))));
+		radius[i] = localRadius * std::sqrt(scale);
+	}
+}
+
+void BoundingSpheres::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	radius.clear();
+}
+
+namespace
+{
+	bool isSphereVisible(const Frustum& frustum, float x, float y, float z, float r)
+	{
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			if (plane.x * x + plane.y * y + plane.z * z + plane.w < -r)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+size_t cullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, std::vector<uint32_t>& visible)
+{
+	//Room for everything, so the SIMD loops can store without checking capacity
+	visible.resize(spheres.size());
+	size_t written = cullSpheres(frustum, spheres, 0, spheres.size(), visible.data());
+	visible.resize(written);
+	return written;
+}
+
+size_t cullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, size_t first, size_t count, uint32_t* out)
+{
+	size_t end = first + count;
+	size_t written = 0;
+	size_t i = first;
+
+	//The loops below write the index of every lane and only advance the output by the lanes
+	//that passed, which compacts the list without a branch per object
+
+#if defined(__AVX2__)
+	{
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+		}
+
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(&spheres.centerX[i]);
+			__m256 y = _mm256_loadu_ps(&spheres.centerY[i]);
+			__m256 z = _mm256_loadu_ps(&spheres.centerZ[i]);
+			__m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&spheres.radius[i]));
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p)
+			{
+				__m256 distance = _mm256_fmadd_ps(planeX[p], x, _mm256_fmadd_ps(planeY[p], y, _mm256_fmadd_ps(planeZ[p], z, planeW[p])));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(inside);
+			for (int lane = 0; lane < 8; ++lane)
+			{
+				out[written] = static_cast<uint32_t>(i + lane);
+				written += (mask >> lane) & 1;
+			}
+		}
+	}
+#endif
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+	{
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&spheres.centerX[i]);
+			__m128 y = _mm_loadu_ps(&spheres.centerY[i]);
+			__m128 z = _mm_loadu_ps(&spheres.centerZ[i]);
+			__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+					_mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				out[written] = static_cast<uint32_t>(i + lane);
+				written += (mask >> lane) & 1;
+			}
+		}
+	}
+#endif
+
+	for (; i < end; ++i)
+	{
+		out[written] = static_cast<uint32_t>(i);
+		written += isSphereVisible(frustum, spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i], spheres.radius[i]) ? 1 : 0;
+	}
+	return written;
+}
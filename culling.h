@@ -0,0 +1,33 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//Six normalized planes (xyz = normal pointing inside, w = distance) of a view-projection matrix
+//with Vulkan's [0, 1] clip depth. Order: left, right, bottom, top, near, far.
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	static Frustum fromMatrix(const glm::mat4& viewProjection);
+};
+
+//Bounding spheres stored as structure of arrays, so one register holds 4 (SSE) or 8 (AVX2) of them
+class BoundingSpheres
+{
+public:
+	//World space spheres of objects whose local bounds are a sphere of localRadius around the origin
+	void fromWorldMatrices(const glm::mat4* worlds, size_t count, float localRadius);
+
+	size_t size() const { return centerX.size(); }
+	void clear();
+
+	std::vector<float> centerX, centerY, centerZ, radius;
+};
+
+//Writes the indices of spheres that intersect the frustum to visible, in ascending order.
+//Returns the number of visible spheres.
+size_t cullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, std::vector<uint32_t>& visible);
+//Only spheres [first, first + count), their indices go to out, which needs room for count of them
+size_t cullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, size_t first, size_t count, uint32_t* out);
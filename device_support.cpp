@@ -0,0 +1,20 @@
+#include "device_support.h"
+
+#include <algorithm>
+#include <set>
+#include <string>
+
+bool checkDeviceExtensionSupport(const vk::PhysicalDevice& device, const std::vector<const char*>& requestedExtensions)
+{
+	std::set<std::string> requiredExtensions(requestedExtensions.begin(), requestedExtensions.end());
+	for (vk::ExtensionProperties& extension : device.enumerateDeviceExtensionProperties())
+	{
+		requiredExtensions.erase(extension.extensionName);
+	}
+	return requiredExtensions.empty();
+}
+
+bool canQueryDeviceFeatures(const vk::PhysicalDevice& device, uint32_t apiVersion)
+{
+	return std::min(apiVersion, device.getProperties().apiVersion) >= VK_API_VERSION_1_1;
+}
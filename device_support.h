@@ -0,0 +1,10 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <cstdint>
+
+//Whether the device has every one of requestedExtensions
+bool checkDeviceExtensionSupport(const vk::PhysicalDevice& device, const std::vector<const char*>& requestedExtensions);
+//Whether the features of an extension can be queried with vkGetPhysicalDeviceFeatures2, which is core in 1.1.
+//apiVersion is the version the instance was created with, the device may support less.
+bool canQueryDeviceFeatures(const vk::PhysicalDevice& device, uint32_t apiVersion);
@@ -0,0 +1,123 @@
+#include "draw_sort.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <array>
+
+//Smaller lists sort faster on one thread than it takes to hand them out
+static const size_t ParallelSortThreshold = 16384;
+
+uint64_t makeSortKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth)
+{
+	uint64_t depthBits = uint64_t(std::min(std::max(depth, 0.0f), 1.0f) * float((1u << SortKeyDepthBits) - 1));
+
+	uint64_t key = pass & ((1u << SortKeyPassBits) - 1);
+	key = (key << SortKeyPipelineBits) | (pipeline & ((1u << SortKeyPipelineBits) - 1));
+	key = (key << SortKeyMaterialBits) | (material & ((1u << SortKeyMaterialBits) - 1));
+	key = (key << SortKeyMeshBits) | (mesh & ((1u << SortKeyMeshBits) - 1));
+	key = (key << SortKeyDepthBits) | depthBits;
+	return key;
+}
+
+void sortDrawPackets(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch, JobSystem* jobs)
+{
+	size_t count = packets.size();
+	if (count < 2)
+	{
+		return;
+	}
+	scratch.resize(count);
+
+	size_t chunks = 1;
+	if (jobs && count >= ParallelSortThreshold)
+	{
+		chunks = std::min<size_t>(jobs->getThreadCount(), count / (ParallelSortThreshold / 4));
+	}
+	size_t chunkSize = (count + chunks - 1) / chunks;
+
+	auto forEachChunk = [&](auto&& body) {
+		if (chunks > 1)
+		{
+			jobs->parallelFor(chunks, 1, [&](size_t first, size_t end) {
+				for (size_t chunk = first; chunk < end; ++chunk)
+				{
+					body(chunk, chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize));
+				}
+			});
+		}
+		else
+		{
+			body(size_t(0), size_t(0), count);
+		}
+	};
+
+	//Bits that differ between any two keys
+	std::vector<uint64_t> chunkVarying(chunks, 0);
+	uint64_t firstKey = packets[0].key;
+	forEachChunk([&](size_t chunk, size_t first, size_t end) {
+		uint64_t varying = 0;
+		for (size_t i = first; i < end; ++i)
+		{
+			varying |= packets[i].key ^ firstKey;
+		}
+		chunkVarying[chunk] = varying;
+	});
+	uint64_t varying = 0;
+	for (uint64_t bits : chunkVarying)
+	{
+		varying |= bits;
+	}
+
+	std::vector<std::array<uint32_t, 256>> histograms(chunks);
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		if (((varying >> shift) & 0xFF) == 0)
+		{
+			continue;
+		}
+
+		forEachChunk([&](size_t chunk, size_t first, size_t end) {
+			std::array<uint32_t, 256>& histogram = histograms[chunk];
+			histogram.fill(0);
+			for (size_t i = first; i < end; ++i)
+			{
+				++histogram[(packets[i].key >> shift) & 0xFF];
+			}
+		});
+
+		//Each chunk writes its part of a bucket after the parts of the chunks before it, which keeps the sort stable
+		uint32_t offset = 0;
+		for (size_t bucket = 0; bucket < 256; ++bucket)
+		{
+			for (size_t chunk = 0; chunk < chunks; ++chunk)
+			{
+				uint32_t bucketCount = histograms[chunk][bucket];
+				histograms[chunk][bucket] = offset;
+				offset += bucketCount;
+			}
+		}
+
+		forEachChunk([&](size_t chunk, size_t first, size_t end) {
+			std::array<uint32_t, 256>& offsets = histograms[chunk];
+			for (size_t i = first; i < end; ++i)
+			{
+				scratch[offsets[(packets[i].key >> shift) & 0xFF]++] = packets[i];
+			}
+		});
+		packets.swap(scratch);
+	}
+}
+
+void buildDrawBatches(const std::vector<DrawPacket>& packets, std::vector<DrawBatch>& batches)
+{
+	batches.clear();
+	for (uint32_t i = 0; i < packets.size(); ++i)
+	{
+		uint64_t state = sortKeyState(packets[i].key);
+		if (batches.empty() || batches.back().state != state)
+		{
+			batches.push_back({ state, i, 0 });
+		}
+		++batches.back().count;
+	}
+}
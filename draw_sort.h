@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class JobSystem;
+
+//Sort key layout, most significant first. Sorting by the key groups draws by pass, then by
+//pipeline, material and mesh, and orders draws that share all of those front to back.
+//  pass      4 bits
+//  pipeline 12 bits
+//  material 12 bits
+//  mesh     12 bits
+//  depth    24 bits
+static const uint32_t SortKeyDepthBits = 24;
+static const uint32_t SortKeyMeshBits = 12;
+static const uint32_t SortKeyMaterialBits = 12;
+static const uint32_t SortKeyPipelineBits = 12;
+static const uint32_t SortKeyPassBits = 4;
+
+//depth is clamped to [0, 1], 0 being closest
+uint64_t makeSortKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+
+inline uint32_t sortKeyPipeline(uint64_t key)
+{
+	return uint32_t(key >> (SortKeyDepthBits + SortKeyMeshBits + SortKeyMaterialBits)) & ((1u << SortKeyPipelineBits) - 1);
+}
+inline uint32_t sortKeyMaterial(uint64_t key)
+{
+	return uint32_t(key >> (SortKeyDepthBits + SortKeyMeshBits)) & ((1u << SortKeyMaterialBits) - 1);
+}
+inline uint32_t sortKeyMesh(uint64_t key)
+{
+	return uint32_t(key >> SortKeyDepthBits) & ((1u << SortKeyMeshBits) - 1);
+}
+//Everything but the depth, packets with the same state can be drawn without rebinding anything
+inline uint64_t sortKeyState(uint64_t key)
+{
+	return key >> SortKeyDepthBits;
+}
+
+struct DrawPacket
+{
+	uint64_t key;
+	//What to draw, meaning is up to whoever records the packets
+	uint32_t object;
+	uint32_t lod;
+};
+
+//Consecutive sorted packets [first, first + count) sharing one state
+struct DrawBatch
+{
+	uint64_t state;
+	uint32_t first;
+	uint32_t count;
+};
+
+//Stable LSD radix sort on the key, 8 bits per pass. Passes over bytes that are equal in every
+//key are skipped, so unused key fields cost nothing. Large lists build histograms and scatter as
+//parallel jobs when a job system is given. scratch is resized as needed and its contents are garbage.
+void sortDrawPackets(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch, JobSystem* jobs = nullptr);
+
+//Merges runs of sorted packets with the same state into batches
+void buildDrawBatches(const std::vector<DrawPacket>& packets, std::vector<DrawBatch>& batches);
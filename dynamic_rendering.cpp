@@ -0,0 +1,36 @@
+#include "dynamic_rendering.h"
+
+#include <algorithm>
+
+#include "device_support.h"
+
+static uint32_t usableVersion(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion)
+{
+	return std::min(apiVersion, physicalDevice.getProperties().apiVersion);
+}
+
+std::vector<const char*> getDynamicRenderingExtensions(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion)
+{
+	if (usableVersion(physicalDevice, apiVersion) >= VK_API_VERSION_1_3)
+	{
+		return {};
+	}
+	//The extension depends on these two, multiview and maintenance2 are core in 1.1
+	return {
+		VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+		VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+		VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME
+	};
+}
+
+bool isDynamicRenderingSupported(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion)
+{
+	if (!canQueryDeviceFeatures(physicalDevice, apiVersion) ||
+		!checkDeviceExtensionSupport(physicalDevice, getDynamicRenderingExtensions(physicalDevice, apiVersion)))
+	{
+		return false;
+	}
+
+	auto features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDynamicRenderingFeatures>();
+	return features.get<vk::PhysicalDeviceDynamicRenderingFeatures>().dynamicRendering == VK_TRUE;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <cstdint>
+
+//VK_KHR_dynamic_rendering path, core in Vulkan 1.3. Rendering begins directly on image views, so the
+//scene needs no vk::RenderPass or vk::Framebuffer and pipelines only depend on the attachment formats.
+//Layout transitions the render pass used to make are recorded as barriers around the pass instead.
+
+//apiVersion is the version the instance was created with, before 1.3 the extension is needed
+bool isDynamicRenderingSupported(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion);
+//Empty when dynamic rendering is core on the device
+std::vector<const char*> getDynamicRenderingExtensions(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion);
@@ -0,0 +1,133 @@
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+//Fraction of the way to the ideal scale taken every frame, a single slow frame shouldn't drop the resolution
+static const float ScaleSmoothing = 0.1f;
+//GPU times this close to the target leave the scale alone
+static const float TargetTolerance = 0.05f;
+
+DynamicResolution::~DynamicResolution()
+{
+	destroy();
+}
+
+bool DynamicResolution::init(const vk::PhysicalDevice& physicalDevice, vk::Device device, uint32_t queueFamily, uint32_t framesInFlight)
+{
+	scale = settings.maxScale;
+
+	uint32_t validBits = physicalDevice.getQueueFamilyProperties()[queueFamily].timestampValidBits;
+	if (validBits == 0)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Timestamps unsupported, dynamic resolution disabled" << std::endl;
+#endif
+		return false;
+	}
+	timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+	timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+
+	//A begin and an end timestamp per frame in flight
+	vk::QueryPoolCreateInfo poolInfo = {};
+	poolInfo.queryType = vk::QueryType::eTimestamp;
+	poolInfo.queryCount = 2 * framesInFlight;
+	try
+	{
+		queryPool = device.createQueryPool(poolInfo);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create timestamp query pool!" << std::endl;
+#endif
+		return false;
+	}
+
+	this->device = device;
+	written.assign(framesInFlight, false);
+	return true;
+}
+
+void DynamicResolution::destroy()
+{
+	if (queryPool)
+	{
+		device.destroyQueryPool(queryPool);
+		queryPool = nullptr;
+	}
+	written.clear();
+	device = nullptr;
+}
+
+void DynamicResolution::setSettings(const DynamicResolutionSettings& newSettings)
+{
+	settings = newSettings;
+	settings.minScale = std::min(std::max(settings.minScale, 0.1f), 1.0f);
+	settings.maxScale = std::min(std::max(settings.maxScale, settings.minScale), 1.0f);
+	scale = std::min(std::max(scale, settings.minScale), settings.maxScale);
+	if (!queryPool)
+	{
+		scale = settings.maxScale;
+	}
+}
+
+void DynamicResolution::update(uint32_t frame)
+{
+	if (!queryPool || !written[frame])
+	{
+		return;
+	}
+
+	//The fence was waited on, so the results are there and this doesn't block
+	uint64_t timestamps[2];
+	vk::Result result = device.getQueryPoolResults(queryPool, 2 * frame, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+		vk::QueryResultFlagBits::e64);
+	if (result != vk::Result::eSuccess)
+	{
+		return;
+	}
+	uint64_t ticks = ((timestamps[1] & timestampMask) - (timestamps[0] & timestampMask)) & timestampMask;
+	gpuMilliseconds = float(double(ticks) * timestampPeriod / 1000000.0);
+
+	if (std::abs(gpuMilliseconds - settings.targetMilliseconds) < settings.targetMilliseconds * TargetTolerance)
+	{
+		return;
+	}
+
+	//Pixel cost goes with the area, so the scale per axis follows the square root of the time ratio
+	float ideal = scale * std::sqrt(settings.targetMilliseconds / std::max(gpuMilliseconds, 0.01f));
+	scale += (ideal - scale) * ScaleSmoothing;
+	scale = std::min(std::max(scale, settings.minScale), settings.maxScale);
+}
+
+void DynamicResolution::recordBegin(vk::CommandBuffer commandBuffer, uint32_t frame)
+{
+	if (!queryPool)
+	{
+		return;
+	}
+	commandBuffer.resetQueryPool(queryPool, 2 * frame, 2);
+	commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queryPool, 2 * frame);
+}
+
+void DynamicResolution::recordEnd(vk::CommandBuffer commandBuffer, uint32_t frame)
+{
+	if (!queryPool)
+	{
+		return;
+	}
+	commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, 2 * frame + 1);
+	written[frame] = true;
+}
+
+vk::Extent2D DynamicResolution::getRenderExtent(vk::Extent2D fullExtent) const
+{
+	vk::Extent2D extent;
+	extent.width = std::max(1u, static_cast<uint32_t>(std::lround(fullExtent.width * scale)));
+	extent.height = std::max(1u, static_cast<uint32_t>(std::lround(fullExtent.height * scale)));
+	extent.width = std::min(extent.width, fullExtent.width);
+	extent.height = std::min(extent.height, fullExtent.height);
+	return extent;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <cstdint>
+
+struct DynamicResolutionSettings
+{
+	//Fraction of the output resolution, per axis
+	float minScale{ 0.5f };
+	float maxScale{ 1.0f };
+	//GPU time per frame to aim for, leaves headroom below a 60 Hz frame
+	float targetMilliseconds{ 14.0f };
+};
+
+//Measures every frame's GPU time with timestamp queries and scales the render resolution so that
+//the GPU time stays at the target. Timestamps are read back once the frame's fence was waited on,
+//so the scale always reacts to the most recent finished frame without stalling.
+class DynamicResolution
+{
+public:
+	~DynamicResolution();
+
+	//Returns false when the queue family can't write timestamps, the scale then stays at maxScale
+	bool init(const vk::PhysicalDevice& physicalDevice, vk::Device device, uint32_t queueFamily, uint32_t framesInFlight);
+	bool isEnabled() const { return static_cast<bool>(queryPool); }
+	void destroy();
+
+	void setSettings(const DynamicResolutionSettings& settings);
+	const DynamicResolutionSettings& getSettings() const { return settings; }
+
+	//Call after the fence of the frame slot was waited on, before its command buffer is recorded again
+	void update(uint32_t frame);
+	//Around the frame's resolution dependent work, outside of any render pass and before anything
+	//that waits for the swapchain image
+	void recordBegin(vk::CommandBuffer commandBuffer, uint32_t frame);
+	void recordEnd(vk::CommandBuffer commandBuffer, uint32_t frame);
+
+	float getScale() const { return scale; }
+	//The scaled part of an image of the full extent to render into
+	vk::Extent2D getRenderExtent(vk::Extent2D fullExtent) const;
+	float getGpuMilliseconds() const { return gpuMilliseconds; }
+private:
+	vk::Device device{ nullptr };
+	vk::QueryPool queryPool{ nullptr };
+	//Nanoseconds per timestamp tick
+	float timestampPeriod{ 1.0f };
+	uint64_t timestampMask{ ~0ull };
+	//Whether the slot's queries were written by a submitted frame
+	std::vector<bool> written;
+
+	DynamicResolutionSettings settings;
+	float scale{ 1.0f };
+	float gpuMilliseconds{ 0.0f };
+};
@@ -0,0 +1,216 @@
+#include "ecs.h"
+
+#include <atomic>
+#include <cassert>
+#include <mutex>
+
+namespace
+{
+	ComponentRegistry::Info componentInfos[MaxComponentTypes];
+	std::atomic<uint32_t> componentTypeCount{ 0 };
+	std::mutex registryMutex;
+
+	size_t alignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+ComponentType ComponentRegistry::registerType(size_t size, size_t alignment)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	uint32_t type = componentTypeCount.load();
+	assert(type < MaxComponentTypes && "Too many component types for a ComponentMask");
+	componentInfos[type] = { size, alignment };
+	componentTypeCount.store(type + 1);
+	return type;
+}
+
+const ComponentRegistry::Info& ComponentRegistry::getInfo(ComponentType type)
+{
+	return componentInfos[type];
+}
+
+Archetype::Archetype(ComponentMask mask) : mask(mask)
+{
+	size_t bytesPerEntity = sizeof(Entity);
+	for (ComponentType type = 0; type < MaxComponentTypes; ++type)
+	{
+		offsets[type] = 0;
+		if (mask & (ComponentMask(1) << type))
+		{
+			types.push_back(type);
+			bytesPerEntity += ComponentRegistry::getInfo(type).size;
+		}
+	}
+
+	//Leave room for padding every array out to a cache line
+	size_t usable = ChunkSize - ComponentArrayAlignment * types.size();
+	capacity = static_cast<uint32_t>(usable / bytesPerEntity);
+
+	//Entity handles first, then one array per component
+	size_t offset = capacity * sizeof(Entity);
+	for (ComponentType type : types)
+	{
+		offset = alignUp(offset, ComponentArrayAlignment);
+		offsets[type] = static_cast<uint32_t>(offset);
+		offset += capacity * ComponentRegistry::getInfo(type).size;
+	}
+	assert(offset <= ChunkSize);
+}
+
+Archetype::~Archetype()
+{
+	for (uint8_t* chunk : chunks)
+	{
+		::operator delete(chunk, std::align_val_t(ChunkSize));
+	}
+}
+
+void Archetype::allocateRow(uint32_t& chunk, uint32_t& row)
+{
+	if (chunks.empty() || counts.back() == capacity)
+	{
+		chunks.push_back(static_cast<uint8_t*>(::operator new(ChunkSize, std::align_val_t(ChunkSize))));
+		counts.push_back(0);
+	}
+	chunk = static_cast<uint32_t>(chunks.size() - 1);
+	row = counts.back()++;
+}
+
+Entity Archetype::removeRow(uint32_t chunk, uint32_t row)
+{
+	uint32_t lastChunk = static_cast<uint32_t>(chunks.size() - 1);
+	uint32_t lastRow = counts.back() - 1;
+
+	Entity moved;
+	if (chunk != lastChunk || row != lastRow)
+	{
+		moved = entities(lastChunk)[lastRow];
+		entities(chunk)[row] = moved;
+		for (ComponentType type : types)
+		{
+			size_t size = ComponentRegistry::getInfo(type).size;
+			std::memcpy(static_cast<uint8_t*>(components(chunk, type)) + row * size,
+				static_cast<uint8_t*>(components(lastChunk, type)) + lastRow * size, size);
+		}
+	}
+
+	if (--counts.back() == 0)
+	{
+		::operator delete(chunks.back(), std::align_val_t(ChunkSize));
+		chunks.pop_back();
+		counts.pop_back();
+	}
+	return moved;
+}
+
+Archetype& EntityStore::getArchetype(ComponentMask mask)
+{
+	auto found = archetypesByMask.find(mask);
+	if (found != archetypesByMask.end())
+	{
+		return *found->second;
+	}
+
+	archetypes.push_back(std::make_unique<Archetype>(mask));
+	archetypesByMask[mask] = archetypes.back().get();
+	return *archetypes.back();
+}
+
+Entity EntityStore::createEntity(ComponentMask mask)
+{
+	Entity entity;
+	if (!freeIndices.empty())
+	{
+		entity.index = freeIndices.back();
+		freeIndices.pop_back();
+	}
+	else
+	{
+		entity.index = static_cast<uint32_t>(records.size());
+		records.push_back({ nullptr, 0, 0, 0 });
+	}
+
+	Record& record = records[entity.index];
+	entity.generation = record.generation;
+	record.archetype = &getArchetype(mask);
+	record.archetype->allocateRow(record.chunk, record.row);
+	record.archetype->entities(record.chunk)[record.row] = entity;
+	++aliveCount;
+	return entity;
+}
+
+void EntityStore::destroy(Entity entity)
+{
+	if (!isAlive(entity))
+	{
+		return;
+	}
+
+	Record& record = records[entity.index];
+	Entity moved = record.archetype->removeRow(record.chunk, record.row);
+	if (moved.index != UINT32_MAX)
+	{
+		records[moved.index].chunk = record.chunk;
+		records[moved.index].row = record.row;
+	}
+
+	//A new generation makes every handle to the old entity stale
+	record.archetype = nullptr;
+	++record.generation;
+	freeIndices.push_back(entity.index);
+	--aliveCount;
+}
+
+bool EntityStore::isAlive(Entity entity) const
+{
+	return entity.index < records.size() && records[entity.index].archetype &&
+		records[entity.index].generation == entity.generation;
+}
+
+void EntityStore::clear()
+{
+	archetypes.clear();
+	archetypesByMask.clear();
+	records.clear();
+	freeIndices.clear();
+	aliveCount = 0;
+}
+
+void EntityStore::moveEntity(Entity entity, ComponentMask mask)
+{
+	Record& record = records[entity.index];
+	Archetype* source = record.archetype;
+	if (source->getMask() == mask)
+	{
+		return;
+	}
+
+	Archetype& target = getArchetype(mask);
+	uint32_t chunk, row;
+	target.allocateRow(chunk, row);
+	target.entities(chunk)[row] = entity;
+
+	//Components both archetypes have are carried over, new ones are written by the caller
+	for (ComponentType type : source->types)
+	{
+		if (mask & (ComponentMask(1) << type))
+		{
+			size_t size = ComponentRegistry::getInfo(type).size;
+			std::memcpy(static_cast<uint8_t*>(target.components(chunk, type)) + row * size,
+				static_cast<uint8_t*>(source->components(record.chunk, type)) + record.row * size, size);
+		}
+	}
+
+	Entity moved = source->removeRow(record.chunk, record.row);
+	if (moved.index != UINT32_MAX)
+	{
+		records[moved.index].chunk = record.chunk;
+		records[moved.index].row = record.row;
+	}
+
+	record.archetype = &target;
+	record.chunk = chunk;
+	record.row = row;
+}
@@ -0,0 +1,237 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "job_system.h"
+
+//Handle to an entity, stale once the entity is destroyed
+struct Entity
+{
+	uint32_t index{ UINT32_MAX };
+	uint32_t generation{ 0 };
+
+	bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+using ComponentType = uint32_t;
+//One bit per component type
+using ComponentMask = uint64_t;
+static const uint32_t MaxComponentTypes = 64;
+
+//Chunks are this big and aligned to their size, component arrays inside start on cache lines
+static const size_t ChunkSize = 16 * 1024;
+static const size_t ComponentArrayAlignment = 64;
+
+//Component types are numbered in the order they are first used
+class ComponentRegistry
+{
+public:
+	struct Info
+	{
+		size_t size;
+		size_t alignment;
+	};
+
+	template <typename T>
+	static ComponentType typeOf()
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Components are moved between chunks with memcpy");
+		static_assert(alignof(T) <= ComponentArrayAlignment, "Component arrays are only aligned to cache lines");
+		static const ComponentType type = registerType(sizeof(T), alignof(T));
+		return type;
+	}
+	static const Info& getInfo(ComponentType type);
+private:
+	static ComponentType registerType(size_t size, size_t alignment);
+};
+
+template <typename... Components>
+ComponentMask componentMask()
+{
+	return (ComponentMask(0) | ... | (ComponentMask(1) << ComponentRegistry::typeOf<Components>()));
+}
+
+//All entities with exactly the same set of components. Each chunk stores the entity handles and
+//one array per component type, so iterating a component is a linear walk through memory.
+class Archetype
+{
+public:
+	explicit Archetype(ComponentMask mask);
+	~Archetype();
+	Archetype(const Archetype&) = delete;
+	Archetype& operator=(const Archetype&) = delete;
+
+	ComponentMask getMask() const { return mask; }
+	//Entities per chunk
+	uint32_t getCapacity() const { return capacity; }
+	size_t chunkCount() const { return chunks.size(); }
+	uint32_t entityCount(size_t chunk) const { return counts[chunk]; }
+
+	Entity* entities(size_t chunk) { return reinterpret_cast<Entity*>(chunks[chunk]); }
+	void* components(size_t chunk, ComponentType type) { return chunks[chunk] + offsets[type]; }
+	template <typename T>
+	T* components(size_t chunk) { return static_cast<T*>(components(chunk, ComponentRegistry::typeOf<T>())); }
+private:
+	friend class EntityStore;
+
+	//Appends a row to the last chunk, starting a new one when it is full
+	void allocateRow(uint32_t& chunk, uint32_t& row);
+	//Moves the last row into the hole so chunks stay dense, returns the moved entity or an invalid one
+	Entity removeRow(uint32_t chunk, uint32_t row);
+
+	ComponentMask mask;
+	uint32_t capacity{ 0 };
+	std::vector<ComponentType> types;
+	uint32_t offsets[MaxComponentTypes];
+	std::vector<uint8_t*> chunks;
+	std::vector<uint32_t> counts;
+};
+
+//Entities grouped into archetypes by their component set. Queries only visit the chunks of
+//archetypes that have every requested component.
+class EntityStore
+{
+public:
+	template <typename... Components>
+	Entity create(const Components&... components)
+	{
+		Entity entity = createEntity(componentMask<Components...>());
+		(writeComponent(entity, components), ...);
+		return entity;
+	}
+	void destroy(Entity entity);
+	bool isAlive(Entity entity) const;
+	size_t size() const { return aliveCount; }
+	void clear();
+
+	//nullptr when the entity is dead or doesn't have the component
+	template <typename T>
+	T* get(Entity entity)
+	{
+		if (!isAlive(entity) || !(records[entity.index].archetype->getMask() & componentMask<T>()))
+		{
+			return nullptr;
+		}
+		const Record& record = records[entity.index];
+		return record.archetype->components<T>(record.chunk) + record.row;
+	}
+	template <typename T>
+	bool has(Entity entity) const
+	{
+		return isAlive(entity) && (records[entity.index].archetype->getMask() & componentMask<T>());
+	}
+
+	//Moves the entity to the archetype with the component, or overwrites it when already there
+	template <typename T>
+	void add(Entity entity, const T& component)
+	{
+		if (!isAlive(entity))
+		{
+			return;
+		}
+		moveEntity(entity, records[entity.index].archetype->getMask() | componentMask<T>());
+		writeComponent(entity, component);
+	}
+	template <typename T>
+	void remove(Entity entity)
+	{
+		if (isAlive(entity))
+		{
+			moveEntity(entity, records[entity.index].archetype->getMask() & ~componentMask<T>());
+		}
+	}
+
+	//Calls function(count, entities, Components*...) once per matching chunk, with the
+	//component arrays of that chunk
+	template <typename... Components, typename Function>
+	void forEachChunk(Function&& function)
+	{
+		ComponentMask mask = componentMask<Components...>();
+		for (const auto& archetype : archetypes)
+		{
+			if ((archetype->getMask() & mask) != mask)
+			{
+				continue;
+			}
+			for (size_t chunk = 0; chunk < archetype->chunkCount(); ++chunk)
+			{
+				function(size_t(archetype->entityCount(chunk)), archetype->entities(chunk),
+					archetype->template components<Components>(chunk)...);
+			}
+		}
+	}
+
+	//Calls function(entity, Components&...) for every matching entity
+	template <typename... Components, typename Function>
+	void forEach(Function&& function)
+	{
+		forEachChunk<Components...>([&function](size_t count, Entity* entities, Components*... arrays) {
+			for (size_t i = 0; i < count; ++i)
+			{
+				function(entities[i], arrays[i]...);
+			}
+		});
+	}
+
+	//Like forEachChunk with every chunk as its own job. The function must not create or
+	//destroy entities, or add or remove components.
+	template <typename... Components, typename Function>
+	void forEachChunkParallel(JobSystem& jobs, Function&& function)
+	{
+		ComponentMask mask = componentMask<Components...>();
+		std::vector<std::pair<Archetype*, size_t>> chunks;
+		for (const auto& archetype : archetypes)
+		{
+			if ((archetype->getMask() & mask) == mask)
+			{
+				for (size_t chunk = 0; chunk < archetype->chunkCount(); ++chunk)
+				{
+					chunks.emplace_back(archetype.get(), chunk);
+				}
+			}
+		}
+
+		jobs.parallelFor(chunks.size(), 1, [&](size_t first, size_t end) {
+			for (size_t i = first; i < end; ++i)
+			{
+				Archetype* archetype = chunks[i].first;
+				size_t chunk = chunks[i].second;
+				function(size_t(archetype->entityCount(chunk)), archetype->entities(chunk),
+					archetype->template components<Components>(chunk)...);
+			}
+		});
+	}
+private:
+	struct Record
+	{
+		Archetype* archetype;
+		uint32_t chunk;
+		uint32_t row;
+		uint32_t generation;
+	};
+
+	Archetype& getArchetype(ComponentMask mask);
+	Entity createEntity(ComponentMask mask);
+	void moveEntity(Entity entity, ComponentMask mask);
+
+	template <typename T>
+	void writeComponent(Entity entity, const T& component)
+	{
+		const Record& record = records[entity.index];
+		record.archetype->components<T>(record.chunk)[record.row] = component;
+	}
+
+	std::vector<std::unique_ptr<Archetype>> archetypes;
+	std::unordered_map<ComponentMask, Archetype*> archetypesByMask;
+	std::vector<Record> records;
+	std::vector<uint32_t> freeIndices;
+	size_t aliveCount{ 0 };
+};
@@ -0,0 +1,83 @@
+#include "frame_limiter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <timeapi.h>
+#endif
+
+//Averaged equally up to this many samples, after that the weight of older ones decays by 1/MaxSleepSamples
+//per sleep, so the estimate follows changes in timer behavior and stays bounded however long it runs
+static const uint64_t MaxSleepSamples = 1000;
+
+FrameLimiter::FrameLimiter()
+{
+#ifdef _WIN32
+	//The default timer resolution of 15.6 ms would leave nearly every frame to the spin
+	timeBeginPeriod(1);
+#endif
+}
+
+FrameLimiter::~FrameLimiter()
+{
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+void FrameLimiter::setTargetFrameRate(double framesPerSecond)
+{
+	targetFrameRate = std::max(0.0, framesPerSecond);
+	period = targetFrameRate > 0.0 ?
+		std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFrameRate)) : Clock::duration(0);
+	started = false;
+}
+
+void FrameLimiter::wait()
+{
+	if (period.count() == 0)
+	{
+		return;
+	}
+
+	Clock::time_point now = Clock::now();
+	//A frame that ran more than a period late doesn't get followed by a burst of catch-up frames
+	if (!started || now > next + period)
+	{
+		next = now;
+		started = true;
+	}
+	else
+	{
+		sleepUntil(next);
+	}
+	next += period;
+}
+
+void FrameLimiter::sleepUntil(Clock::time_point deadline)
+{
+	while (std::chrono::duration<double>(deadline - Clock::now()).count() > sleepEstimate)
+	{
+		Clock::time_point start = Clock::now();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		double observed = std::chrono::duration<double>(Clock::now() - start).count();
+
+		//Exponentially weighted mean and variance, the estimate is one standard deviation above the mean
+		sleepCount = std::min(sleepCount + 1, MaxSleepSamples);
+		double weight = 1.0 / static_cast<double>(sleepCount);
+		double delta = observed - sleepMean;
+		sleepMean += weight * delta;
+		sleepVariance = (1.0 - weight) * (sleepVariance + weight * delta * delta);
+		sleepEstimate = sleepMean + std::sqrt(std::max(0.0, sleepVariance));
+	}
+
+	//Too close for a sleep to wake up in time
+	while (Clock::now() < deadline)
+	{
+		std::this_thread::yield();
+	}
+}
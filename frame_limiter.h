@@ -0,0 +1,37 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+//Caps the frame rate by waiting for each frame's start time. Sleeps while the deadline is further
+//away than a sleep is known to overshoot, then spins the rest, so frames start within microseconds
+//of their target without burning a core for the whole wait.
+class FrameLimiter
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	FrameLimiter();
+	~FrameLimiter();
+
+	//0 turns the limiter off
+	void setTargetFrameRate(double framesPerSecond);
+	double getTargetFrameRate() const { return targetFrameRate; }
+
+	//Blocks until the next frame is due. Call it before the frame takes its input (the latest
+	//scene snapshot), so the waiting happens ahead of the frame instead of between its input and its present.
+	void wait();
+private:
+	void sleepUntil(Clock::time_point deadline);
+
+	double targetFrameRate{ 0.0 };
+	Clock::duration period{ 0 };
+	Clock::time_point next;
+	bool started{ false };
+
+	//Running mean and variance of how long a 1 ms sleep really takes, in seconds
+	double sleepMean{ 0.002 };
+	double sleepVariance{ 0.0 };
+	uint64_t sleepCount{ 1 };
+	//Sleeps stop once less than this is left
+	double sleepEstimate{ 0.002 };
+};
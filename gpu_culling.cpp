@@ -0,0 +1,429 @@
+#include "gpu_culling.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+
+static const uint32_t CullGroupSize = 64;
+static const uint32_t PyramidGroupSize = 8;
+static const size_t InitialCapacity = 1024;
+
+struct CullConstants
+{
+	glm::mat4 viewProjection;
+	uint32_t instanceCount;
+	float radius;
+	uint32_t occlusion;
+	uint32_t lodCount;
+	glm::vec4 lodErrors;
+	float maxPixelError;
+	float hysteresis;
+	float viewportHeight;
+	float pyramidScale;
+};
+
+struct PyramidConstants
+{
+	int32_t sourceWidth, sourceHeight;
+	int32_t destinationWidth, destinationHeight;
+};
+
+vk::Pipeline GpuCulling::makeComputePipeline(ShaderModuleCache& shaderModules, PipelineLayoutCache& pipelineLayouts,
+	const std::string& filename, vk::PipelineLayout& layout, vk::DescriptorSetLayout& setLayout)
+{
+	const ShaderModule* shader = shaderModules.get(device, filename);
+	if (!shader)
+	{
+		return nullptr;
+	}
+
+	PipelineLayoutSignature signature = makeLayoutSignature({ shader->reflection });
+	layout = pipelineLayouts.get(device, signature);
+	setLayout = signature.sets.empty() ? nullptr : pipelineLayouts.getSetLayout(device, signature.sets[0]);
+
+	vk::ComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.flags = vk::PipelineCreateFlags();
+	pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+	pipelineInfo.stage.module = shader->module;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = layout;
+
+#ifdef DEBUG_MODE
+	std::cout << "Create Compute Pipeline " << filename << std::endl;
+#endif
+	try
+	{
+		return device.createComputePipeline(nullptr, pipelineInfo).value;
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create compute pipeline " << filename << std::endl;
+#endif
+		return nullptr;
+	}
+}
+
+bool GpuCulling::init(const vk::PhysicalDevice& physicalDevice, vk::Device device, ShaderModuleCache& shaderModules,
+	PipelineLayoutCache& pipelineLayouts, vk::DescriptorSetLayout drawSetLayout, const Image& depthBuffer,
+	const LodMesh& mesh, uint32_t framesInFlight, const std::vector<uint32_t>& sharingFamilies)
+{
+	if (mesh.levels.empty() || mesh.levels.size() > MaxLodLevels)
+	{
+		return false;
+	}
+
+	this->physicalDevice = physicalDevice;
+	this->device = device;
+	this->mesh = mesh;
+	this->sharingFamilies = sharingFamilies;
+
+	cullPipeline = makeComputePipeline(shaderModules, pipelineLayouts, "media/shaders/cull.spv", cullLayout, cullSetLayout);
+	pyramidPipeline = makeComputePipeline(shaderModules, pipelineLayouts, "media/shaders/hiz.spv", pyramidLayout, pyramidSetLayout);
+	if (!cullPipeline || !pyramidPipeline || !cullSetLayout || !pyramidSetLayout || !drawSetLayout)
+	{
+		destroy();
+		return false;
+	}
+
+	//Each level is half of the one above, level 0 is half of the depth buffer
+	depthExtent = depthBuffer.extent;
+	vk::Extent2D pyramidExtent(std::max(1u, depthExtent.width / 2), std::max(1u, depthExtent.height / 2));
+	uint32_t levels = 1;
+	while ((std::max(pyramidExtent.width, pyramidExtent.height) >> levels) > 0)
+	{
+		++levels;
+	}
+	depthPyramid = createImage(physicalDevice, device, pyramidExtent, vk::Format::eR32Sfloat,
+		vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled, vk::ImageAspectFlagBits::eColor, levels);
+	if (!depthPyramid.image)
+	{
+		destroy();
+		return false;
+	}
+
+	vk::SamplerCreateInfo samplerInfo = {};
+	samplerInfo.magFilter = vk::Filter::eNearest;
+	samplerInfo.minFilter = vk::Filter::eNearest;
+	samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+	samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+	samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+	samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	std::vector<vk::DescriptorPoolSize> poolSizes = {
+		{ vk::DescriptorType::eStorageBuffer, 6 * framesInFlight },
+		{ vk::DescriptorType::eCombinedImageSampler, framesInFlight + levels },
+		{ vk::DescriptorType::eStorageImage, levels }
+	};
+	vk::DescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.flags = vk::DescriptorPoolCreateFlags();
+	poolInfo.maxSets = 2 * framesInFlight + levels;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+
+	try
+	{
+		sampler = device.createSampler(samplerInfo);
+		descriptorPool = device.createDescriptorPool(poolInfo);
+
+		std::vector<vk::DescriptorSetLayout> pyramidLayouts(levels, pyramidSetLayout);
+		vk::DescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.descriptorPool = descriptorPool;
+		allocInfo.descriptorSetCount = levels;
+		allocInfo.pSetLayouts = pyramidLayouts.data();
+		pyramidSets = device.allocateDescriptorSets(allocInfo);
+
+		frames.resize(framesInFlight);
+		for (Frame& frame : frames)
+		{
+			vk::DescriptorSetLayout frameLayouts[] = { cullSetLayout, drawSetLayout };
+			allocInfo.descriptorSetCount = 2;
+			allocInfo.pSetLayouts = frameLayouts;
+			std::vector<vk::DescriptorSet> sets = device.allocateDescriptorSets(allocInfo);
+			frame.cullSet = sets[0];
+			frame.drawSet = sets[1];
+		}
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create GPU culling descriptors!" << std::endl;
+#endif
+		destroy();
+		return false;
+	}
+
+	for (Frame& frame : frames)
+	{
+		//Host visible so the counts can be read back once the frame's fence was waited on
+		frame.drawCommands = createBuffer(physicalDevice, device, MaxLodLevels * sizeof(vk::DrawIndirectCommand),
+			vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, sharingFamilies);
+		if (!frame.drawCommands.buffer)
+		{
+			destroy();
+			return false;
+		}
+		std::memset(frame.drawCommands.mapped, 0, MaxLodLevels * sizeof(vk::DrawIndirectCommand));
+	}
+	if (!allocateInstances(InitialCapacity))
+	{
+		destroy();
+		return false;
+	}
+
+	//Level 0 reads the depth buffer, every other level the one above it
+	std::vector<vk::DescriptorImageInfo> sources(levels);
+	std::vector<vk::DescriptorImageInfo> destinations(levels);
+	std::vector<vk::WriteDescriptorSet> writes;
+	for (uint32_t level = 0; level < levels; ++level)
+	{
+		sources[level].sampler = sampler;
+		sources[level].imageView = level == 0 ? depthBuffer.view : depthPyramid.mipViews[level - 1];
+		sources[level].imageLayout = level == 0 ? vk::ImageLayout::eShaderReadOnlyOptimal : vk::ImageLayout::eGeneral;
+		destinations[level].imageView = depthPyramid.mipViews[level];
+		destinations[level].imageLayout = vk::ImageLayout::eGeneral;
+
+		writes.push_back(vk::WriteDescriptorSet(pyramidSets[level], 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &sources[level]));
+		writes.push_back(vk::WriteDescriptorSet(pyramidSets[level], 1, 0, 1, vk::DescriptorType::eStorageImage, &destinations[level]));
+	}
+	device.updateDescriptorSets(writes, nullptr);
+
+	return true;
+}
+
+bool GpuCulling::allocateInstances(size_t newCapacity)
+{
+	//The level state is shared by every frame, so all of them grow together
+	capacity = 0;
+	destroyBuffer(device, lodState);
+	lodState = createBuffer(physicalDevice, device, newCapacity * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer,
+		vk::MemoryPropertyFlagBits::eDeviceLocal);
+	if (!lodState.buffer)
+	{
+		return false;
+	}
+
+	for (Frame& frame : frames)
+	{
+		destroyBuffer(device, frame.instances);
+		destroyBuffer(device, frame.visible);
+
+		//Both are read by the vertex shader as well, the level state and the pyramid stay on the culling queue
+		frame.instances = createBuffer(physicalDevice, device, newCapacity * sizeof(glm::mat4), vk::BufferUsageFlagBits::eStorageBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, sharingFamilies);
+		//Every level has a section big enough for all instances
+		frame.visible = createBuffer(physicalDevice, device, newCapacity * MaxLodLevels * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, sharingFamilies);
+		if (!frame.instances.buffer || !frame.visible.buffer)
+		{
+			return false;
+		}
+	}
+
+	capacity = newCapacity;
+	for (Frame& frame : frames)
+	{
+		writeFrameSets(frame);
+	}
+	return true;
+}
+
+void GpuCulling::writeFrameSets(Frame& frame)
+{
+	vk::DescriptorBufferInfo instances(frame.instances.buffer, 0, VK_WHOLE_SIZE);
+	vk::DescriptorBufferInfo visible(frame.visible.buffer, 0, VK_WHOLE_SIZE);
+	vk::DescriptorBufferInfo drawCommands(frame.drawCommands.buffer, 0, VK_WHOLE_SIZE);
+	vk::DescriptorImageInfo pyramid(sampler, depthPyramid.view, vk::ImageLayout::eGeneral);
+	vk::DescriptorBufferInfo levels(lodState.buffer, 0, VK_WHOLE_SIZE);
+
+	std::array<vk::WriteDescriptorSet, 7> writes = {
+		vk::WriteDescriptorSet(frame.cullSet, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &instances),
+		vk::WriteDescriptorSet(frame.cullSet, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &visible),
+		vk::WriteDescriptorSet(frame.cullSet, 2, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &drawCommands),
+		vk::WriteDescriptorSet(frame.cullSet, 3, 0, 1, vk::DescriptorType::eCombinedImageSampler, &pyramid),
+		vk::WriteDescriptorSet(frame.cullSet, 4, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &levels),
+		vk::WriteDescriptorSet(frame.drawSet, 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &instances),
+		vk::WriteDescriptorSet(frame.drawSet, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &visible)
+	};
+	device.updateDescriptorSets(writes, nullptr);
+}
+
+void GpuCulling::upload(uint32_t frameIndex, const glm::mat4* models, size_t count)
+{
+	Frame& frame = frames[frameIndex];
+
+	//The slot's fence has been waited on, so the counts the GPU wrote last time are final
+	vk::DrawIndirectCommand* commands = static_cast<vk::DrawIndirectCommand*>(frame.drawCommands.mapped);
+	statistics.reset(mesh.levels.size());
+	for (uint32_t level = 0; level < mesh.levels.size(); ++level)
+	{
+		statistics.add(mesh, level, commands[level].instanceCount);
+	}
+
+	if (count > capacity)
+	{
+		//Other frames in flight still use the shared buffers. Growing is rare, so just wait.
+		device.waitIdle();
+		if (!allocateInstances(std::max(count, capacity * 2)))
+		{
+			for (Frame& other : frames)
+			{
+				other.count = 0;
+			}
+			return;
+		}
+	}
+	std::memcpy(frame.instances.mapped, models, count * sizeof(glm::mat4));
+	frame.count = count;
+
+	//instanceCount starts at 0 and is counted up by the shader
+	for (uint32_t level = 0; level < mesh.levels.size(); ++level)
+	{
+		commands[level] = vk::DrawIndirectCommand(mesh.levels[level].vertexCount, 0, mesh.levels[level].firstVertex,
+			static_cast<uint32_t>(level * capacity));
+	}
+}
+
+void GpuCulling::recordCull(vk::CommandBuffer commandBuffer, uint32_t frameIndex, const glm::mat4& viewProjection, float radius,
+	const LodSettings& lodSettings, float viewportHeight)
+{
+	Frame& frame = frames[frameIndex];
+
+	//The pyramid is bound from the first frame on, even though it's only read once it was built
+	if (!pyramidInitialized)
+	{
+		vk::ImageMemoryBarrier toGeneral(vk::AccessFlags(), vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+			vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+			depthPyramid.image, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, depthPyramid.mipLevels, 0, 1));
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(), nullptr, nullptr, toGeneral);
+		pyramidInitialized = true;
+	}
+
+	//The pyramid and level state the previous frame wrote have to land before culling reads them.
+	//The draw commands were reset by the host, which submission makes visible.
+	vk::MemoryBarrier beforeCull(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(), beforeCull, nullptr, nullptr);
+
+	CullConstants constants = {};
+	constants.viewProjection = viewProjection;
+	constants.instanceCount = static_cast<uint32_t>(frame.count);
+	constants.radius = radius;
+	constants.occlusion = pyramidValid ? 1 : 0;
+	constants.lodCount = static_cast<uint32_t>(mesh.levels.size());
+	for (uint32_t level = 0; level < mesh.levels.size(); ++level)
+	{
+		constants.lodErrors[level] = mesh.levels[level].geometricError;
+	}
+	constants.maxPixelError = lodSettings.maxPixelError;
+	constants.hysteresis = lodSettings.hysteresis;
+	constants.viewportHeight = viewportHeight;
+	constants.pyramidScale = pyramidScale;
+
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullLayout, 0, frame.cullSet, nullptr);
+	commandBuffer.pushConstants(cullLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+	if (frame.count > 0)
+	{
+		commandBuffer.dispatch(static_cast<uint32_t>((frame.count + CullGroupSize - 1) / CullGroupSize), 1, 1);
+	}
+
+	//A compute-only queue doesn't have the draw stages, the semaphore it signals covers them there
+	if (sharingFamilies.size() > 1)
+	{
+		return;
+	}
+	vk::MemoryBarrier afterCull(vk::AccessFlagBits::eShaderWrite,
+		vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader,
+		vk::DependencyFlags(), afterCull, nullptr, nullptr);
+}
+
+void GpuCulling::recordDraws(vk::CommandBuffer commandBuffer, vk::PipelineLayout layout, uint32_t frameIndex)
+{
+	const Frame& frame = frames[frameIndex];
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0, frame.drawSet, nullptr);
+
+	//One draw per level rather than one multi-draw, so the multiDrawIndirect feature isn't needed
+	for (uint32_t level = 0; level < mesh.levels.size(); ++level)
+	{
+		commandBuffer.drawIndirect(frame.drawCommands.buffer, level * sizeof(vk::DrawIndirectCommand), 1, sizeof(vk::DrawIndirectCommand));
+	}
+}
+
+void GpuCulling::recordDepthPyramid(vk::CommandBuffer commandBuffer, float renderScale)
+{
+	//The render pass dependency (or the semaphore from the graphics queue) already made the depth writes
+	//visible to compute. Culling earlier in this frame read the old pyramid, so only an execution dependency is needed.
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(), nullptr, nullptr, nullptr);
+
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pyramidPipeline);
+
+	vk::Extent2D source = depthExtent;
+	for (uint32_t level = 0; level < depthPyramid.mipLevels; ++level)
+	{
+		vk::Extent2D destination(std::max(1u, depthPyramid.extent.width >> level), std::max(1u, depthPyramid.extent.height >> level));
+
+		PyramidConstants constants = {
+			static_cast<int32_t>(source.width), static_cast<int32_t>(source.height),
+			static_cast<int32_t>(destination.width), static_cast<int32_t>(destination.height)
+		};
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pyramidLayout, 0, pyramidSets[level], nullptr);
+		commandBuffer.pushConstants(pyramidLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+		commandBuffer.dispatch((destination.width + PyramidGroupSize - 1) / PyramidGroupSize,
+			(destination.height + PyramidGroupSize - 1) / PyramidGroupSize, 1);
+
+		//The next level reads this one
+		vk::ImageMemoryBarrier levelDone(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead,
+			vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+			VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, depthPyramid.image,
+			vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1));
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+			vk::DependencyFlags(), nullptr, nullptr, levelDone);
+
+		source = destination;
+	}
+	pyramidValid = true;
+	pyramidScale = renderScale;
+}
+
+void GpuCulling::destroy()
+{
+	if (!device)
+	{
+		return;
+	}
+
+	for (Frame& frame : frames)
+	{
+		destroyBuffer(device, frame.instances);
+		destroyBuffer(device, frame.visible);
+		destroyBuffer(device, frame.drawCommands);
+	}
+	frames.clear();
+	destroyBuffer(device, lodState);
+	capacity = 0;
+	pyramidSets.clear();
+	destroyImage(device, depthPyramid);
+
+	//Layouts belong to the PipelineLayoutCache, the sets go with the pool
+	device.destroyDescriptorPool(descriptorPool);
+	device.destroySampler(sampler);
+	device.destroyPipeline(cullPipeline);
+	device.destroyPipeline(pyramidPipeline);
+
+	descriptorPool = nullptr;
+	sampler = nullptr;
+	cullPipeline = nullptr;
+	pyramidPipeline = nullptr;
+	pyramidInitialized = false;
+	pyramidValid = false;
+	device = nullptr;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "gpu_resources.h"
+#include "pipeline.h"
+#include "lod.h"
+
+//Culls instances on the GPU: cull.comp tests every model matrix against the frustum and against
+//a hierarchical-Z pyramid built from the previous frame's depth buffer, picks a level of detail
+//for the survivors, compacts them per level and writes their counts into indirect draws.
+//The CPU never touches individual objects.
+class GpuCulling
+{
+public:
+	//The most levels of detail a mesh can have on this path
+	static const uint32_t MaxLodLevels = 4;
+
+	//drawSetLayout is set 0 of the vertex shader that reads the culled instances (instanced.vert).
+	//sharingFamilies are the graphics and compute families when culling runs on its own compute queue,
+	//the buffers the draws read are then shared between them. Empty when everything is on one queue.
+	//Returns false when the shaders or resources can't be made, the caller then culls on the CPU.
+	bool init(const vk::PhysicalDevice& physicalDevice, vk::Device device, ShaderModuleCache& shaderModules,
+		PipelineLayoutCache& pipelineLayouts, vk::DescriptorSetLayout drawSetLayout, const Image& depthBuffer,
+		const LodMesh& mesh, uint32_t framesInFlight, const std::vector<uint32_t>& sharingFamilies = {});
+	bool isEnabled() const { return static_cast<bool>(device); }
+	void destroy();
+
+	//Copies the model matrices into the instance buffer of a frame slot that is no longer in use,
+	//and collects the statistics of the last time the slot was drawn
+	void upload(uint32_t frame, const glm::mat4* models, size_t count);
+
+	//Outside of a render pass, before the draw. radius is the bounding radius of the mesh in model space.
+	//On a separate compute queue the caller's semaphore has to make the results visible to the draws.
+	void recordCull(vk::CommandBuffer commandBuffer, uint32_t frame, const glm::mat4& viewProjection, float radius,
+		const LodSettings& lodSettings, float viewportHeight);
+	//Inside the render pass, with the instanced pipeline and the mesh's vertex buffer bound
+	void recordDraws(vk::CommandBuffer commandBuffer, vk::PipelineLayout layout, uint32_t frame);
+	//Outside of a render pass, after the depth buffer has been written, for the next frame to cull against.
+	//renderScale is the fraction of the depth buffer the frame drew to, the rest must be cleared to far.
+	void recordDepthPyramid(vk::CommandBuffer commandBuffer, float renderScale = 1.0f);
+
+	//Read back from the indirect draws, so it lags a few frames behind
+	const LodStatistics& getStatistics() const { return statistics; }
+private:
+	struct Frame
+	{
+		Buffer instances;
+		Buffer visible;
+		//Host visible, one vk::DrawIndirectCommand per level of detail
+		Buffer drawCommands;
+		size_t count{ 0 };
+		vk::DescriptorSet cullSet{ nullptr };
+		vk::DescriptorSet drawSet{ nullptr };
+	};
+
+	vk::Pipeline makeComputePipeline(ShaderModuleCache& shaderModules, PipelineLayoutCache& pipelineLayouts,
+		const std::string& filename, vk::PipelineLayout& layout, vk::DescriptorSetLayout& setLayout);
+	bool allocateInstances(size_t capacity);
+	void writeFrameSets(Frame& frame);
+
+	vk::PhysicalDevice physicalDevice{ nullptr };
+	vk::Device device{ nullptr };
+	std::vector<uint32_t> sharingFamilies;
+	vk::DescriptorPool descriptorPool{ nullptr };
+	vk::Sampler sampler{ nullptr };
+
+	vk::Pipeline cullPipeline{ nullptr };
+	vk::PipelineLayout cullLayout{ nullptr };
+	vk::DescriptorSetLayout cullSetLayout{ nullptr };
+	vk::Pipeline pyramidPipeline{ nullptr };
+	vk::PipelineLayout pyramidLayout{ nullptr };
+	vk::DescriptorSetLayout pyramidSetLayout{ nullptr };
+
+	std::vector<Frame> frames;
+	//Instances every frame's buffers have room for
+	size_t capacity{ 0 };
+	//Last level of every instance, shared by all frames since the queue orders them anyway
+	Buffer lodState;
+	LodMesh mesh;
+	LodStatistics statistics;
+
+	vk::Extent2D depthExtent;
+	Image depthPyramid;
+	//One set per pyramid level, reading the level above (or the depth buffer) and writing the level
+	std::vector<vk::DescriptorSet> pyramidSets;
+	bool pyramidInitialized{ false };
+	//Set once a pyramid has been recorded, occlusion culling is skipped until then
+	bool pyramidValid{ false };
+	float pyramidScale{ 1.0f };
+};
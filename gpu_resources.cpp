@@ -0,0 +1,198 @@
+#include "gpu_resources.h"
+
+#include <iostream>
+
+uint32_t findMemoryType(const vk::PhysicalDevice& physicalDevice, uint32_t typeBits, vk::MemoryPropertyFlags properties)
+{
+	vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+	{
+		if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+	return UINT32_MAX;
+}
+
+static vk::DeviceMemory allocateMemory(const vk::PhysicalDevice& physicalDevice, vk::Device device,
+	const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties)
+{
+	uint32_t memoryType = findMemoryType(physicalDevice, requirements.memoryTypeBits, properties);
+	if (memoryType == UINT32_MAX)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "No suitable memory type!" << std::endl;
+#endif
+		return nullptr;
+	}
+
+	vk::MemoryAllocateInfo allocInfo = {};
+	allocInfo.allocationSize = requirements.size;
+	allocInfo.memoryTypeIndex = memoryType;
+	try
+	{
+		return device.allocateMemory(allocInfo);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to allocate device memory!" << std::endl;
+#endif
+		return nullptr;
+	}
+}
+
+Buffer createBuffer(const vk::PhysicalDevice& physicalDevice, vk::Device device, vk::DeviceSize size,
+	vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, const std::vector<uint32_t>& sharingFamilies)
+{
+	Buffer buffer;
+
+	vk::BufferCreateInfo bufferInfo = {};
+	bufferInfo.flags = vk::BufferCreateFlags();
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+	if (sharingFamilies.size() > 1)
+	{
+		bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
+		bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+		bufferInfo.pQueueFamilyIndices = sharingFamilies.data();
+	}
+	try
+	{
+		buffer.buffer = device.createBuffer(bufferInfo);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create buffer!" << std::endl;
+#endif
+		return Buffer();
+	}
+
+	buffer.memory = allocateMemory(physicalDevice, device, device.getBufferMemoryRequirements(buffer.buffer), properties);
+	if (!buffer.memory)
+	{
+		destroyBuffer(device, buffer);
+		return Buffer();
+	}
+	device.bindBufferMemory(buffer.buffer, buffer.memory, 0);
+	buffer.size = size;
+
+	if (properties & vk::MemoryPropertyFlagBits::eHostVisible)
+	{
+		buffer.mapped = device.mapMemory(buffer.memory, 0, size);
+	}
+	return buffer;
+}
+
+void destroyBuffer(vk::Device device, Buffer& buffer)
+{
+	if (buffer.mapped)
+	{
+		device.unmapMemory(buffer.memory);
+	}
+	device.destroyBuffer(buffer.buffer);
+	device.freeMemory(buffer.memory);
+	buffer = Buffer();
+}
+
+static vk::ImageView makeImageView(vk::Device device, const Image& image, vk::ImageAspectFlags aspect, uint32_t baseMip, uint32_t mipCount)
+{
+	vk::ImageViewCreateInfo createInfo = {};
+	createInfo.image = image.image;
+	createInfo.viewType = vk::ImageViewType::e2D;
+	createInfo.format = image.format;
+	createInfo.components.r = vk::ComponentSwizzle::eIdentity;
+	createInfo.components.g = vk::ComponentSwizzle::eIdentity;
+	createInfo.components.b = vk::ComponentSwizzle::eIdentity;
+	createInfo.components.a = vk::ComponentSwizzle::eIdentity;
+	createInfo.subresourceRange.aspectMask = aspect;
+	createInfo.subresourceRange.baseMipLevel = baseMip;
+	createInfo.subresourceRange.levelCount = mipCount;
+	createInfo.subresourceRange.baseArrayLayer = 0;
+	createInfo.subresourceRange.layerCount = 1;
+	return device.createImageView(createInfo);
+}
+
+Image createImage(const vk::PhysicalDevice& physicalDevice, vk::Device device, vk::Extent2D extent, vk::Format format,
+	vk::ImageUsageFlags usage, vk::ImageAspectFlags aspect, uint32_t mipLevels, const std::vector<uint32_t>& sharingFamilies)
+{
+	Image image;
+	image.format = format;
+	image.extent = extent;
+	image.mipLevels = mipLevels;
+
+	vk::ImageCreateInfo imageInfo = {};
+	imageInfo.flags = vk::ImageCreateFlags();
+	imageInfo.imageType = vk::ImageType::e2D;
+	imageInfo.format = format;
+	imageInfo.extent = vk::Extent3D(extent.width, extent.height, 1);
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = vk::SampleCountFlagBits::e1;
+	imageInfo.tiling = vk::ImageTiling::eOptimal;
+	imageInfo.usage = usage;
+	imageInfo.sharingMode = vk::SharingMode::eExclusive;
+	if (sharingFamilies.size() > 1)
+	{
+		imageInfo.sharingMode = vk::SharingMode::eConcurrent;
+		imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+		imageInfo.pQueueFamilyIndices = sharingFamilies.data();
+	}
+	imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+	try
+	{
+		image.image = device.createImage(imageInfo);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create image!" << std::endl;
+#endif
+		return Image();
+	}
+
+	image.memory = allocateMemory(physicalDevice, device, device.getImageMemoryRequirements(image.image), vk::MemoryPropertyFlagBits::eDeviceLocal);
+	if (!image.memory)
+	{
+		destroyImage(device, image);
+		return Image();
+	}
+	device.bindImageMemory(image.image, image.memory, 0);
+
+	try
+	{
+		image.view = makeImageView(device, image, aspect, 0, mipLevels);
+		if (mipLevels > 1)
+		{
+			for (uint32_t mip = 0; mip < mipLevels; ++mip)
+			{
+				image.mipViews.push_back(makeImageView(device, image, aspect, mip, 1));
+			}
+		}
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create image view!" << std::endl;
+#endif
+		destroyImage(device, image);
+		return Image();
+	}
+	return image;
+}
+
+void destroyImage(vk::Device device, Image& image)
+{
+	for (vk::ImageView view : image.mipViews)
+	{
+		device.destroyImageView(view);
+	}
+	device.destroyImageView(image.view);
+	device.destroyImage(image.image);
+	device.freeMemory(image.memory);
+	image = Image();
+}
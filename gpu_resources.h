@@ -0,0 +1,40 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <vector>
+
+//Returns UINT32_MAX when no memory type in typeBits has all of the properties
+uint32_t findMemoryType(const vk::PhysicalDevice& physicalDevice, uint32_t typeBits, vk::MemoryPropertyFlags properties);
+
+struct Buffer
+{
+	vk::Buffer buffer{ nullptr };
+	vk::DeviceMemory memory{ nullptr };
+	vk::DeviceSize size{ 0 };
+	//Persistently mapped when the memory is host visible, nullptr otherwise
+	void* mapped{ nullptr };
+};
+
+//Returns an empty Buffer on failure. With more than one of sharingFamilies the buffer is shared
+//concurrently between those queue families, so no ownership transfers are needed.
+Buffer createBuffer(const vk::PhysicalDevice& physicalDevice, vk::Device device, vk::DeviceSize size,
+	vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, const std::vector<uint32_t>& sharingFamilies = {});
+void destroyBuffer(vk::Device device, Buffer& buffer);
+
+struct Image
+{
+	vk::Image image{ nullptr };
+	vk::DeviceMemory memory{ nullptr };
+	vk::Format format{ vk::Format::eUndefined };
+	vk::Extent2D extent;
+	uint32_t mipLevels{ 1 };
+	//View of every mip level
+	vk::ImageView view{ nullptr };
+	//One view per mip level, only made when mipLevels > 1
+	std::vector<vk::ImageView> mipViews;
+};
+
+//Device local 2D image, returns an empty Image on failure. sharingFamilies as for createBuffer().
+Image createImage(const vk::PhysicalDevice& physicalDevice, vk::Device device, vk::Extent2D extent, vk::Format format,
+	vk::ImageUsageFlags usage, vk::ImageAspectFlags aspect, uint32_t mipLevels = 1, const std::vector<uint32_t>& sharingFamilies = {});
+void destroyImage(vk::Device device, Image& image);
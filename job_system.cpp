@@ -0,0 +1,273 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+struct Job
+{
+	std::function<void()> function;
+	JobCounter* counter;
+	JobCounter* dependency;
+};
+
+namespace
+{
+	//Index of the worker running on this thread, -1 for threads that aren't workers
+	thread_local int workerIndex = -1;
+	thread_local const JobSystem* workerSystem = nullptr;
+	thread_local uint32_t stealSeed = 0;
+}
+
+bool WorkStealingDeque::push(Job* job)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= Capacity)
+	{
+		return false;
+	}
+	jobs[b & (Capacity - 1)].store(job, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+Job* WorkStealingDeque::pop()
+{
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		//Empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = jobs[b & (Capacity - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		//Last job, race the thieves for it
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			job = nullptr;
+		}
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Job* WorkStealingDeque::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+	{
+		return nullptr;
+	}
+
+	Job* job = jobs[t & (Capacity - 1)].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return nullptr;
+	}
+	return job;
+}
+
+JobSystem::~JobSystem()
+{
+	shutdown();
+}
+
+void JobSystem::init(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	stopping = false;
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		deques.push_back(std::make_unique<WorkStealingDeque>());
+	}
+
+	workerIndex = 0;
+	workerSystem = this;
+	for (uint32_t i = 1; i < threadCount; ++i)
+	{
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+}
+
+void JobSystem::shutdown()
+{
+	if (deques.empty())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	sleep.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+	deques.clear();
+
+	if (workerSystem == this)
+	{
+		workerIndex = -1;
+		workerSystem = nullptr;
+	}
+}
+
+void JobSystem::run(JobCounter& counter, std::function<void()> function, JobCounter* dependency)
+{
+	counter.pending.fetch_add(1, std::memory_order_relaxed);
+	Job* job = new Job{ std::move(function), &counter, dependency };
+
+	if (dependency)
+	{
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (!dependency->isDone())
+		{
+			dependency->waiting.push_back(job);
+			return;
+		}
+	}
+	schedule(job);
+}
+
+void JobSystem::schedule(Job* job)
+{
+	if (deques.empty())
+	{
+		execute(job);
+		return;
+	}
+
+	queued.fetch_add(1, std::memory_order_release);
+	bool pushed = false;
+	if (workerSystem == this && workerIndex >= 0)
+	{
+		pushed = deques[workerIndex]->push(job);
+	}
+	if (!pushed)
+	{
+		std::lock_guard<std::mutex> lock(injectedMutex);
+		injected.push_back(job);
+	}
+	sleep.notify_one();
+}
+
+void JobSystem::execute(Job* job)
+{
+	job->function();
+	JobCounter* counter = job->counter;
+	delete job;
+
+	//Decremented under the lock, so a waiter that saw zero and then takes the lock
+	//knows this thread is done with the counter
+	std::vector<Job*> ready;
+	{
+		std::lock_guard<std::mutex> lock(counter->mutex);
+		if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			ready.swap(counter->waiting);
+		}
+	}
+	for (Job* waitingJob : ready)
+	{
+		schedule(waitingJob);
+	}
+}
+
+Job* JobSystem::findJob()
+{
+	Job* job = nullptr;
+	if (workerSystem == this && workerIndex >= 0)
+	{
+		job = deques[workerIndex]->pop();
+	}
+
+	if (!job)
+	{
+		//Start at a random victim so thieves don't all hammer the same deque
+		uint32_t count = static_cast<uint32_t>(deques.size());
+		stealSeed = stealSeed * 1664525u + 1013904223u;
+		uint32_t start = (stealSeed >> 16) % count;
+		for (uint32_t i = 0; i < count && !job; ++i)
+		{
+			uint32_t victim = (start + i) % count;
+			if (static_cast<int>(victim) != workerIndex || workerSystem != this)
+			{
+				job = deques[victim]->steal();
+			}
+		}
+	}
+
+	if (!job)
+	{
+		std::lock_guard<std::mutex> lock(injectedMutex);
+		if (!injected.empty())
+		{
+			job = injected.front();
+			injected.pop_front();
+		}
+	}
+
+	if (job)
+	{
+		queued.fetch_sub(1, std::memory_order_acq_rel);
+	}
+	return job;
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	while (!counter.isDone())
+	{
+		Job* job = findJob();
+		if (job)
+		{
+			execute(job);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	//The last job may still be holding the lock it decremented under
+	std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+void JobSystem::workerLoop(uint32_t index)
+{
+	workerIndex = static_cast<int>(index);
+	workerSystem = this;
+	stealSeed = index * 2654435761u;
+
+	while (!stopping.load(std::memory_order_acquire))
+	{
+		Job* job = findJob();
+		if (job)
+		{
+			execute(job);
+			continue;
+		}
+
+		//Nothing to do, sleep until a job is scheduled
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleep.wait_for(lock, std::chrono::milliseconds(1), [this]() {
+			return stopping.load(std::memory_order_acquire) || queued.load(std::memory_order_acquire) > 0;
+		});
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Job;
+
+//Counts unfinished jobs. Jobs can be made to wait for a counter, and threads waiting
+//on one keep executing other jobs until it drops to zero.
+class JobCounter
+{
+public:
+	bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+private:
+	friend class JobSystem;
+
+	std::atomic<uint32_t> pending{ 0 };
+	std::mutex mutex;
+	//Jobs that depend on this counter, scheduled once it reaches zero
+	std::vector<Job*> waiting;
+};
+
+//Chase-Lev work-stealing deque of a fixed size. Only the owning thread pushes and pops at
+//the bottom, any other thread steals from the top.
+class WorkStealingDeque
+{
+public:
+	static const int64_t Capacity = 4096;
+
+	//Returns false when full
+	bool push(Job* job);
+	Job* pop();
+	Job* steal();
+private:
+	alignas(64) std::atomic<int64_t> top{ 0 };
+	alignas(64) std::atomic<int64_t> bottom{ 0 };
+	std::atomic<Job*> jobs[Capacity];
+};
+
+//Fixed pool of workers, one per hardware thread with the thread that calls init() as worker 0.
+//Every worker has its own deque; idle workers steal from the others.
+class JobSystem
+{
+public:
+	~JobSystem();
+
+	//threadCount 0 uses the hardware concurrency
+	void init(uint32_t threadCount = 0);
+	void shutdown();
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(deques.size()); }
+
+	//Adds one to counter and runs job, after dependency reached zero when one is given
+	void run(JobCounter& counter, std::function<void()> job, JobCounter* dependency = nullptr);
+	//Executes other jobs until counter reaches zero
+	void wait(JobCounter& counter);
+
+	//Calls body(first, end) on chunks of [0, count) of at least grainSize items and waits for all of them
+	template <typename Body>
+	void parallelFor(size_t count, size_t grainSize, const Body& body)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		size_t chunks = (count + grainSize - 1) / grainSize;
+		chunks = std::min(chunks, size_t(getThreadCount()) * 4);
+		if (chunks <= 1 || deques.empty())
+		{
+			body(size_t(0), count);
+			return;
+		}
+
+		JobCounter counter;
+		size_t chunkSize = (count + chunks - 1) / chunks;
+		for (size_t first = chunkSize; first < count; first += chunkSize)
+		{
+			size_t end = std::min(count, first + chunkSize);
+			run(counter, [&body, first, end]() { body(first, end); });
+		}
+		//The calling thread takes the first chunk itself
+		body(size_t(0), std::min(count, chunkSize));
+		wait(counter);
+	}
+private:
+	void schedule(Job* job);
+	void execute(Job* job);
+	Job* findJob();
+	void workerLoop(uint32_t index);
+
+	std::vector<std::unique_ptr<WorkStealingDeque>> deques;
+	std::vector<std::thread> workers;
+
+	//Jobs scheduled from threads that aren't workers, which can't push to a deque
+	std::mutex injectedMutex;
+	std::deque<Job*> injected;
+
+	std::mutex sleepMutex;
+	std::condition_variable sleep;
+	std::atomic<uint32_t> queued{ 0 };
+	std::atomic<bool> stopping{ false };
+};
@@ -0,0 +1,250 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "device_support.h"
+
+//How long the waiter sleeps between polls of a present, without holding the swapchain. It bounds
+//how late a present can be noticed.
+static const std::chrono::microseconds PresentPollInterval(200);
+
+static double toMilliseconds(LatencyClock::duration duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void LatencyHistogram::add(double milliseconds)
+{
+	uint32_t bucket = std::min(BucketCount - 1, static_cast<uint32_t>(std::max(0.0, milliseconds) / BucketMilliseconds));
+	++buckets[bucket];
+	++samples;
+	total += milliseconds;
+	maximum = std::max(maximum, milliseconds);
+}
+
+void LatencyHistogram::reset()
+{
+	buckets.fill(0);
+	samples = 0;
+	total = 0.0;
+	maximum = 0.0;
+}
+
+double LatencyHistogram::percentile(double fraction) const
+{
+	uint64_t target = static_cast<uint64_t>(fraction * samples);
+	uint64_t seen = 0;
+	for (uint32_t bucket = 0; bucket < BucketCount; ++bucket)
+	{
+		seen += buckets[bucket];
+		if (seen > target)
+		{
+			return (bucket + 1) * BucketMilliseconds;
+		}
+	}
+	return maximum;
+}
+
+std::vector<const char*> LatencyTracker::getDeviceExtensions()
+{
+	return { VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME };
+}
+
+bool LatencyTracker::isSupported(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion)
+{
+	if (!canQueryDeviceFeatures(physicalDevice, apiVersion) || !checkDeviceExtensionSupport(physicalDevice, getDeviceExtensions()))
+	{
+		return false;
+	}
+
+	auto features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2,
+		vk::PhysicalDevicePresentIdFeaturesKHR, vk::PhysicalDevicePresentWaitFeaturesKHR>();
+	return features.get<vk::PhysicalDevicePresentIdFeaturesKHR>().presentId == VK_TRUE &&
+		features.get<vk::PhysicalDevicePresentWaitFeaturesKHR>().presentWait == VK_TRUE;
+}
+
+LatencyTracker::~LatencyTracker()
+{
+	destroy();
+}
+
+void LatencyTracker::init(vk::Device device, bool presentWaitSupported, const vk::DispatchLoaderDynamic& dispatch)
+{
+	this->device = device;
+	this->dispatch = &dispatch;
+	presentWait = presentWaitSupported;
+	stopping = false;
+	if (presentWait)
+	{
+		waiter = std::thread(&LatencyTracker::waitLoop, this);
+	}
+#ifdef DEBUG_MODE
+	std::cout << (presentWait ? "Measuring latency up to the present with present wait" :
+		"Measuring latency up to vkQueuePresentKHR, present wait is unavailable") << std::endl;
+#endif
+}
+
+void LatencyTracker::destroy()
+{
+	if (waiter.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueChanged.notify_all();
+		waiter.join();
+	}
+	queue.clear();
+	device = nullptr;
+}
+
+void LatencyTracker::recordInput()
+{
+	//GLFW only runs callbacks inside glfwPollEvents and has no event times of its own,
+	//so this misses however long the event waited for the poll.
+	//Only the oldest input a frame hasn't seen yet is kept, 0 means there is none.
+	int64_t now = LatencyClock::now().time_since_epoch().count();
+	int64_t none = 0;
+	pendingInput.compare_exchange_strong(none, now);
+}
+
+FrameLatency LatencyTracker::sampleInput()
+{
+	FrameLatency frame;
+	frame.sampled = LatencyClock::now();
+	int64_t input = pendingInput.load();
+	frame.input = LatencyClock::time_point(LatencyClock::duration(input));
+	frame.hasInput = input != 0;
+	return frame;
+}
+
+FrameLatency LatencyTracker::beginFrame(const FrameLatency& sampled)
+{
+	FrameLatency frame = sampled;
+	frame.measured = true;
+	if (!frame.hasInput)
+	{
+		return frame;
+	}
+
+	//A step that sampled the input before an earlier frame claimed it still carries it, it only counts once
+	int64_t input = frame.input.time_since_epoch().count();
+	if (input <= claimedInput)
+	{
+		frame.hasInput = false;
+		return frame;
+	}
+	claimedInput = input;
+	//Input that arrives from now on is the next one a frame will see
+	pendingInput.compare_exchange_strong(input, 0);
+	return frame;
+}
+
+void LatencyTracker::framePresented(vk::SwapchainKHR swapchain, uint64_t presentId, const FrameLatency& frame)
+{
+	if (!frame.measured)
+	{
+		return;
+	}
+	if (!presentWait)
+	{
+		record(frame, LatencyClock::now());
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queue.push_back({ swapchain, presentId, frame });
+	}
+	queueChanged.notify_all();
+}
+
+void LatencyTracker::flush()
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+	queueChanged.wait(lock, [this]() { return (queue.empty() && !waiting) || stopping; });
+}
+
+void LatencyTracker::takeHistograms(LatencyHistogram& inputToPresent, LatencyHistogram& frameToPresent)
+{
+	std::lock_guard<std::mutex> lock(histogramMutex);
+	inputToPresent = this->inputToPresent;
+	frameToPresent = this->frameToPresent;
+	this->inputToPresent.reset();
+	this->frameToPresent.reset();
+}
+
+void LatencyTracker::record(const FrameLatency& frame, LatencyClock::time_point presented)
+{
+	std::lock_guard<std::mutex> lock(histogramMutex);
+	frameToPresent.add(toMilliseconds(presented - frame.sampled));
+	if (frame.hasInput)
+	{
+		inputToPresent.add(toMilliseconds(presented - frame.input));
+	}
+}
+
+void LatencyTracker::waitLoop()
+{
+	while (true)
+	{
+		PendingPresent pending;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueChanged.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (stopping)
+			{
+				return;
+			}
+			pending = queue.front();
+			queue.pop_front();
+			waiting = true;
+		}
+
+		//Polled without a timeout, and only when the render thread doesn't hold the swapchain. A blocking
+		//wait would hold it too, and acquire and present would stall behind the very thing they measure.
+		bool done = false;
+		while (!done)
+		{
+			std::unique_lock<std::mutex> swapchainLock(swapchainMutex, std::try_to_lock);
+			if (swapchainLock.owns_lock())
+			{
+				try
+				{
+					vk::Result result = device.waitForPresentKHR(pending.swapchain, pending.presentId, 0, *dispatch);
+					if (result == vk::Result::eSuccess || result == vk::Result::eSuboptimalKHR)
+					{
+						record(pending.frame, LatencyClock::now());
+						done = true;
+					}
+				}
+				catch (vk::SystemError err)
+				{
+					//Out of date or lost, this frame won't be shown
+					done = true;
+				}
+				swapchainLock.unlock();
+			}
+
+			if (!done)
+			{
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+					done = stopping;
+				}
+				if (!done)
+				{
+					std::this_thread::sleep_for(PresentPollInterval);
+				}
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			waiting = false;
+		}
+		queueChanged.notify_all();
+	}
+}
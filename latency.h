@@ -0,0 +1,117 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+using LatencyClock = std::chrono::steady_clock;
+
+//Latency samples in 0.5 ms buckets, the last bucket takes everything slower
+class LatencyHistogram
+{
+public:
+	static const uint32_t BucketCount = 200;
+	static constexpr double BucketMilliseconds = 0.5;
+
+	void add(double milliseconds);
+	void reset();
+
+	uint64_t count() const { return samples; }
+	double mean() const { return samples ? total / samples : 0.0; }
+	double max() const { return maximum; }
+	//Upper edge of the bucket below which the given fraction of samples lies
+	double percentile(double fraction) const;
+private:
+	std::array<uint32_t, BucketCount> buckets{};
+	uint64_t samples{ 0 };
+	double total{ 0.0 };
+	double maximum{ 0.0 };
+};
+
+//Timestamps one frame carries from input sampling to presentation
+struct FrameLatency
+{
+	//When the simulation step the frame shows sampled input
+	LatencyClock::time_point sampled;
+	//Oldest input event the frame is the first to see, if there was one
+	LatencyClock::time_point input;
+	bool hasInput{ false };
+	//False for a frame that draws the same snapshot again, it isn't measured
+	bool measured{ false };
+};
+
+//Measures how long input and frames take to reach the display. With VK_KHR_present_id and
+//VK_KHR_present_wait a thread polls for each present to actually happen; without them a frame
+//counts as presented when vkQueuePresentKHR returns, which hides the queueing in the swapchain.
+class LatencyTracker
+{
+public:
+	static bool isSupported(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion);
+	static std::vector<const char*> getDeviceExtensions();
+
+	~LatencyTracker();
+
+	void init(vk::Device device, bool presentWaitSupported, const vk::DispatchLoaderDynamic& dispatch);
+	void destroy();
+	bool usesPresentWait() const { return presentWait; }
+
+	//Called from input callbacks, on the window thread
+	void recordInput();
+	//Called where the simulation samples input, on the window thread. The input stays pending until
+	//a frame claims it, so a step whose snapshot is never drawn passes it on to the next one.
+	FrameLatency sampleInput();
+	//Called by the render thread for the first frame that draws a snapshot, with what the snapshot sampled
+	FrameLatency beginFrame(const FrameLatency& sampled);
+
+	//Id for the present of the next frame, chain it with vk::PresentIdKHR when present wait is used
+	uint64_t nextPresentId() { return ++lastPresentId; }
+	//Right after the frame's present was queued
+	void framePresented(vk::SwapchainKHR swapchain, uint64_t presentId, const FrameLatency& frame);
+	//Waits until every queued present was seen, call before a swapchain is destroyed
+	void flush();
+
+	//vkWaitForPresentKHR needs the swapchain externally synchronized, so acquire and present hold this too.
+	//The waiter only holds it for polls that don't block, and never while this is held.
+	std::mutex& getSwapchainMutex() { return swapchainMutex; }
+
+	//Moves the samples collected so far out, leaving the tracker's histograms empty
+	void takeHistograms(LatencyHistogram& inputToPresent, LatencyHistogram& frameToPresent);
+private:
+	struct PendingPresent
+	{
+		vk::SwapchainKHR swapchain;
+		uint64_t presentId;
+		FrameLatency frame;
+	};
+
+	void record(const FrameLatency& frame, LatencyClock::time_point presented);
+	void waitLoop();
+
+	vk::Device device{ nullptr };
+	const vk::DispatchLoaderDynamic* dispatch{ nullptr };
+	bool presentWait{ false };
+	uint64_t lastPresentId{ 0 };
+
+	//Ticks of the oldest input no frame has claimed yet, 0 for none
+	std::atomic<int64_t> pendingInput{ 0 };
+	//Render thread only, ticks of the last input a frame claimed
+	int64_t claimedInput{ 0 };
+
+	std::mutex histogramMutex;
+	LatencyHistogram inputToPresent;
+	LatencyHistogram frameToPresent;
+
+	std::mutex swapchainMutex;
+	std::thread waiter;
+	std::mutex queueMutex;
+	std::condition_variable queueChanged;
+	std::deque<PendingPresent> queue;
+	bool waiting{ false };
+	bool stopping{ false };
+};
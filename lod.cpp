@@ -0,0 +1,111 @@
+#include "lod.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//Objects per job when selecting in parallel
+static const size_t ParallelSelectGrainSize = 2048;
+
+void LodStatistics::reset(size_t levelCount)
+{
+	objectsPerLevel.assign(levelCount, 0);
+	triangles = 0;
+	fullDetailTriangles = 0;
+}
+
+void LodStatistics::add(const LodMesh& mesh, uint32_t level, uint32_t objects)
+{
+	objectsPerLevel[level] += objects;
+	triangles += uint64_t(objects) * (mesh.levels[level].vertexCount / 3);
+	fullDetailTriangles += uint64_t(objects) * (mesh.levels[0].vertexCount / 3);
+}
+
+float pixelsPerUnit(const glm::mat4& viewProjection, const glm::mat4& world, float viewportHeight)
+{
+	glm::vec4 clip = viewProjection * world[3];
+	if (clip.w <= 0.0f)
+	{
+		//At or behind the camera plane, always full detail
+		return std::numeric_limits<float>::infinity();
+	}
+
+	//Clip space y per world unit, from the second row of the matrix
+	glm::vec3 row(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]);
+	float scale = std::sqrt(std::max(glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+		std::max(glm::dot(glm::vec3(world[1]), glm::vec3(world[1])), glm::dot(glm::vec3(world[2]), glm::vec3(world[2])))));
+	return glm::length(row) * scale / clip.w * 0.5f * viewportHeight;
+}
+
+uint32_t selectLod(const LodMesh& mesh, const LodSettings& settings, float pixels, uint32_t currentLevel)
+{
+	float coarsenThreshold = settings.maxPixelError * (1.0f - settings.hysteresis);
+
+	uint32_t acceptable = 0;
+	uint32_t clearlyAcceptable = 0;
+	for (uint32_t level = 1; level < mesh.levels.size(); ++level)
+	{
+		float error = mesh.levels[level].geometricError * pixels;
+		if (error <= settings.maxPixelError)
+		{
+			acceptable = level;
+		}
+		if (error <= coarsenThreshold)
+		{
+			clearlyAcceptable = level;
+		}
+	}
+
+	currentLevel = std::min<uint32_t>(currentLevel, static_cast<uint32_t>(mesh.levels.size()) - 1);
+	if (acceptable < currentLevel)
+	{
+		//The current level has become too coarse, refine right away
+		return acceptable;
+	}
+	return std::max(currentLevel, clearlyAcceptable);
+}
+
+void LodSelector::select(const LodMesh& mesh, const LodSettings& settings, const glm::mat4& viewProjection, float viewportHeight,
+	const std::vector<glm::mat4>& worlds, const std::vector<uint32_t>& visible, std::vector<uint8_t>& levels,
+	JobSystem* jobs)
+{
+	currentLevels.resize(worlds.size(), 0);
+	levels.resize(visible.size());
+	statistics.reset(mesh.levels.size());
+	if (mesh.levels.empty())
+	{
+		return;
+	}
+
+	//Every object is visible at most once, so the ranges write disjoint levels
+	auto selectRange = [&](size_t first, size_t end) {
+		for (size_t i = first; i < end; ++i)
+		{
+			uint32_t object = visible[i];
+			float pixels = pixelsPerUnit(viewProjection, worlds[object], viewportHeight);
+			uint32_t level = selectLod(mesh, settings, pixels, currentLevels[object]);
+
+			currentLevels[object] = static_cast<uint8_t>(level);
+			levels[i] = static_cast<uint8_t>(level);
+		}
+	};
+	if (jobs)
+	{
+		jobs->parallelFor(visible.size(), ParallelSelectGrainSize, selectRange);
+	}
+	else
+	{
+		selectRange(0, visible.size());
+	}
+
+	std::vector<uint32_t> objectsPerLevel(mesh.levels.size(), 0);
+	for (uint8_t level : levels)
+	{
+		++objectsPerLevel[level];
+	}
+	for (uint32_t level = 0; level < objectsPerLevel.size(); ++level)
+	{
+		statistics.add(mesh, level, objectsPerLevel[level]);
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class JobSystem;
+
+//One level of detail of a mesh, a range of its vertex buffer drawn as a triangle list
+struct MeshLod
+{
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	//Largest distance between this level and the full detail surface, in model space
+	float geometricError;
+};
+
+//Levels are ordered from full detail to coarsest, with growing geometric error
+struct LodMesh
+{
+	std::vector<MeshLod> levels;
+	//Bounding sphere radius around the model space origin
+	float radius{ 0.0f };
+};
+
+struct LodSettings
+{
+	//A level is good enough while its error projects to at most this many pixels
+	float maxPixelError{ 1.0f };
+	//Fraction of maxPixelError an object has to drop below before it switches to a coarser level
+	float hysteresis{ 0.25f };
+};
+
+struct LodStatistics
+{
+	std::vector<uint32_t> objectsPerLevel;
+	uint64_t triangles{ 0 };
+	//What the same objects would have cost at full detail
+	uint64_t fullDetailTriangles{ 0 };
+
+	void reset(size_t levelCount);
+	void add(const LodMesh& mesh, uint32_t level, uint32_t objects);
+};
+
+//Pixels per model space unit at a world position, for an object with the given world matrix.
+//Uses the vertical scale of the view-projection matrix, so it works for any projection.
+float pixelsPerUnit(const glm::mat4& viewProjection, const glm::mat4& world, float viewportHeight);
+
+//Picks the coarsest level whose projected error is acceptable. An object's current level is
+//remembered, and it only becomes coarser once the error is clearly below the threshold, so
+//objects sitting right at a switching distance don't pop back and forth every frame.
+uint32_t selectLod(const LodMesh& mesh, const LodSettings& settings, float pixels, uint32_t currentLevel);
+
+class LodSelector
+{
+public:
+	//Writes a level for every visible object to levels, indexed like visible. Objects are spread
+	//over jobs when a job system is given.
+	void select(const LodMesh& mesh, const LodSettings& settings, const glm::mat4& viewProjection, float viewportHeight,
+		const std::vector<glm::mat4>& worlds, const std::vector<uint32_t>& visible, std::vector<uint8_t>& levels,
+		JobSystem* jobs = nullptr);
+
+	const LodStatistics& getStatistics() const { return statistics; }
+private:
+	//Per object, the level it was drawn with last
+	std::vector<uint8_t> currentLevels;
+	LodStatistics statistics;
+};
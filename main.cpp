@@ -1,9 +1,32 @@
 
 #include "app.h"
 
-int main()
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+int main(int argc, char** argv)
 {
-	Application* vkApp = new Application();
+	//--windows N opens N windows that all show the scene, one per display
+	uint32_t windowCount = 1;
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--windows") == 0)
+		{
+			windowCount = static_cast<uint32_t>(std::max(1, std::atoi(argv[i + 1])));
+		}
+	}
+
+	Application* vkApp = new Application(windowCount);
+
+	//--max-fps N caps the frame rate
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--max-fps") == 0)
+		{
+			vkApp->setFrameRateLimit(std::atof(argv[i + 1]));
+		}
+	}
 
 	vkApp->run();
 
@@ -0,0 +1,28 @@
+#version 450
+
+// Same as vertex.vert, but the model matrix comes from the instance buffer and gl_InstanceIndex
+// walks the compacted list written by cull.comp. Every level of detail has its own section of
+// that list, which the indirect draw of the level points at through firstInstance.
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(constant_id = 0) const float TRIANGLE_SCALE = 1.0;
+
+layout(std430, set = 0, binding = 0) readonly buffer Instances
+{
+	mat4 models[];
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer VisibleInstances
+{
+	uint visible[];
+};
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+	mat4 model = models[visible[gl_InstanceIndex]];
+	gl_Position = model * vec4(inPosition * TRIANGLE_SCALE, 0.0, 1.0);
+	fragColor = inColor;
+}
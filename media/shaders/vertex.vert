@@ -3,20 +3,12 @@
 // vulkan NDC:	x: -1(left), 1(right)
 //				y: -1(top), 1(bottom)
 
-vec2 positions[3] = vec2[](
-	//vec2(0.0, -0.5),
-	//vec2(0.5, 0.5),
-	//vec2(-0.5, 0.5)
-	vec2(0.0, -0.05), 
-	vec2(0.05, 0.05),
-	vec2(-0.05, 0.05)
-);
+// One level of detail of the mesh, see Application::createMesh()
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
 
-vec3 colors[3] = vec3[](
-	vec3(1.0, 0.0, 0.0),
-	vec3(0.0, 1.0, 0.0),
-	vec3(0.0, 0.0, 1.0)
-);
+// Set through GraphicsPipelineKey::vertexConstants, see Application::getPipelineKey()
+layout(constant_id = 0) const float TRIANGLE_SCALE = 1.0;
 
 layout(push_constant) uniform constants 
 {
@@ -26,7 +18,6 @@ layout(push_constant) uniform constants
 layout(location = 0) out vec3 fragColor;
 
 void main() {
-	//gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-	gl_Position = ObjectData.model *  vec4(positions[gl_VertexIndex], 0.0, 1.0);
-	fragColor = colors[gl_VertexIndex];
-}
\ No newline at end of file
+	gl_Position = ObjectData.model * vec4(inPosition * TRIANGLE_SCALE, 0.0, 1.0);
+	fragColor = inColor;
+}
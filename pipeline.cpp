@@ -0,0 +1,428 @@
+#include "pipeline.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+void SpecializationConstants::set(uint32_t constantId, uint32_t value)
+{
+	setBits(constantId, value);
+}
+
+void SpecializationConstants::set(uint32_t constantId, int32_t value)
+{
+	setBits(constantId, static_cast<uint32_t>(value));
+}
+
+void SpecializationConstants::set(uint32_t constantId, float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	setBits(constantId, bits);
+}
+
+void SpecializationConstants::set(uint32_t constantId, bool value)
+{
+	setBits(constantId, value ? VK_TRUE : VK_FALSE);
+}
+
+void SpecializationConstants::setBits(uint32_t constantId, uint32_t bits)
+{
+	size_t i = 0;
+	while (i < entries.size() && entries[i].constantID < constantId)
+	{
+		++i;
+	}
+
+	if (i < entries.size() && entries[i].constantID == constantId)
+	{
+		data[i] = bits;
+		return;
+	}
+
+	entries.insert(entries.begin() + i, vk::SpecializationMapEntry(constantId, 0, sizeof(uint32_t)));
+	data.insert(data.begin() + i, bits);
+
+	for (size_t j = 0; j < entries.size(); ++j)
+	{
+		entries[j].offset = static_cast<uint32_t>(j * sizeof(uint32_t));
+	}
+}
+
+vk::SpecializationInfo SpecializationConstants::info() const
+{
+	vk::SpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = static_cast<uint32_t>(entries.size());
+	specializationInfo.pMapEntries = entries.data();
+	specializationInfo.dataSize = data.size() * sizeof(uint32_t);
+	specializationInfo.pData = data.data();
+	return specializationInfo;
+}
+
+size_t SpecializationConstants::hash() const
+{
+	size_t seed = entries.size();
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		hashCombine(seed, entries[i].constantID);
+		hashCombine(seed, data[i]);
+	}
+	return seed;
+}
+
+bool SpecializationConstants::operator==(const SpecializationConstants& other) const
+{
+	if (entries.size() != other.entries.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (entries[i].constantID != other.entries[i].constantID || data[i] != other.data[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool GraphicsPipelineKey::operator==(const GraphicsPipelineKey& other) const
+{
+	return vertexShader == other.vertexShader
+		&& fragmentShader == other.fragmentShader
+		&& vertexConstants == other.vertexConstants
+		&& fragmentConstants == other.fragmentConstants;
+}
+
+size_t GraphicsPipelineKeyHash::operator()(const GraphicsPipelineKey& key) const
+{
+	size_t seed = std::hash<std::string>()(key.vertexShader);
+	hashCombine(seed, std::hash<std::string>()(key.fragmentShader));
+	hashCombine(seed, key.vertexConstants.hash());
+	hashCombine(seed, key.fragmentConstants.hash());
+	return seed;
+}
+
+static size_t hashBinding(const vk::DescriptorSetLayoutBinding& binding)
+{
+	size_t seed = binding.binding;
+	hashCombine(seed, static_cast<size_t>(binding.descriptorType));
+	hashCombine(seed, binding.descriptorCount);
+	hashCombine(seed, static_cast<uint32_t>(binding.stageFlags));
+	return seed;
+}
+
+bool PipelineLayoutSignature::operator==(const PipelineLayoutSignature& other) const
+{
+	return sets == other.sets && pushConstants == other.pushConstants;
+}
+
+size_t PipelineLayoutSignatureHash::operator()(const PipelineLayoutSignature& signature) const
+{
+	size_t seed = signature.sets.size();
+	for (const auto& set : signature.sets)
+	{
+		hashCombine(seed, set.size());
+		for (const auto& binding : set)
+		{
+			hashCombine(seed, hashBinding(binding));
+		}
+	}
+	for (const auto& range : signature.pushConstants)
+	{
+		hashCombine(seed, static_cast<uint32_t>(range.stageFlags));
+		hashCombine(seed, range.offset);
+		hashCombine(seed, range.size);
+	}
+	return seed;
+}
+
+size_t PipelineLayoutCache::SetLayoutHash::operator()(const std::vector<vk::DescriptorSetLayoutBinding>& bindings) const
+{
+	size_t seed = bindings.size();
+	for (const auto& binding : bindings)
+	{
+		hashCombine(seed, hashBinding(binding));
+	}
+	return seed;
+}
+
+PipelineLayoutSignature makeLayoutSignature(const std::vector<ShaderReflection>& stages)
+{
+	PipelineLayoutSignature signature;
+
+	for (const ShaderReflection& stage : stages)
+	{
+		for (const ReflectedBinding& reflected : stage.bindings)
+		{
+			if (signature.sets.size() <= reflected.set)
+			{
+				signature.sets.resize(reflected.set + 1);
+			}
+			auto& set = signature.sets[reflected.set];
+
+			auto existing = std::find_if(set.begin(), set.end(),
+				[&](const vk::DescriptorSetLayoutBinding& binding) { return binding.binding == reflected.binding; });
+
+			if (existing != set.end())
+			{
+				existing->stageFlags |= stage.stage;
+				existing->descriptorCount = std::max(existing->descriptorCount, reflected.count);
+			}
+			else
+			{
+				set.push_back(vk::DescriptorSetLayoutBinding(reflected.binding, reflected.type, reflected.count, stage.stage));
+			}
+		}
+
+		if (stage.pushConstantSize == 0)
+		{
+			continue;
+		}
+
+		//Stages that see the same block share one range, a stage may only appear in one range
+		auto existing = std::find_if(signature.pushConstants.begin(), signature.pushConstants.end(),
+			[&](const vk::PushConstantRange& range) { return range.offset == stage.pushConstantOffset && range.size == stage.pushConstantSize; });
+
+		if (existing != signature.pushConstants.end())
+		{
+			existing->stageFlags |= stage.stage;
+		}
+		else
+		{
+			signature.pushConstants.push_back(vk::PushConstantRange(stage.stage, stage.pushConstantOffset, stage.pushConstantSize));
+		}
+	}
+
+	for (auto& set : signature.sets)
+	{
+		std::sort(set.begin(), set.end(),
+			[](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+	}
+
+	return signature;
+}
+
+vk::DescriptorSetLayout PipelineLayoutCache::getSetLayout(vk::Device device, const std::vector<vk::DescriptorSetLayoutBinding>& bindings)
+{
+	auto cached = setLayouts.find(bindings);
+	if (cached != setLayouts.end())
+	{
+		return cached->second;
+	}
+
+	vk::DescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.flags = vk::DescriptorSetLayoutCreateFlags();
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	vk::DescriptorSetLayout setLayout = nullptr;
+	try
+	{
+		setLayout = device.createDescriptorSetLayout(layoutInfo);
+		setLayouts.emplace(bindings, setLayout);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create descriptor set layout!" << std::endl;
+#endif
+	}
+	return setLayout;
+}
+
+vk::PipelineLayout PipelineLayoutCache::get(vk::Device device, const PipelineLayoutSignature& signature)
+{
+	auto cached = layouts.find(signature);
+	if (cached != layouts.end())
+	{
+		return cached->second;
+	}
+
+#ifdef DEBUG_MODE
+	std::cout << "Create Pipeline Layout" << std::endl;
+#endif
+
+	//Gaps in the set numbers still need a (empty) layout
+	std::vector<vk::DescriptorSetLayout> setLayoutHandles;
+	for (const auto& set : signature.sets)
+	{
+		setLayoutHandles.push_back(getSetLayout(device, set));
+	}
+
+	vk::PipelineLayoutCreateInfo layoutInfo;
+	layoutInfo.flags = vk::PipelineLayoutCreateFlags();
+	layoutInfo.setLayoutCount = static_cast<uint32_t>(setLayoutHandles.size());
+	layoutInfo.pSetLayouts = setLayoutHandles.data();
+	layoutInfo.pushConstantRangeCount = static_cast<uint32_t>(signature.pushConstants.size());
+	layoutInfo.pPushConstantRanges = signature.pushConstants.data();
+
+	vk::PipelineLayout layout = nullptr;
+	try
+	{
+		layout = device.createPipelineLayout(layoutInfo);
+		layouts.emplace(signature, layout);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create pipeline layout!" << std::endl;
+#endif
+	}
+	return layout;
+}
+
+void PipelineLayoutCache::destroy(vk::Device device)
+{
+	for (auto& cached : layouts)
+	{
+		device.destroyPipelineLayout(cached.second);
+	}
+	layouts.clear();
+
+	for (auto& cached : setLayouts)
+	{
+		device.destroyDescriptorSetLayout(cached.second);
+	}
+	setLayouts.clear();
+}
+
+GraphicsPipelineState::GraphicsPipelineState(const GraphicsPipelineKey& key, const ShaderModule& vertexShader,
+	const ShaderModule& fragmentShader, vk::Extent2D extent)
+{
+	//Vertex Input, one interleaved binding with the attributes packed in location order
+	uint32_t vertexStride = 0;
+	for (const ReflectedVertexInput& input : vertexShader.reflection.vertexInputs)
+	{
+		attributes.push_back(vk::VertexInputAttributeDescription(input.location, 0, input.format, vertexStride));
+		vertexStride += input.size;
+	}
+	vertexBinding = vk::VertexInputBindingDescription(0, vertexStride, vk::VertexInputRate::eVertex);
+
+	vertexInputInfo = vk::PipelineVertexInputStateCreateInfo();
+	vertexInputInfo.flags = vk::PipelineVertexInputStateCreateFlags();
+	vertexInputInfo.vertexBindingDescriptionCount = attributes.empty() ? 0 : 1;
+	vertexInputInfo.pVertexBindingDescriptions = &vertexBinding;
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+	vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
+
+	//Input Assembly
+	inputAssemblyInfo = vk::PipelineInputAssemblyStateCreateInfo();
+	inputAssemblyInfo.flags = vk::PipelineInputAssemblyStateCreateFlags();
+	inputAssemblyInfo.topology = vk::PrimitiveTopology::eTriangleList;
+
+	//Vertex Shader
+	vertexSpecialization = key.vertexConstants.info();
+	shaderStages[0] = vk::PipelineShaderStageCreateInfo();
+	shaderStages[0].flags = vk::PipelineShaderStageCreateFlags();
+	shaderStages[0].stage = vk::ShaderStageFlagBits::eVertex;
+	shaderStages[0].module = vertexShader.module;
+	shaderStages[0].pName = "main";
+	shaderStages[0].pSpecializationInfo = key.vertexConstants.empty() ? nullptr : &vertexSpecialization;
+
+	//Viewport and Scissor
+	viewport = vk::Viewport();
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)extent.width;
+	viewport.height = (float)extent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	scissor = vk::Rect2D();
+	scissor.offset.x = 0;
+	scissor.offset.y = 0;
+	scissor.extent = extent;
+	viewportState = vk::PipelineViewportStateCreateInfo();
+	viewportState.flags = vk::PipelineViewportStateCreateFlags();
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = &viewport;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = &scissor;
+	dynamicStates[0] = vk::DynamicState::eViewport;
+	dynamicStates[1] = vk::DynamicState::eScissor;
+	dynamicState = vk::PipelineDynamicStateCreateInfo();
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+
+	//Rasterizer
+	rasterizer = vk::PipelineRasterizationStateCreateInfo();
+	rasterizer.flags = vk::PipelineRasterizationStateCreateFlags();
+	rasterizer.depthClampEnable = VK_FALSE; //discard out of bounds fragments, don't clamp them
+	rasterizer.rasterizerDiscardEnable = VK_FALSE; //This flag would disable fragment output
+	rasterizer.polygonMode = vk::PolygonMode::eFill;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = vk::CullModeFlagBits::eBack;
+	rasterizer.frontFace = vk::FrontFace::eClockwise;
+	rasterizer.depthBiasEnable = VK_FALSE; //Depth bias can be useful in shadow maps.
+
+	//Fragment Shader
+	fragmentSpecialization = key.fragmentConstants.info();
+	shaderStages[1] = vk::PipelineShaderStageCreateInfo();
+	shaderStages[1].flags = vk::PipelineShaderStageCreateFlags();
+	shaderStages[1].stage = vk::ShaderStageFlagBits::eFragment;
+	shaderStages[1].module = fragmentShader.module;
+	shaderStages[1].pName = "main";
+	shaderStages[1].pSpecializationInfo = key.fragmentConstants.empty() ? nullptr : &fragmentSpecialization;
+
+	//Multisampling
+	multisampling = vk::PipelineMultisampleStateCreateInfo();
+	multisampling.flags = vk::PipelineMultisampleStateCreateFlags();
+	multisampling.sampleShadingEnable = VK_FALSE;
+	multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+	//Depth, later objects at equal depth still draw over earlier ones
+	depthStencil = vk::PipelineDepthStencilStateCreateInfo();
+	depthStencil.flags = vk::PipelineDepthStencilStateCreateFlags();
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = vk::CompareOp::eLessOrEqual;
+	depthStencil.depthBoundsTestEnable = VK_FALSE;
+	depthStencil.stencilTestEnable = VK_FALSE;
+
+	//Color Blend
+	colorBlendAttachment = vk::PipelineColorBlendAttachmentState();
+	colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+	colorBlendAttachment.blendEnable = VK_FALSE;
+	colorBlending = vk::PipelineColorBlendStateCreateInfo();
+	colorBlending.flags = vk::PipelineColorBlendStateCreateFlags();
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.logicOp = vk::LogicOp::eCopy;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &colorBlendAttachment;
+	colorBlending.blendConstants[0] = 0.0f;
+	colorBlending.blendConstants[1] = 0.0f;
+	colorBlending.blendConstants[2] = 0.0f;
+	colorBlending.blendConstants[3] = 0.0f;
+}
+
+void GraphicsPipelineState::fill(vk::GraphicsPipelineCreateInfo& pipelineInfo) const
+{
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlending;
+}
+
+void RenderTargetLayout::fill(vk::GraphicsPipelineCreateInfo& pipelineInfo, vk::PipelineRenderingCreateInfo& rendering) const
+{
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+	if (renderPass)
+	{
+		return;
+	}
+
+	rendering = vk::PipelineRenderingCreateInfo();
+	rendering.colorAttachmentCount = 1;
+	rendering.pColorAttachmentFormats = &colorFormat;
+	rendering.depthAttachmentFormat = depthFormat;
+	rendering.pNext = pipelineInfo.pNext;
+	pipelineInfo.pNext = &rendering;
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+#include "shader.h"
+
+inline void hashCombine(size_t& seed, size_t value)
+{
+	seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+//Specialization constant values for one shader stage, keyed by their constant_id in GLSL.
+//Every constant is stored as 4 bytes, which covers int, uint, float and bool constants.
+class SpecializationConstants
+{
+public:
+	void set(uint32_t constantId, uint32_t value);
+	void set(uint32_t constantId, int32_t value);
+	void set(uint32_t constantId, float value);
+	void set(uint32_t constantId, bool value);
+
+	bool empty() const { return entries.empty(); }
+
+	//The returned info points into this object, keep it alive until the pipeline is created
+	vk::SpecializationInfo info() const;
+
+	size_t hash() const;
+	bool operator==(const SpecializationConstants& other) const;
+private:
+	void setBits(uint32_t constantId, uint32_t bits);
+
+	//Kept sorted by constantID so equal sets of constants always compare and hash equal
+	std::vector<vk::SpecializationMapEntry> entries;
+	std::vector<uint32_t> data;
+};
+
+//Everything that makes one graphics pipeline different from another
+struct GraphicsPipelineKey
+{
+	std::string vertexShader;
+	std::string fragmentShader;
+	SpecializationConstants vertexConstants;
+	SpecializationConstants fragmentConstants;
+
+	bool operator==(const GraphicsPipelineKey& other) const;
+};
+
+struct GraphicsPipelineKeyHash
+{
+	size_t operator()(const GraphicsPipelineKey& key) const;
+};
+
+struct GraphicsPipeline
+{
+	vk::Pipeline pipeline{ nullptr };
+	vk::PipelineLayout layout{ nullptr };
+};
+
+//Shader stages and fixed function state of one graphics pipeline. Monolithic pipelines and
+//pipeline libraries are both built from this, so the two paths can never disagree.
+//The create infos point into the object itself, so it can't be copied.
+struct GraphicsPipelineState
+{
+	GraphicsPipelineState(const GraphicsPipelineKey& key, const ShaderModule& vertexShader,
+		const ShaderModule& fragmentShader, vk::Extent2D extent);
+	GraphicsPipelineState(const GraphicsPipelineState&) = delete;
+	GraphicsPipelineState& operator=(const GraphicsPipelineState&) = delete;
+
+	//Points every state of pipelineInfo at this object, layout and render pass are left to the caller
+	void fill(vk::GraphicsPipelineCreateInfo& pipelineInfo) const;
+
+	std::vector<vk::VertexInputAttributeDescription> attributes;
+	vk::VertexInputBindingDescription vertexBinding;
+	vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
+	vk::PipelineInputAssemblyStateCreateInfo inputAssemblyInfo;
+
+	vk::SpecializationInfo vertexSpecialization;
+	vk::SpecializationInfo fragmentSpecialization;
+	//[0] vertex, [1] fragment
+	vk::PipelineShaderStageCreateInfo shaderStages[2];
+
+	vk::Viewport viewport;
+	vk::Rect2D scissor;
+	vk::PipelineViewportStateCreateInfo viewportState;
+	//Viewport and scissor are set while recording, so the render resolution can change without new pipelines
+	vk::DynamicState dynamicStates[2];
+	vk::PipelineDynamicStateCreateInfo dynamicState;
+	vk::PipelineRasterizationStateCreateInfo rasterizer;
+	vk::PipelineMultisampleStateCreateInfo multisampling;
+	vk::PipelineDepthStencilStateCreateInfo depthStencil;
+	vk::PipelineColorBlendAttachmentState colorBlendAttachment;
+	vk::PipelineColorBlendStateCreateInfo colorBlending;
+};
+
+//What a graphics pipeline has to be compatible with. With a render pass that's the render pass,
+//with dynamic rendering (renderPass null) only the formats of the attachments it draws to.
+struct RenderTargetLayout
+{
+	vk::RenderPass renderPass{ nullptr };
+	vk::Format colorFormat{ vk::Format::eUndefined };
+	vk::Format depthFormat{ vk::Format::eUndefined };
+
+	bool usesDynamicRendering() const { return !renderPass; }
+	//Sets the render pass of pipelineInfo, or chains rendering in front of its pNext.
+	//rendering is filled in here and has to live until the pipeline is created.
+	void fill(vk::GraphicsPipelineCreateInfo& pipelineInfo, vk::PipelineRenderingCreateInfo& rendering) const;
+};
+
+//Descriptor set layouts and push constant ranges merged from the reflection of every stage of a pipeline
+struct PipelineLayoutSignature
+{
+	//Indexed by set number, each sorted by binding
+	std::vector<std::vector<vk::DescriptorSetLayoutBinding>> sets;
+	std::vector<vk::PushConstantRange> pushConstants;
+
+	bool operator==(const PipelineLayoutSignature& other) const;
+};
+
+struct PipelineLayoutSignatureHash
+{
+	size_t operator()(const PipelineLayoutSignature& signature) const;
+};
+
+PipelineLayoutSignature makeLayoutSignature(const std::vector<ShaderReflection>& stages);
+
+//Pipelines whose shaders declare the same interface share one vk::PipelineLayout,
+//and identical sets share one vk::DescriptorSetLayout, so switching between them
+//never disturbs descriptor sets that are already bound.
+class PipelineLayoutCache
+{
+public:
+	vk::PipelineLayout get(vk::Device device, const PipelineLayoutSignature& signature);
+	//The layout descriptor sets have to be allocated with to be bound to one of the sets of a signature
+	vk::DescriptorSetLayout getSetLayout(vk::Device device, const std::vector<vk::DescriptorSetLayoutBinding>& bindings);
+	void destroy(vk::Device device);
+private:
+
+	struct SetLayoutHash
+	{
+		size_t operator()(const std::vector<vk::DescriptorSetLayoutBinding>& bindings) const;
+	};
+
+	std::unordered_map<std::vector<vk::DescriptorSetLayoutBinding>, vk::DescriptorSetLayout, SetLayoutHash> setLayouts;
+	std::unordered_map<PipelineLayoutSignature, vk::PipelineLayout, PipelineLayoutSignatureHash> layouts;
+};
@@ -0,0 +1,260 @@
+#include "pipeline_library.h"
+
+#include <iostream>
+#include <functional>
+
+#include "device_support.h"
+
+GraphicsPipelineLibrary::~GraphicsPipelineLibrary()
+{
+	//The owner is expected to call destroy() while the device is alive, this only makes sure
+	//the thread never outlives the object
+	if (optimizer.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		optimizer.join();
+	}
+}
+
+std::vector<const char*> GraphicsPipelineLibrary::getDeviceExtensions()
+{
+	return {
+		VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME,
+		VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME
+	};
+}
+
+bool GraphicsPipelineLibrary::isSupported(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion)
+{
+	if (!canQueryDeviceFeatures(physicalDevice, apiVersion) || !checkDeviceExtensionSupport(physicalDevice, getDeviceExtensions()))
+	{
+		return false;
+	}
+
+	auto features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>();
+	return features.get<vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT>().graphicsPipelineLibrary == VK_TRUE;
+}
+
+void GraphicsPipelineLibrary::init(vk::Device device, const RenderTargetLayout& target)
+{
+#ifdef DEBUG_MODE
+	std::cout << "Using graphics pipeline libraries" << std::endl;
+#endif
+	this->device = device;
+	this->target = target;
+	stopping = false;
+	optimizer = std::thread(&GraphicsPipelineLibrary::optimizeLoop, this);
+}
+
+bool GraphicsPipelineLibrary::LibraryKey::operator==(const LibraryKey& other) const
+{
+	return part == other.part && module == other.module && constants == other.constants && layout == other.layout;
+}
+
+size_t GraphicsPipelineLibrary::LibraryKeyHash::operator()(const LibraryKey& key) const
+{
+	size_t seed = static_cast<size_t>(key.part);
+	hashCombine(seed, std::hash<VkShaderModule>()(static_cast<VkShaderModule>(key.module)));
+	hashCombine(seed, key.constants.hash());
+	hashCombine(seed, std::hash<VkPipelineLayout>()(static_cast<VkPipelineLayout>(key.layout)));
+	return seed;
+}
+
+vk::Pipeline GraphicsPipelineLibrary::getLibrary(const LibraryKey& key, const GraphicsPipelineState& state)
+{
+	auto cached = libraries.find(key);
+	if (cached != libraries.end())
+	{
+		return cached->second;
+	}
+
+	vk::GraphicsPipelineLibraryCreateInfoEXT libraryInfo = {};
+	libraryInfo.flags = key.part;
+
+	vk::GraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.pNext = &libraryInfo;
+	//Keep what the optimized link in the background needs
+	pipelineInfo.flags = vk::PipelineCreateFlagBits::eLibraryKHR | vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT;
+	vk::PipelineRenderingCreateInfo rendering;
+
+	switch (key.part)
+	{
+	case vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface:
+		pipelineInfo.pVertexInputState = &state.vertexInputInfo;
+		pipelineInfo.pInputAssemblyState = &state.inputAssemblyInfo;
+		break;
+
+	case vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders:
+		pipelineInfo.stageCount = 1;
+		pipelineInfo.pStages = &state.shaderStages[0];
+		pipelineInfo.pViewportState = &state.viewportState;
+		pipelineInfo.pDynamicState = &state.dynamicState;
+		pipelineInfo.pRasterizationState = &state.rasterizer;
+		pipelineInfo.layout = key.layout;
+		target.fill(pipelineInfo, rendering);
+		break;
+
+	case vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader:
+		pipelineInfo.stageCount = 1;
+		pipelineInfo.pStages = &state.shaderStages[1];
+		pipelineInfo.pMultisampleState = &state.multisampling;
+		pipelineInfo.pDepthStencilState = &state.depthStencil;
+		pipelineInfo.layout = key.layout;
+		target.fill(pipelineInfo, rendering);
+		break;
+
+	case vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface:
+		pipelineInfo.pMultisampleState = &state.multisampling;
+		pipelineInfo.pColorBlendState = &state.colorBlending;
+		target.fill(pipelineInfo, rendering);
+		break;
+	}
+
+#ifdef DEBUG_MODE
+	std::cout << "Create pipeline library: " << vk::to_string(key.part) << std::endl;
+#endif
+
+	vk::Pipeline library = nullptr;
+	try {
+		library = (device.createGraphicsPipeline(nullptr, pipelineInfo)).value;
+		libraries.emplace(key, library);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create pipeline library" << std::endl;
+#endif
+	}
+	return library;
+}
+
+vk::Pipeline GraphicsPipelineLibrary::linkLibraries(const std::vector<vk::Pipeline>& parts, vk::PipelineLayout layout, bool optimize)
+{
+	vk::PipelineLibraryCreateInfoKHR linkInfo = {};
+	linkInfo.libraryCount = static_cast<uint32_t>(parts.size());
+	linkInfo.pLibraries = parts.data();
+
+	vk::GraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.pNext = &linkInfo;
+	pipelineInfo.flags = optimize ? vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT : vk::PipelineCreateFlags();
+	pipelineInfo.layout = layout;
+
+	try {
+		return (device.createGraphicsPipeline(nullptr, pipelineInfo)).value;
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to link pipeline libraries" << std::endl;
+#endif
+		return nullptr;
+	}
+}
+
+vk::Pipeline GraphicsPipelineLibrary::link(const GraphicsPipelineKey& key, const GraphicsPipelineState& state, vk::PipelineLayout layout)
+{
+	vk::ShaderModule vertexModule = state.shaderStages[0].module;
+	vk::ShaderModule fragmentModule = state.shaderStages[1].module;
+
+	std::vector<vk::Pipeline> parts = {
+		//The vertex input interface only depends on what the vertex shader declares
+		getLibrary({ vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface, vertexModule, {}, nullptr }, state),
+		getLibrary({ vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders, vertexModule, key.vertexConstants, layout }, state),
+		getLibrary({ vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader, fragmentModule, key.fragmentConstants, layout }, state),
+		getLibrary({ vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface, nullptr, {}, nullptr }, state)
+	};
+
+	for (vk::Pipeline part : parts)
+	{
+		if (!part)
+		{
+			return nullptr;
+		}
+	}
+
+#ifdef DEBUG_MODE
+	std::cout << "Fast link Graphics Pipeline" << std::endl;
+#endif
+	vk::Pipeline pipeline = linkLibraries(parts, layout, false);
+
+	if (pipeline)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requests.push_back({ key, parts, layout });
+		}
+		wake.notify_one();
+	}
+	return pipeline;
+}
+
+void GraphicsPipelineLibrary::optimizeLoop()
+{
+	while (true)
+	{
+		OptimizeRequest request;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !requests.empty(); });
+			if (stopping)
+			{
+				return;
+			}
+			request = std::move(requests.front());
+			requests.pop_front();
+		}
+
+		vk::Pipeline pipeline = linkLibraries(request.libraries, request.layout, true);
+
+		if (pipeline)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			optimized.emplace_back(std::move(request.key), pipeline);
+		}
+	}
+}
+
+std::vector<std::pair<GraphicsPipelineKey, vk::Pipeline>> GraphicsPipelineLibrary::takeOptimized()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<std::pair<GraphicsPipelineKey, vk::Pipeline>> result;
+	result.swap(optimized);
+	return result;
+}
+
+void GraphicsPipelineLibrary::destroy()
+{
+	if (!device)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		requests.clear();
+	}
+	wake.notify_all();
+	if (optimizer.joinable())
+	{
+		optimizer.join();
+	}
+
+	for (auto& unclaimed : optimized)
+	{
+		device.destroyPipeline(unclaimed.second);
+	}
+	optimized.clear();
+
+	for (auto& cached : libraries)
+	{
+		device.destroyPipeline(cached.second);
+	}
+	libraries.clear();
+
+	device = nullptr;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+#include "pipeline.h"
+
+//VK_EXT_graphics_pipeline_library path. The vertex input, pre-rasterization, fragment shader
+//and fragment output parts of a pipeline are compiled once as libraries and shared, so a new
+//combination only costs a fast link. A link time optimized pipeline is built on a background
+//thread and replaces the fast linked one once it's ready.
+class GraphicsPipelineLibrary
+{
+public:
+	~GraphicsPipelineLibrary();
+
+	//apiVersion is the version the instance was created with, the path needs Vulkan 1.1
+	static bool isSupported(const vk::PhysicalDevice& physicalDevice, uint32_t apiVersion);
+	static std::vector<const char*> getDeviceExtensions();
+
+	//Every pipeline linked from the libraries is compatible with target
+	void init(vk::Device device, const RenderTargetLayout& target);
+	bool isEnabled() const { return static_cast<bool>(device); }
+
+	vk::Pipeline link(const GraphicsPipelineKey& key, const GraphicsPipelineState& state, vk::PipelineLayout layout);
+
+	//Optimized pipelines the background thread finished since the last call
+	std::vector<std::pair<GraphicsPipelineKey, vk::Pipeline>> takeOptimized();
+
+	//Stops the background thread and destroys the libraries and any unclaimed optimized pipelines
+	void destroy();
+private:
+	struct LibraryKey
+	{
+		vk::GraphicsPipelineLibraryFlagBitsEXT part;
+		vk::ShaderModule module;
+		SpecializationConstants constants;
+		vk::PipelineLayout layout;
+
+		bool operator==(const LibraryKey& other) const;
+	};
+
+	struct LibraryKeyHash
+	{
+		size_t operator()(const LibraryKey& key) const;
+	};
+
+	struct OptimizeRequest
+	{
+		GraphicsPipelineKey key;
+		std::vector<vk::Pipeline> libraries;
+		vk::PipelineLayout layout;
+	};
+
+	vk::Pipeline getLibrary(const LibraryKey& key, const GraphicsPipelineState& state);
+	vk::Pipeline linkLibraries(const std::vector<vk::Pipeline>& libraries, vk::PipelineLayout layout, bool optimize);
+	void optimizeLoop();
+
+	vk::Device device{ nullptr };
+	RenderTargetLayout target;
+	std::unordered_map<LibraryKey, vk::Pipeline, LibraryKeyHash> libraries;
+
+	std::thread optimizer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<OptimizeRequest> requests;
+	std::vector<std::pair<GraphicsPipelineKey, vk::Pipeline>> optimized;
+	bool stopping{ false };
+};
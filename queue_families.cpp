@@ -0,0 +1,117 @@
+#include "queue_families.h"
+
+#include <algorithm>
+#include <iostream>
+
+std::vector<uint32_t> QueueFamilies::getUniqueFamilies() const
+{
+	std::vector<uint32_t> families;
+	if (!isComplete())
+	{
+		return families;
+	}
+	for (uint32_t family : { graphicsFamily.value(), presentFamily.value(), computeFamily, transferFamily })
+	{
+		if (std::find(families.begin(), families.end(), family) == families.end())
+		{
+			families.push_back(family);
+		}
+	}
+	return families;
+}
+
+static bool canPresent(const vk::PhysicalDevice& device, uint32_t family, const std::vector<vk::SurfaceKHR>& surfaces)
+{
+	for (vk::SurfaceKHR surface : surfaces)
+	{
+		if (!device.getSurfaceSupportKHR(family, surface))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+QueueFamilies findQueueFamilies(const vk::PhysicalDevice& device, const std::vector<vk::SurfaceKHR>& surfaces)
+{
+	QueueFamilies families;
+	families.properties = device.getQueueFamilyProperties();
+	const std::vector<vk::QueueFamilyProperties>& properties = families.properties;
+
+#ifdef DEBUG_MODE
+	std::cout << "There are " << properties.size() << " queue families available on the system.\n";
+#endif
+
+	std::vector<bool> presents(properties.size());
+	for (uint32_t i = 0; i < properties.size(); ++i)
+	{
+		presents[i] = canPresent(device, i, surfaces);
+#ifdef DEBUG_MODE
+		std::cout << "Queue Family " << i << ": " << vk::to_string(properties[i].queueFlags) << ", " << properties[i].queueCount
+			<< " queues" << (presents[i] ? ", can present" : "") << '\n';
+#endif
+	}
+
+	//A graphics family that can also present saves the swapchain images from being shared between families
+	for (uint32_t i = 0; i < properties.size(); ++i)
+	{
+		if (properties[i].queueFlags & vk::QueueFlagBits::eGraphics)
+		{
+			if (!families.graphicsFamily || (presents[i] && !presents[families.graphicsFamily.value()]))
+			{
+				families.graphicsFamily = i;
+			}
+		}
+	}
+	if (!families.graphicsFamily)
+	{
+		return families;
+	}
+
+	if (presents[families.graphicsFamily.value()])
+	{
+		families.presentFamily = families.graphicsFamily;
+	}
+	else
+	{
+		for (uint32_t i = 0; i < properties.size() && !families.presentFamily; ++i)
+		{
+			if (presents[i])
+			{
+				families.presentFamily = i;
+			}
+		}
+	}
+
+	families.computeFamily = families.graphicsFamily.value();
+	for (uint32_t i = 0; i < properties.size(); ++i)
+	{
+		vk::QueueFlags flags = properties[i].queueFlags;
+		if ((flags & vk::QueueFlagBits::eCompute) && !(flags & vk::QueueFlagBits::eGraphics))
+		{
+			families.computeFamily = i;
+			break;
+		}
+	}
+
+	//Graphics and compute queues can always transfer too
+	families.transferFamily = families.computeFamily;
+	for (uint32_t i = 0; i < properties.size(); ++i)
+	{
+		vk::QueueFlags flags = properties[i].queueFlags;
+		if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+		{
+			families.transferFamily = i;
+			break;
+		}
+	}
+
+#ifdef DEBUG_MODE
+	if (families.isComplete())
+	{
+		std::cout << "Queue families: graphics " << families.graphicsFamily.value() << ", present " << families.presentFamily.value()
+			<< ", compute " << families.computeFamily << ", transfer " << families.transferFamily << '\n';
+	}
+#endif
+	return families;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <optional>
+#include <vector>
+#include <cstdint>
+
+//The queue families the application uses, worked out once per device. Graphics and present are
+//required. Compute and transfer get families of their own when the device has them, so that work
+//can overlap the graphics queue; otherwise they fall back to the graphics family.
+struct QueueFamilies
+{
+	std::optional<uint32_t> graphicsFamily;
+	//Can present to every surface, the graphics family when it can
+	std::optional<uint32_t> presentFamily;
+	//Compute without graphics, or the graphics family
+	uint32_t computeFamily{ 0 };
+	//Transfer without graphics or compute, or the compute family
+	uint32_t transferFamily{ 0 };
+	std::vector<vk::QueueFamilyProperties> properties;
+
+	bool isComplete() const { return graphicsFamily.has_value() && presentFamily.has_value(); }
+	bool hasAsyncCompute() const { return isComplete() && computeFamily != graphicsFamily.value(); }
+	bool hasDedicatedTransfer() const { return isComplete() && transferFamily != computeFamily && transferFamily != graphicsFamily.value(); }
+	//Every family in use once, a queue is created in each
+	std::vector<uint32_t> getUniqueFamilies() const;
+};
+
+//surfaces are the ones the present family has to support, all of them
+QueueFamilies findQueueFamilies(const vk::PhysicalDevice& device, const std::vector<vk::SurfaceKHR>& surfaces);
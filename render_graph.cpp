@@ -0,0 +1,549 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+bool RenderGraphImageDesc::operator==(const RenderGraphImageDesc& other) const
+{
+	return extent == other.extent && format == other.format && usage == other.usage && aspect == other.aspect;
+}
+
+RenderGraph::ImageState RenderGraph::getState(RenderGraphAccess access)
+{
+	switch (access)
+	{
+	case RenderGraphAccess::ColorAttachment:
+		return { vk::ImageLayout::eColorAttachmentOptimal, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+			vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite };
+	case RenderGraphAccess::DepthAttachment:
+		return { vk::ImageLayout::eDepthStencilAttachmentOptimal,
+			vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+			vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite };
+	case RenderGraphAccess::SampledFragment:
+		return { vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead };
+	case RenderGraphAccess::SampledCompute:
+		return { vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead };
+	case RenderGraphAccess::StorageCompute:
+		return { vk::ImageLayout::eGeneral, vk::PipelineStageFlagBits::eComputeShader,
+			vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite };
+	case RenderGraphAccess::TransferSrc:
+		return { vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead };
+	case RenderGraphAccess::TransferDst:
+		return { vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite };
+	case RenderGraphAccess::Present:
+		//Bottom of pipe as a source covers every stage, so it chains with the acquire semaphore's wait
+		return { vk::ImageLayout::ePresentSrcKHR, vk::PipelineStageFlagBits::eBottomOfPipe, vk::AccessFlags() };
+	case RenderGraphAccess::None:
+	default:
+		return { vk::ImageLayout::eUndefined, vk::PipelineStageFlags(), vk::AccessFlags() };
+	}
+}
+
+bool RenderGraph::isWrite(RenderGraphAccess access)
+{
+	return access == RenderGraphAccess::ColorAttachment || access == RenderGraphAccess::DepthAttachment ||
+		access == RenderGraphAccess::StorageCompute || access == RenderGraphAccess::TransferDst;
+}
+
+void RenderGraph::PassBuilder::read(Resource image, RenderGraphAccess access)
+{
+	graph.passes[pass].accesses.push_back({ image, access, false, false, RenderGraphAccess::None });
+}
+
+void RenderGraph::PassBuilder::write(Resource image, RenderGraphAccess access, bool discard)
+{
+	graph.passes[pass].accesses.push_back({ image, access, true, discard, RenderGraphAccess::None });
+}
+
+void RenderGraph::PassBuilder::renderPassAttachment(Resource image, RenderGraphAccess finalAccess)
+{
+	graph.passes[pass].accesses.push_back({ image, finalAccess, true, true, finalAccess });
+}
+
+void RenderGraph::PassBuilder::sideEffects()
+{
+	graph.passes[pass].sideEffects = true;
+}
+
+RenderGraph::~RenderGraph()
+{
+	destroy();
+}
+
+void RenderGraph::init(const vk::PhysicalDevice& physicalDevice, vk::Device device)
+{
+	this->physicalDevice = physicalDevice;
+	this->device = device;
+}
+
+void RenderGraph::destroy()
+{
+	if (!device)
+	{
+		return;
+	}
+	releaseTransients();
+	images.clear();
+	passes.clear();
+	device = nullptr;
+}
+
+void RenderGraph::reset()
+{
+	images.clear();
+	passes.clear();
+	culledPasses = 0;
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, vk::Image image, vk::ImageView view,
+	vk::ImageAspectFlags aspect, RenderGraphAccess initialAccess, RenderGraphAccess finalAccess)
+{
+	GraphImage imported;
+	imported.name = name;
+	imported.image = image;
+	imported.view = view;
+	imported.aspect = aspect;
+	imported.initialAccess = initialAccess;
+	imported.finalAccess = finalAccess;
+	images.push_back(imported);
+	return static_cast<Resource>(images.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::createImage(const std::string& name, const RenderGraphImageDesc& desc)
+{
+	GraphImage transient;
+	transient.name = name;
+	transient.aspect = desc.aspect;
+	transient.transient = true;
+	transient.desc = desc;
+	images.push_back(transient);
+	return static_cast<Resource>(images.size() - 1);
+}
+
+void RenderGraph::addPass(const std::string& name, uint32_t batch, const Setup& setup, const Execute& execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.batch = batch;
+	pass.execute = execute;
+	passes.push_back(std::move(pass));
+
+	PassBuilder builder(*this, static_cast<uint32_t>(passes.size() - 1));
+	setup(builder);
+}
+
+void RenderGraph::cullPasses()
+{
+	//Walk back from the passes whose results leave the graph. A pass is needed when a later needed pass
+	//reads what it writes, unless a pass in between overwrote all of it first.
+	std::vector<bool> needed(images.size(), false);
+	culledPasses = 0;
+	for (size_t i = passes.size(); i-- > 0;)
+	{
+		Pass& pass = passes[i];
+		bool keep = pass.sideEffects;
+		for (const ImageAccess& access : pass.accesses)
+		{
+			if (access.write && (!images[access.image].transient || needed[access.image]))
+			{
+				keep = true;
+			}
+		}
+
+		pass.culled = !keep;
+		if (pass.culled)
+		{
+			++culledPasses;
+			continue;
+		}
+		for (const ImageAccess& access : pass.accesses)
+		{
+			if (access.write && access.discard)
+			{
+				needed[access.image] = false;
+			}
+		}
+		for (const ImageAccess& access : pass.accesses)
+		{
+			if (!access.write || !access.discard)
+			{
+				needed[access.image] = true;
+			}
+		}
+	}
+}
+
+bool RenderGraph::compile()
+{
+	cullPasses();
+
+	//Lifetimes of the transients over the passes that are left
+	for (uint32_t i = 0; i < passes.size(); ++i)
+	{
+		if (passes[i].culled)
+		{
+			continue;
+		}
+		for (const ImageAccess& access : passes[i].accesses)
+		{
+			GraphImage& image = images[access.image];
+			image.firstPass = std::min(image.firstPass, i);
+			image.lastPass = std::max(image.lastPass, i);
+		}
+	}
+	if (!allocateTransients())
+	{
+		return false;
+	}
+
+	//How every transient is left at the end of the frame, the next user of its memory has to wait for that:
+	//its last write and every read after it. The first access of a transient always replaces its state,
+	//so a first run gives these whatever the transients start from. Aliased images never live at the same
+	//time, so those earlier in the frame are finished before it starts, and the previous frame ran the same
+	//passes on this memory (or it was just allocated).
+	std::vector<ImageState> states;
+	std::vector<bool> lastWasWrite;
+	std::vector<uint32_t> lastPass;
+	initStates(states, lastWasWrite);
+	buildBarriers(states, lastWasWrite, lastPass);
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		const GraphImage& image = images[i];
+		if (image.transient && image.allocation != UINT32_MAX)
+		{
+			allocations[image.allocation].lastStages = states[i].stages;
+			allocations[image.allocation].lastAccess = lastWasWrite[i] ? states[i].access : vk::AccessFlags();
+		}
+	}
+	initStates(states, lastWasWrite);
+	buildBarriers(states, lastWasWrite, lastPass);
+
+	//Hand imported images over the way their next user expects them, after the last pass that used them
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		const GraphImage& image = images[i];
+		if (image.transient || lastPass[i] == UINT32_MAX || image.finalAccess == RenderGraphAccess::None)
+		{
+			continue;
+		}
+
+		const ImageState& current = states[i];
+		ImageState target = getState(image.finalAccess);
+		if (current.layout == target.layout && !lastWasWrite[i])
+		{
+			continue;
+		}
+
+		Pass& pass = passes[lastPass[i]];
+		pass.after.push_back(vk::ImageMemoryBarrier(lastWasWrite[i] ? current.access : vk::AccessFlags(), target.access,
+			current.layout, target.layout, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image.image,
+			vk::ImageSubresourceRange(image.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, 1)));
+		pass.afterSrc |= current.stages;
+		pass.afterDst |= target.stages;
+	}
+	return true;
+}
+
+void RenderGraph::initStates(std::vector<ImageState>& states, std::vector<bool>& lastWasWrite) const
+{
+	//A transient starts out waiting for every use of the memory it shares, its old contents are never kept
+	states.assign(images.size(), ImageState());
+	lastWasWrite.assign(images.size(), false);
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		const GraphImage& image = images[i];
+		states[i] = getState(image.initialAccess);
+		lastWasWrite[i] = isWrite(image.initialAccess);
+		if (!image.transient || image.allocation == UINT32_MAX)
+		{
+			continue;
+		}
+
+		const Allocation& own = allocations[image.allocation];
+		for (const Allocation& other : allocations)
+		{
+			bool overlaps = other.offset < own.offset + own.requirements.size && own.offset < other.offset + other.requirements.size;
+			if (overlaps)
+			{
+				states[i].stages |= other.lastStages;
+				states[i].access |= other.lastAccess;
+			}
+		}
+		lastWasWrite[i] = true;
+	}
+}
+
+void RenderGraph::buildBarriers(std::vector<ImageState>& states, std::vector<bool>& lastWasWrite, std::vector<uint32_t>& lastPass)
+{
+	//The stages of states include every read since the last write, a write has to wait for all of them.
+	//Only a write leaves something that has to be made available to the next access.
+	lastPass.assign(images.size(), UINT32_MAX);
+	for (uint32_t i = 0; i < passes.size(); ++i)
+	{
+		Pass& pass = passes[i];
+		pass.before.clear();
+		pass.after.clear();
+		pass.beforeSrc = pass.beforeDst = pass.afterSrc = pass.afterDst = vk::PipelineStageFlags();
+		if (pass.culled)
+		{
+			continue;
+		}
+
+		for (const ImageAccess& access : pass.accesses)
+		{
+			const GraphImage& image = images[access.image];
+			ImageState& current = states[access.image];
+			lastPass[access.image] = i;
+
+			//The render pass makes its own transitions, and its external dependency makes the writes
+			//visible to the access it leaves the attachment as
+			if (access.renderPassFinal != RenderGraphAccess::None)
+			{
+				current = getState(access.renderPassFinal);
+				lastWasWrite[access.image] = false;
+				continue;
+			}
+
+			ImageState target = getState(access.access);
+			bool hazard = lastWasWrite[access.image] || access.write;
+			if (current.layout == target.layout && !hazard)
+			{
+				//Reads after reads need no barrier, but the next write waits for every one of them
+				current.stages |= target.stages;
+				continue;
+			}
+
+			vk::ImageMemoryBarrier barrier(lastWasWrite[access.image] ? current.access : vk::AccessFlags(), target.access,
+				access.discard ? vk::ImageLayout::eUndefined : current.layout, target.layout,
+				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image.image,
+				vk::ImageSubresourceRange(image.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, 1));
+			pass.before.push_back(barrier);
+			pass.beforeSrc |= current.stages;
+			pass.beforeDst |= target.stages;
+
+			current = target;
+			lastWasWrite[access.image] = access.write;
+		}
+	}
+}
+
+void RenderGraph::execute(vk::CommandBuffer commandBuffer, uint32_t batch)
+{
+	for (const Pass& pass : passes)
+	{
+		if (pass.culled || pass.batch != batch)
+		{
+			continue;
+		}
+		recordBarriers(commandBuffer, pass.before, pass.beforeSrc, pass.beforeDst);
+		pass.execute(commandBuffer);
+		recordBarriers(commandBuffer, pass.after, pass.afterSrc, pass.afterDst);
+	}
+}
+
+void RenderGraph::recordBarriers(vk::CommandBuffer commandBuffer, const std::vector<vk::ImageMemoryBarrier>& barriers,
+	vk::PipelineStageFlags src, vk::PipelineStageFlags dst) const
+{
+	if (barriers.empty())
+	{
+		return;
+	}
+	//Nothing to wait for is expressed as the top of the pipe
+	if (!src)
+	{
+		src = vk::PipelineStageFlagBits::eTopOfPipe;
+	}
+	if (!dst)
+	{
+		dst = vk::PipelineStageFlagBits::eBottomOfPipe;
+	}
+	commandBuffer.pipelineBarrier(src, dst, vk::DependencyFlags(), nullptr, nullptr, barriers);
+}
+
+bool RenderGraph::allocateTransients()
+{
+	//Transients in the order they were created, with the lifetimes they have this frame
+	std::vector<GraphImage*> used;
+	for (GraphImage& image : images)
+	{
+		if (image.transient && image.firstPass != UINT32_MAX)
+		{
+			used.push_back(&image);
+		}
+	}
+
+	bool same = used.size() == allocations.size();
+	for (size_t i = 0; same && i < used.size(); ++i)
+	{
+		const Allocation& allocation = allocations[i];
+		same = allocation.name == used[i]->name && allocation.desc == used[i]->desc &&
+			allocation.firstPass == used[i]->firstPass && allocation.lastPass == used[i]->lastPass;
+	}
+	if (!same)
+	{
+		//Frames in flight may still use the old images, this only happens when the frame's structure changes
+		if (!allocations.empty())
+		{
+			device.waitIdle();
+		}
+		releaseTransients();
+		++transientVersion;
+
+		uint32_t memoryTypeBits = ~0u;
+		for (GraphImage* image : used)
+		{
+			Allocation allocation;
+			allocation.name = image->name;
+			allocation.desc = image->desc;
+			allocation.firstPass = image->firstPass;
+			allocation.lastPass = image->lastPass;
+
+			vk::ImageCreateInfo imageInfo = {};
+			imageInfo.imageType = vk::ImageType::e2D;
+			imageInfo.format = image->desc.format;
+			imageInfo.extent = vk::Extent3D(image->desc.extent.width, image->desc.extent.height, 1);
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = vk::SampleCountFlagBits::e1;
+			imageInfo.tiling = vk::ImageTiling::eOptimal;
+			imageInfo.usage = image->desc.usage;
+			imageInfo.sharingMode = vk::SharingMode::eExclusive;
+			imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+			try
+			{
+				allocation.image = device.createImage(imageInfo);
+			}
+			catch (vk::SystemError err)
+			{
+#ifdef DEBUG_MODE
+				std::cout << "Failed to create transient image " << image->name << std::endl;
+#endif
+				releaseTransients();
+				return false;
+			}
+			allocation.requirements = device.getImageMemoryRequirements(allocation.image);
+			memoryTypeBits &= allocation.requirements.memoryTypeBits;
+			allocations.push_back(allocation);
+		}
+
+		//Biggest first, each at the lowest offset where it doesn't overlap the memory of an image that
+		//is alive at the same time. Images that never live together end up on top of each other.
+		std::vector<size_t> order(allocations.size());
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+			return allocations[a].requirements.size > allocations[b].requirements.size;
+		});
+
+		std::vector<size_t> placed;
+		transientMemorySize = 0;
+		unaliasedMemorySize = 0;
+		for (size_t index : order)
+		{
+			Allocation& allocation = allocations[index];
+			vk::DeviceSize alignment = allocation.requirements.alignment;
+			vk::DeviceSize size = allocation.requirements.size;
+
+			std::vector<vk::DeviceSize> candidates = { 0 };
+			for (size_t other : placed)
+			{
+				candidates.push_back(allocations[other].offset + allocations[other].requirements.size);
+			}
+			std::sort(candidates.begin(), candidates.end());
+
+			for (vk::DeviceSize candidate : candidates)
+			{
+				vk::DeviceSize offset = (candidate + alignment - 1) / alignment * alignment;
+				bool fits = true;
+				for (size_t other : placed)
+				{
+					const Allocation& placedAllocation = allocations[other];
+					bool livesTogether = placedAllocation.firstPass <= allocation.lastPass && allocation.firstPass <= placedAllocation.lastPass;
+					bool overlaps = placedAllocation.offset < offset + size && offset < placedAllocation.offset + placedAllocation.requirements.size;
+					if (livesTogether && overlaps)
+					{
+						fits = false;
+						break;
+					}
+				}
+				if (fits)
+				{
+					allocation.offset = offset;
+					break;
+				}
+			}
+			placed.push_back(index);
+			transientMemorySize = std::max(transientMemorySize, allocation.offset + size);
+			unaliasedMemorySize += size;
+		}
+
+		if (!allocations.empty())
+		{
+			vk::MemoryAllocateInfo allocInfo = {};
+			allocInfo.allocationSize = transientMemorySize;
+			allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			if (allocInfo.memoryTypeIndex == UINT32_MAX)
+			{
+#ifdef DEBUG_MODE
+				std::cout << "No memory type every transient image can share!" << std::endl;
+#endif
+				releaseTransients();
+				return false;
+			}
+
+			try
+			{
+				transientMemory = device.allocateMemory(allocInfo);
+				for (size_t i = 0; i < allocations.size(); ++i)
+				{
+					Allocation& allocation = allocations[i];
+					device.bindImageMemory(allocation.image, transientMemory, allocation.offset);
+
+					vk::ImageViewCreateInfo viewInfo = {};
+					viewInfo.image = allocation.image;
+					viewInfo.viewType = vk::ImageViewType::e2D;
+					viewInfo.format = allocation.desc.format;
+					viewInfo.subresourceRange = vk::ImageSubresourceRange(allocation.desc.aspect, 0, 1, 0, 1);
+					allocation.view = device.createImageView(viewInfo);
+				}
+			}
+			catch (vk::SystemError err)
+			{
+#ifdef DEBUG_MODE
+				std::cout << "Failed to allocate transient images!" << std::endl;
+#endif
+				releaseTransients();
+				return false;
+			}
+		}
+#ifdef DEBUG_MODE
+		std::cout << "Render graph transients: " << allocations.size() << " images in " << transientMemorySize
+			<< " bytes, " << unaliasedMemorySize << " without aliasing" << std::endl;
+#endif
+	}
+
+	for (size_t i = 0; i < used.size(); ++i)
+	{
+		used[i]->allocation = static_cast<uint32_t>(i);
+		used[i]->image = allocations[i].image;
+		used[i]->view = allocations[i].view;
+	}
+	return true;
+}
+
+void RenderGraph::releaseTransients()
+{
+	for (Allocation& allocation : allocations)
+	{
+		device.destroyImageView(allocation.view);
+		device.destroyImage(allocation.image);
+	}
+	allocations.clear();
+	device.freeMemory(transientMemory);
+	transientMemory = nullptr;
+	transientMemorySize = 0;
+	unaliasedMemorySize = 0;
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "gpu_resources.h"
+
+//How a pass uses an image. Each one stands for a layout, the stages that touch the image and their access.
+enum class RenderGraphAccess
+{
+	//Not used yet, contents undefined
+	None,
+	ColorAttachment,
+	DepthAttachment,
+	SampledFragment,
+	SampledCompute,
+	StorageCompute,
+	TransferSrc,
+	TransferDst,
+	Present
+};
+
+//Transient image the graph creates and owns
+struct RenderGraphImageDesc
+{
+	vk::Extent2D extent;
+	vk::Format format{ vk::Format::eUndefined };
+	vk::ImageUsageFlags usage;
+	vk::ImageAspectFlags aspect{ vk::ImageAspectFlagBits::eColor };
+
+	bool operator==(const RenderGraphImageDesc& other) const;
+};
+
+//Describes one frame as passes that declare which images they read and write, and records it.
+//Passes run in the order they were added. compile() drops passes whose results nothing uses,
+//works out every layout transition and dependency between passes and batches them into one
+//barrier per pass, and places transient images whose lifetimes don't overlap in the same memory.
+//The frame is described again every frame, transient images are only remade when they change.
+class RenderGraph
+{
+public:
+	using Resource = uint32_t;
+
+	class PassBuilder
+	{
+	public:
+		void read(Resource image, RenderGraphAccess access);
+		//discard when the pass overwrites all of it (a clear, a full blit), the old contents are dropped
+		void write(Resource image, RenderGraphAccess access, bool discard = false);
+		//For a pass that begins a vk::RenderPass: its attachment descriptions and dependencies make the
+		//transitions of this attachment, and leave it as finalAccess
+		void renderPassAttachment(Resource image, RenderGraphAccess finalAccess);
+		//Kept even when nothing in the graph reads what it writes, for work with results outside of it
+		void sideEffects();
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+		RenderGraph& graph;
+		uint32_t pass;
+	};
+	using Setup = std::function<void(PassBuilder& builder)>;
+	using Execute = std::function<void(vk::CommandBuffer commandBuffer)>;
+
+	~RenderGraph();
+
+	void init(const vk::PhysicalDevice& physicalDevice, vk::Device device);
+	void destroy();
+
+	//Starts the description of a new frame
+	void reset();
+	//An image that lives outside of the graph. initialAccess is how the last user left it,
+	//the graph leaves it as finalAccess after the last pass that uses it.
+	Resource importImage(const std::string& name, vk::Image image, vk::ImageView view, vk::ImageAspectFlags aspect,
+		RenderGraphAccess initialAccess, RenderGraphAccess finalAccess);
+	//Only lives between the first and the last pass that use it, may share memory with other transients
+	Resource createImage(const std::string& name, const RenderGraphImageDesc& desc);
+	//Passes of a batch are recorded together by execute(), batches follow each other in submission order
+	void addPass(const std::string& name, uint32_t batch, const Setup& setup, const Execute& execute);
+
+	//Returns false when the transient images can't be made
+	bool compile();
+	//Records the passes of a batch that survived compile(), with their barriers
+	void execute(vk::CommandBuffer commandBuffer, uint32_t batch);
+
+	//Valid during execute(), transients only have theirs once compiled
+	vk::Image getImage(Resource image) const { return images[image].image; }
+	vk::ImageView getView(Resource image) const { return images[image].view; }
+	//Changes whenever the transients are made again, after the device went idle. Anything made
+	//from their views (a framebuffer) has to be made again as well.
+	uint64_t getTransientVersion() const { return transientVersion; }
+
+	size_t getPassCount() const { return passes.size(); }
+	size_t getCulledPassCount() const { return culledPasses; }
+	//Memory all transients share, against what they would take on their own
+	vk::DeviceSize getTransientMemory() const { return transientMemorySize; }
+	vk::DeviceSize getUnaliasedMemory() const { return unaliasedMemorySize; }
+private:
+	struct ImageState
+	{
+		vk::ImageLayout layout;
+		vk::PipelineStageFlags stages;
+		vk::AccessFlags access;
+	};
+	static ImageState getState(RenderGraphAccess access);
+	static bool isWrite(RenderGraphAccess access);
+
+	struct ImageAccess
+	{
+		Resource image;
+		RenderGraphAccess access;
+		bool write;
+		bool discard;
+		//Left as this by the pass itself (renderPassAttachment), None when the graph transitions it
+		RenderGraphAccess renderPassFinal;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		uint32_t batch;
+		Execute execute;
+		std::vector<ImageAccess> accesses;
+		bool sideEffects{ false };
+		bool culled{ false };
+		//Filled in by compile()
+		std::vector<vk::ImageMemoryBarrier> before;
+		vk::PipelineStageFlags beforeSrc, beforeDst;
+		std::vector<vk::ImageMemoryBarrier> after;
+		vk::PipelineStageFlags afterSrc, afterDst;
+	};
+
+	struct GraphImage
+	{
+		std::string name;
+		vk::Image image{ nullptr };
+		vk::ImageView view{ nullptr };
+		vk::ImageAspectFlags aspect;
+		RenderGraphAccess initialAccess{ RenderGraphAccess::None };
+		RenderGraphAccess finalAccess{ RenderGraphAccess::None };
+		//Transients only
+		bool transient{ false };
+		RenderGraphImageDesc desc;
+		uint32_t firstPass{ UINT32_MAX };
+		uint32_t lastPass{ 0 };
+		//Index into allocations
+		uint32_t allocation{ UINT32_MAX };
+	};
+
+	//A transient image as it was allocated, kept from frame to frame while the transients stay the same
+	struct Allocation
+	{
+		std::string name;
+		RenderGraphImageDesc desc;
+		uint32_t firstPass, lastPass;
+		vk::Image image{ nullptr };
+		vk::ImageView view{ nullptr };
+		vk::MemoryRequirements requirements;
+		vk::DeviceSize offset{ 0 };
+		//Stages of the last write in the frame and every read after it, and the access of that write.
+		//The next user of the memory waits for them.
+		vk::PipelineStageFlags lastStages;
+		vk::AccessFlags lastAccess;
+	};
+
+	void cullPasses();
+	void initStates(std::vector<ImageState>& states, std::vector<bool>& lastWasWrite) const;
+	//Fills in the barriers before every pass, leaves states as the images are after the last pass
+	void buildBarriers(std::vector<ImageState>& states, std::vector<bool>& lastWasWrite, std::vector<uint32_t>& lastPass);
+	bool allocateTransients();
+	void releaseTransients();
+	void recordBarriers(vk::CommandBuffer commandBuffer, const std::vector<vk::ImageMemoryBarrier>& barriers,
+		vk::PipelineStageFlags src, vk::PipelineStageFlags dst) const;
+
+	vk::PhysicalDevice physicalDevice{ nullptr };
+	vk::Device device{ nullptr };
+
+	std::vector<GraphImage> images;
+	std::vector<Pass> passes;
+	size_t culledPasses{ 0 };
+
+	std::vector<Allocation> allocations;
+	vk::DeviceMemory transientMemory{ nullptr };
+	vk::DeviceSize transientMemorySize{ 0 };
+	vk::DeviceSize unaliasedMemorySize{ 0 };
+	uint64_t transientVersion{ 0 };
+};
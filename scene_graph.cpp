@@ -0,0 +1,182 @@
+#include "scene_graph.h"
+
+#include "job_system.h"
+
+#include <algorithm>
+
+//Below this many dirty nodes spreading the work over threads costs more than it saves
+static const size_t ParallelUpdateThreshold = 16384;
+
+uint32_t SceneGraph::addNode(uint32_t parent, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	uint32_t node = static_cast<uint32_t>(nodeToIndex.size());
+
+	uint32_t parentIndex = NoParent;
+	uint32_t index = static_cast<uint32_t>(size());
+	if (parent != NoParent)
+	{
+		//Append as the last child, right behind the parent's current subtree
+		parentIndex = nodeToIndex[parent];
+		index = parentIndex + subtreeSizes[parentIndex];
+
+		for (uint32_t ancestor = parentIndex; ancestor != NoParent; ancestor = parents[ancestor])
+		{
+			subtreeSizes[ancestor]++;
+		}
+	}
+
+	//Everything behind the insertion point moves up by one, appending moves nothing
+	if (index < size())
+	{
+		for (uint32_t& parentOfNode : parents)
+		{
+			if (parentOfNode != NoParent && parentOfNode >= index)
+			{
+				parentOfNode++;
+			}
+		}
+		for (uint32_t& nodeIndex : nodeToIndex)
+		{
+			if (nodeIndex >= index)
+			{
+				nodeIndex++;
+			}
+		}
+	}
+
+	localTransforms.insert(index, position, rotation, scale);
+	parents.insert(parents.begin() + index, parentIndex);
+	subtreeSizes.insert(subtreeSizes.begin() + index, 1);
+	dirty.insert(dirty.begin() + index, 1);
+	worldMatrices.insert(worldMatrices.begin() + index, glm::mat4(1.0f));
+	indexToNode.insert(indexToNode.begin() + index, node);
+	nodeToIndex.push_back(index);
+
+	return node;
+}
+
+void SceneGraph::reserve(size_t count)
+{
+	localTransforms.reserve(count);
+	parents.reserve(count);
+	subtreeSizes.reserve(count);
+	dirty.reserve(count);
+	worldMatrices.reserve(count);
+	nodeToIndex.reserve(count);
+	indexToNode.reserve(count);
+}
+
+void SceneGraph::setPosition(uint32_t node, const glm::vec3& position)
+{
+	uint32_t index = nodeToIndex[node];
+	localTransforms.setPosition(index, position);
+	dirty[index] = 1;
+}
+
+void SceneGraph::setRotation(uint32_t node, const glm::quat& rotation)
+{
+	uint32_t index = nodeToIndex[node];
+	localTransforms.setRotation(index, rotation);
+	dirty[index] = 1;
+}
+
+void SceneGraph::setScale(uint32_t node, const glm::vec3& scale)
+{
+	uint32_t index = nodeToIndex[node];
+	localTransforms.setScale(index, scale);
+	dirty[index] = 1;
+}
+
+glm::vec3 SceneGraph::getPosition(uint32_t node) const
+{
+	return localTransforms.getPosition(nodeToIndex[node]);
+}
+
+const glm::mat4& SceneGraph::getWorldMatrix(uint32_t node) const
+{
+	return worldMatrices[nodeToIndex[node]];
+}
+
+void SceneGraph::clear()
+{
+	localTransforms.clear();
+	parents.clear();
+	subtreeSizes.clear();
+	dirty.clear();
+	worldMatrices.clear();
+	nodeToIndex.clear();
+	indexToNode.clear();
+}
+
+void SceneGraph::updateRange(size_t first, size_t count)
+{
+	//Local matrices for the whole range in one batch, then parents are applied in order.
+	//A parent always comes before its children, so its world matrix is already final.
+	localTransforms.buildModelMatrices(&worldMatrices[first], first, count);
+
+	for (size_t i = first; i < first + count; ++i)
+	{
+		if (parents[i] != NoParent)
+		{
+			worldMatrices[i] = worldMatrices[parents[i]] * worldMatrices[i];
+		}
+		dirty[i] = 0;
+	}
+}
+
+size_t SceneGraph::update(JobSystem* jobs)
+{
+	//Collect the topmost dirty subtrees, nothing inside them needs to be looked at separately
+	std::vector<std::pair<size_t, size_t>> ranges;
+	size_t dirtyNodes = 0;
+	for (size_t i = 0; i < size();)
+	{
+		if (dirty[i])
+		{
+			ranges.emplace_back(i, subtreeSizes[i]);
+			dirtyNodes += subtreeSizes[i];
+			i += subtreeSizes[i];
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	size_t workers = jobs ? jobs->getThreadCount() : 1;
+	if (dirtyNodes < ParallelUpdateThreshold || workers == 1 || ranges.size() == 1)
+	{
+		for (const auto& range : ranges)
+		{
+			updateRange(range.first, range.second);
+		}
+		return dirtyNodes;
+	}
+
+	//The ranges never overlap and only read parents outside of them, which are clean,
+	//so each job can take a share of whole subtrees without synchronization
+	JobCounter counter;
+	size_t share = (dirtyNodes + workers - 1) / workers;
+	size_t begin = 0;
+	while (begin < ranges.size())
+	{
+		size_t end = begin;
+		size_t nodes = 0;
+		while (end < ranges.size() && (nodes < share || end == begin))
+		{
+			nodes += ranges[end].second;
+			++end;
+		}
+
+		jobs->run(counter, [this, &ranges, begin, end]() {
+			for (size_t r = begin; r < end; ++r)
+			{
+				updateRange(ranges[r].first, ranges[r].second);
+			}
+		});
+		begin = end;
+	}
+
+	jobs->wait(counter);
+	return dirtyNodes;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "transform.h"
+
+class JobSystem;
+
+//Parent/child transform hierarchy stored in depth-first order: every node is followed by its
+//whole subtree, so a subtree is the contiguous range [index, index + subtreeSize).
+//Nodes are addressed by stable handles, their storage index changes when nodes are inserted.
+//Changing a local transform only marks the node dirty; update() recomputes world matrices
+//of dirty subtrees and leaves everything else untouched.
+class SceneGraph
+{
+public:
+	static const uint32_t NoParent = UINT32_MAX;
+
+	//A node lands at the end of its parent's subtree. When that is the end of the storage, which is
+	//the case for roots and whenever a hierarchy is built depth-first (a parent before its children,
+	//each child's subtree before the next child), it is appended in O(depth). Anywhere else every
+	//node behind it moves and all storage indices are renumbered, O(size()), so large hierarchies
+	//should be built depth-first.
+	uint32_t addNode(uint32_t parent, const glm::vec3& position,
+		const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+		const glm::vec3& scale = glm::vec3(1.0f));
+	//Room for count nodes in total, before a large build
+	void reserve(size_t count);
+
+	void setPosition(uint32_t node, const glm::vec3& position);
+	void setRotation(uint32_t node, const glm::quat& rotation);
+	void setScale(uint32_t node, const glm::vec3& scale);
+
+	glm::vec3 getPosition(uint32_t node) const;
+	const glm::mat4& getWorldMatrix(uint32_t node) const;
+
+	//Recomputes the world matrices of every dirty subtree, independent subtrees as parallel jobs
+	//when a job system is given. Returns the number of nodes that were recomputed.
+	size_t update(JobSystem* jobs = nullptr);
+
+	size_t size() const { return parents.size(); }
+	void clear();
+
+	//Depth-first ordered world matrices, valid after update()
+	const std::vector<glm::mat4>& getWorldMatrices() const { return worldMatrices; }
+	//Handle of the node stored at a depth-first index
+	uint32_t getNode(size_t index) const { return indexToNode[index]; }
+private:
+	void updateRange(size_t first, size_t count);
+
+	TransformStore localTransforms;
+	//Storage index of the parent, NoParent for roots
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> subtreeSizes;
+	std::vector<uint8_t> dirty;
+	std::vector<glm::mat4> worldMatrices;
+
+	std::vector<uint32_t> nodeToIndex;
+	std::vector<uint32_t> indexToNode;
+};
@@ -0,0 +1,46 @@
+#include "scene_snapshot.h"
+
+#include <thread>
+
+//The writer stores latest and then loads reading, the reader stores reading and then loads latest.
+//Both are sequentially consistent, so at least one of them sees the other's store: either the writer
+//waits for the reader, or the reader notices the new snapshot and retries with it.
+
+SceneSnapshot& SceneSnapshotBuffer::beginWrite()
+{
+	int published = latest.load();
+	writing = published < 0 ? 0 : 1 - published;
+	while (reading.load() == writing)
+	{
+		std::this_thread::yield();
+	}
+	return buffers[writing];
+}
+
+void SceneSnapshotBuffer::publish()
+{
+	buffers[writing].sequence = ++sequence;
+	latest.store(writing);
+}
+
+const SceneSnapshot* SceneSnapshotBuffer::acquire()
+{
+	for (;;)
+	{
+		int published = latest.load();
+		if (published < 0)
+		{
+			return nullptr;
+		}
+		reading.store(published);
+		if (latest.load() == published)
+		{
+			return &buffers[published];
+		}
+	}
+}
+
+void SceneSnapshotBuffer::release()
+{
+	reading.store(-1);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "latency.h"
+
+//Everything the render thread needs from one simulation step
+struct SceneSnapshot
+{
+	//Depth-first world matrices of every scene node
+	std::vector<glm::mat4> worldMatrices;
+	glm::mat4 viewProjection{ 1.0f };
+	//Increases whenever a transform changed, so a reader that skipped snapshots still notices movement
+	uint64_t transformVersion{ 0 };
+	//When the step sampled input, and the oldest input no frame has claimed yet
+	FrameLatency latency;
+	//Set by publish(), increases with every snapshot
+	uint64_t sequence{ 0 };
+};
+
+//Two snapshots, one published and one being written. The writer (the window thread) fills the
+//unpublished one and swaps them; the reader (the render thread) copies out the latest published
+//one. The reader never waits, the writer only waits if the reader is still copying the buffer
+//it wants to reuse.
+class SceneSnapshotBuffer
+{
+public:
+	//Writer only, the buffer to fill for the next snapshot. It still holds the contents of the one before the latest.
+	SceneSnapshot& beginWrite();
+	//Writer only, makes the buffer from beginWrite() the latest snapshot
+	void publish();
+
+	//Reader only, the latest snapshot or nullptr before the first one. Keep it until release().
+	const SceneSnapshot* acquire();
+	void release();
+private:
+	SceneSnapshot buffers[2];
+	//Index of the latest published buffer, -1 before the first
+	std::atomic<int> latest{ -1 };
+	//Index of the buffer the reader holds, -1 for none
+	std::atomic<int> reading{ -1 };
+	int writing{ 0 };
+	uint64_t sequence{ 0 };
+};
@@ -0,0 +1,627 @@
+#include "shader.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+std::string getExecutablePath() {
+	char path[MAX_PATH];
+	GetModuleFileNameA(NULL, path, MAX_PATH);
+	return std::string(path);
+}
+#elif defined(__linux__)
+#include <unistd.h>
+#include <limits.h>
+std::string getExecutablePath() {
+	char path[PATH_MAX];
+	ssize_t count = readlink("/proc/self/exe", path, PATH_MAX);
+	return std::string(path, (count > 0) ? count : 0);
+}
+#elif defined(__APPLE__)
+#include <mach-o/dyld.h>
+std::string getExecutablePath() {
+	char path[PATH_MAX];
+	uint32_t size = sizeof(path);
+	if (_NSGetExecutablePath(path, &size) == 0) {
+		return std::string(path);
+	}
+	return "";
+}
+#endif
+
+#if EMBED_SHADERS
+extern const EmbeddedShader embeddedShaders[];
+extern const size_t embeddedShaderCount;
+#endif
+
+static std::filesystem::path getExecutableDir() {
+	return std::filesystem::path(getExecutablePath()).parent_path();
+}
+
+//Reads straight into uint32_t storage so the words are correctly aligned for vkCreateShaderModule
+static std::vector<uint32_t> readFile(const std::filesystem::path& filepath)
+{
+	std::ifstream file(filepath, std::ios::ate | std::ios::binary);
+
+	if (!file.is_open())
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to load \"" << filepath.string() << "\"" << std::endl;
+#endif
+		return {};
+	}
+
+	size_t filesize{ static_cast<size_t>(file.tellg()) };
+
+	std::vector<uint32_t> buffer((filesize + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(buffer.data()), filesize);
+
+	file.close();
+	return buffer;
+}
+
+SpirvCode loadSpirv(const std::string& filename)
+{
+	SpirvCode result;
+
+	if (const char* overrideDir = std::getenv("VULKAN_SHADER_DIR"))
+	{
+		std::filesystem::path path = std::filesystem::path(overrideDir) / std::filesystem::path(filename).filename();
+		if (std::filesystem::exists(path))
+		{
+#ifdef DEBUG_MODE
+			std::cout << "Loading shader override \"" << path.string() << "\"" << std::endl;
+#endif
+			result.storage = readFile(path);
+			return result;
+		}
+	}
+
+#if EMBED_SHADERS
+	for (size_t i = 0; i < embeddedShaderCount; ++i)
+	{
+		if (filename == embeddedShaders[i].name)
+		{
+			result.code = embeddedShaders[i].code;
+			result.wordCount = embeddedShaders[i].wordCount;
+			return result;
+		}
+	}
+#endif
+
+	result.storage = readFile(getExecutableDir() / filename);
+	return result;
+}
+
+namespace
+{
+	//The subset of the SPIR-V specification needed to reflect a pipeline layout
+	namespace spv
+	{
+		const uint32_t MagicNumber = 0x07230203;
+
+		enum Op : uint32_t
+		{
+			OpEntryPoint = 15,
+			OpTypeBool = 20,
+			OpTypeInt = 21,
+			OpTypeFloat = 22,
+			OpTypeVector = 23,
+			OpTypeMatrix = 24,
+			OpTypeImage = 25,
+			OpTypeSampler = 26,
+			OpTypeSampledImage = 27,
+			OpTypeArray = 28,
+			OpTypeRuntimeArray = 29,
+			OpTypeStruct = 30,
+			OpTypePointer = 32,
+			OpConstant = 43,
+			OpVariable = 59,
+			OpDecorate = 71,
+			OpMemberDecorate = 72,
+			OpTypeAccelerationStructureKHR = 5341,
+		};
+
+		enum Decoration : uint32_t
+		{
+			DecorationBlock = 2,
+			DecorationBufferBlock = 3,
+			DecorationArrayStride = 6,
+			DecorationMatrixStride = 7,
+			DecorationBuiltIn = 11,
+			DecorationLocation = 30,
+			DecorationBinding = 33,
+			DecorationDescriptorSet = 34,
+			DecorationOffset = 35,
+		};
+
+		enum StorageClass : uint32_t
+		{
+			StorageClassUniformConstant = 0,
+			StorageClassInput = 1,
+			StorageClassUniform = 2,
+			StorageClassPushConstant = 9,
+			StorageClassStorageBuffer = 12,
+		};
+
+		const uint32_t DimBuffer = 5;
+		const uint32_t DimSubpassData = 6;
+	}
+
+	struct SpirvId
+	{
+		uint32_t opcode{ 0 };
+		//Operands of the instruction that declared this id, without the result id itself
+		std::vector<uint32_t> operands;
+
+		std::vector<uint32_t> memberOffsets;
+		std::vector<uint32_t> memberMatrixStrides;
+		bool block{ false };
+		bool bufferBlock{ false };
+		bool builtIn{ false };
+		uint32_t arrayStride{ 0 };
+		uint32_t location{ UINT32_MAX };
+		uint32_t binding{ UINT32_MAX };
+		uint32_t set{ UINT32_MAX };
+		uint32_t constant{ 0 };
+	};
+
+	class SpirvModule
+	{
+	public:
+		std::vector<SpirvId> ids;
+		uint32_t executionModel{ 0 };
+
+		bool parse(const uint32_t* code, size_t wordCount)
+		{
+			if (wordCount < 5 || code[0] != spv::MagicNumber)
+			{
+				return false;
+			}
+
+			ids.resize(code[3]);
+
+			size_t offset = 5;
+			while (offset < wordCount)
+			{
+				uint32_t opcode = code[offset] & 0xFFFF;
+				uint32_t length = code[offset] >> 16;
+				if (length == 0 || offset + length > wordCount)
+				{
+					return false;
+				}
+				parseInstruction(opcode, code + offset + 1, length - 1);
+				offset += length;
+			}
+			return true;
+		}
+
+		//Size in bytes of a type as laid out in a push constant or buffer block
+		uint32_t typeSize(uint32_t typeId, uint32_t matrixStride = 0) const
+		{
+			const SpirvId& type = ids[typeId];
+			switch (type.opcode)
+			{
+			case spv::OpTypeBool:
+				return 4;
+			case spv::OpTypeInt:
+			case spv::OpTypeFloat:
+				return type.operands[0] / 8;
+			case spv::OpTypeVector:
+				return type.operands[1] * typeSize(type.operands[0]);
+			case spv::OpTypeMatrix:
+				return type.operands[1] * (matrixStride ? matrixStride : typeSize(type.operands[0]));
+			case spv::OpTypeArray:
+			{
+				uint32_t length = ids[type.operands[1]].constant;
+				return length * (type.arrayStride ? type.arrayStride : typeSize(type.operands[0]));
+			}
+			case spv::OpTypeStruct:
+			{
+				uint32_t size = 0;
+				for (size_t i = 0; i < type.operands.size(); ++i)
+				{
+					uint32_t memberOffset = i < type.memberOffsets.size() ? type.memberOffsets[i] : size;
+					uint32_t memberStride = i < type.memberMatrixStrides.size() ? type.memberMatrixStrides[i] : 0;
+					size = std::max(size, memberOffset + typeSize(type.operands[i], memberStride));
+				}
+				return size;
+			}
+			default:
+				return 0;
+			}
+		}
+
+	private:
+		SpirvId* id(uint32_t value)
+		{
+			return value < ids.size() ? &ids[value] : nullptr;
+		}
+
+		void setMember(std::vector<uint32_t>& values, uint32_t member, uint32_t value)
+		{
+			if (values.size() <= member)
+			{
+				values.resize(member + 1, 0);
+			}
+			values[member] = value;
+		}
+
+		void parseInstruction(uint32_t opcode, const uint32_t* operands, uint32_t count)
+		{
+			switch (opcode)
+			{
+			case spv::OpEntryPoint:
+				executionModel = operands[0];
+				break;
+
+			case spv::OpTypeBool:
+			case spv::OpTypeInt:
+			case spv::OpTypeFloat:
+			case spv::OpTypeVector:
+			case spv::OpTypeMatrix:
+			case spv::OpTypeImage:
+			case spv::OpTypeSampler:
+			case spv::OpTypeSampledImage:
+			case spv::OpTypeArray:
+			case spv::OpTypeRuntimeArray:
+			case spv::OpTypeStruct:
+			case spv::OpTypePointer:
+			case spv::OpTypeAccelerationStructureKHR:
+				if (SpirvId* result = id(operands[0]))
+				{
+					result->opcode = opcode;
+					result->operands.assign(operands + 1, operands + count);
+				}
+				break;
+
+			case spv::OpConstant:
+				if (SpirvId* result = id(operands[1]))
+				{
+					result->opcode = opcode;
+					result->constant = count > 2 ? operands[2] : 0;
+				}
+				break;
+
+			case spv::OpVariable:
+				if (SpirvId* result = id(operands[1]))
+				{
+					result->opcode = opcode;
+					//[0] pointer type, [1] storage class
+					result->operands = { operands[0], operands[2] };
+				}
+				break;
+
+			case spv::OpDecorate:
+				if (SpirvId* target = id(operands[0]))
+				{
+					uint32_t literal = count > 2 ? operands[2] : 0;
+					switch (operands[1])
+					{
+					case spv::DecorationBlock: target->block = true; break;
+					case spv::DecorationBufferBlock: target->bufferBlock = true; break;
+					case spv::DecorationArrayStride: target->arrayStride = literal; break;
+					case spv::DecorationBuiltIn: target->builtIn = true; break;
+					case spv::DecorationLocation: target->location = literal; break;
+					case spv::DecorationBinding: target->binding = literal; break;
+					case spv::DecorationDescriptorSet: target->set = literal; break;
+					default: break;
+					}
+				}
+				break;
+
+			case spv::OpMemberDecorate:
+				if (SpirvId* target = id(operands[0]))
+				{
+					uint32_t literal = count > 3 ? operands[3] : 0;
+					switch (operands[2])
+					{
+					case spv::DecorationOffset: setMember(target->memberOffsets, operands[1], literal); break;
+					case spv::DecorationMatrixStride: setMember(target->memberMatrixStrides, operands[1], literal); break;
+					case spv::DecorationBuiltIn: target->builtIn = true; break;
+					default: break;
+					}
+				}
+				break;
+
+			default:
+				break;
+			}
+		}
+	};
+
+	vk::ShaderStageFlagBits getStage(uint32_t executionModel)
+	{
+		switch (executionModel)
+		{
+		case 1: return vk::ShaderStageFlagBits::eTessellationControl;
+		case 2: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+		case 3: return vk::ShaderStageFlagBits::eGeometry;
+		case 4: return vk::ShaderStageFlagBits::eFragment;
+		case 5: return vk::ShaderStageFlagBits::eCompute;
+		default: return vk::ShaderStageFlagBits::eVertex;
+		}
+	}
+
+	bool getDescriptorType(const SpirvModule& module, uint32_t storageClass, uint32_t typeId, vk::DescriptorType& type)
+	{
+		const SpirvId& spirvType = module.ids[typeId];
+
+		if (storageClass == spv::StorageClassStorageBuffer)
+		{
+			type = vk::DescriptorType::eStorageBuffer;
+			return true;
+		}
+		if (storageClass == spv::StorageClassUniform)
+		{
+			type = spirvType.bufferBlock ? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eUniformBuffer;
+			return true;
+		}
+		if (storageClass != spv::StorageClassUniformConstant)
+		{
+			return false;
+		}
+
+		switch (spirvType.opcode)
+		{
+		case spv::OpTypeSampler:
+			type = vk::DescriptorType::eSampler;
+			return true;
+		case spv::OpTypeSampledImage:
+			type = vk::DescriptorType::eCombinedImageSampler;
+			return true;
+		case spv::OpTypeAccelerationStructureKHR:
+			type = vk::DescriptorType::eAccelerationStructureKHR;
+			return true;
+		case spv::OpTypeImage:
+		{
+			//[0] sampled type, [1] dim, [2] depth, [3] arrayed, [4] ms, [5] sampled
+			uint32_t dim = spirvType.operands[1];
+			bool storage = spirvType.operands[5] == 2;
+			if (dim == spv::DimSubpassData)
+			{
+				type = vk::DescriptorType::eInputAttachment;
+			}
+			else if (dim == spv::DimBuffer)
+			{
+				type = storage ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+			}
+			else
+			{
+				type = storage ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+			}
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	vk::Format getVertexFormat(const SpirvModule& module, uint32_t typeId, uint32_t& size)
+	{
+		const SpirvId& type = module.ids[typeId];
+
+		uint32_t components = 1;
+		const SpirvId* scalar = &type;
+		if (type.opcode == spv::OpTypeVector)
+		{
+			components = type.operands[1];
+			scalar = &module.ids[type.operands[0]];
+		}
+
+		if (scalar->opcode != spv::OpTypeFloat && scalar->opcode != spv::OpTypeInt)
+		{
+			size = 0;
+			return vk::Format::eUndefined;
+		}
+		if (scalar->operands[0] != 32)
+		{
+			size = 0;
+			return vk::Format::eUndefined;
+		}
+		size = components * 4;
+
+		static const vk::Format floatFormats[] = { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat };
+		static const vk::Format sintFormats[] = { vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint };
+		static const vk::Format uintFormats[] = { vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint };
+
+		if (scalar->opcode == spv::OpTypeFloat)
+		{
+			return floatFormats[components - 1];
+		}
+		return scalar->operands[1] ? sintFormats[components - 1] : uintFormats[components - 1];
+	}
+}
+
+ShaderReflection reflectSpirv(const SpirvCode& code)
+{
+	ShaderReflection reflection;
+
+	SpirvModule module;
+	if (!module.parse(code.data(), code.size() / sizeof(uint32_t)))
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to reflect shader, not a valid SPIR-V module" << std::endl;
+#endif
+		return reflection;
+	}
+
+	reflection.stage = getStage(module.executionModel);
+
+	for (const SpirvId& variable : module.ids)
+	{
+		if (variable.opcode != spv::OpVariable)
+		{
+			continue;
+		}
+
+		const SpirvId& pointer = module.ids[variable.operands[0]];
+		uint32_t storageClass = variable.operands[1];
+		//Pointer operands: [0] storage class, [1] pointee type
+		uint32_t typeId = pointer.operands[1];
+
+		if (storageClass == spv::StorageClassPushConstant)
+		{
+			const SpirvId& block = module.ids[typeId];
+			uint32_t begin = UINT32_MAX;
+			for (uint32_t offset : block.memberOffsets)
+			{
+				begin = std::min(begin, offset);
+			}
+			reflection.pushConstantOffset = (begin == UINT32_MAX) ? 0 : begin;
+			reflection.pushConstantSize = module.typeSize(typeId) - reflection.pushConstantOffset;
+			continue;
+		}
+
+		if (storageClass == spv::StorageClassInput)
+		{
+			if (reflection.stage != vk::ShaderStageFlagBits::eVertex || variable.builtIn
+				|| module.ids[typeId].builtIn || variable.location == UINT32_MAX)
+			{
+				continue;
+			}
+
+			ReflectedVertexInput input;
+			input.location = variable.location;
+			input.format = getVertexFormat(module, typeId, input.size);
+			if (input.format != vk::Format::eUndefined)
+			{
+				reflection.vertexInputs.push_back(input);
+			}
+			continue;
+		}
+
+		if (variable.set == UINT32_MAX || variable.binding == UINT32_MAX)
+		{
+			continue;
+		}
+
+		ReflectedBinding binding;
+		binding.set = variable.set;
+		binding.binding = variable.binding;
+		binding.count = 1;
+
+		//Arrays of resources become a single binding with descriptorCount > 1
+		if (module.ids[typeId].opcode == spv::OpTypeArray)
+		{
+			binding.count = module.ids[module.ids[typeId].operands[1]].constant;
+			typeId = module.ids[typeId].operands[0];
+		}
+		else if (module.ids[typeId].opcode == spv::OpTypeRuntimeArray)
+		{
+			typeId = module.ids[typeId].operands[0];
+		}
+
+		if (getDescriptorType(module, storageClass, typeId, binding.type))
+		{
+			reflection.bindings.push_back(binding);
+		}
+	}
+
+	std::sort(reflection.vertexInputs.begin(), reflection.vertexInputs.end(),
+		[](const ReflectedVertexInput& a, const ReflectedVertexInput& b) { return a.location < b.location; });
+
+	return reflection;
+}
+
+uint64_t hashSpirv(const SpirvCode& code)
+{
+	//FNV-1a over the words
+	uint64_t hash = 14695981039346656037ull;
+	const uint32_t* words = code.data();
+	size_t wordCount = code.size() / sizeof(uint32_t);
+	for (size_t i = 0; i < wordCount; ++i)
+	{
+		hash ^= words[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+const ShaderModule* ShaderModuleCache::get(vk::Device device, const std::string& filename)
+{
+	auto file = files.find(filename);
+	if (file != files.end())
+	{
+		return &modules.at(file->second);
+	}
+	auto collided = collisions.find(filename);
+	if (collided != collisions.end())
+	{
+		return &collided->second;
+	}
+
+	SpirvCode code = loadSpirv(filename);
+	if (code.empty())
+	{
+		return nullptr;
+	}
+
+	uint64_t hash = hashSpirv(code);
+	auto cached = modules.find(hash);
+	if (cached != modules.end())
+	{
+		const SpirvCode& cachedCode = cached->second.code;
+		if (cachedCode.size() == code.size() && std::memcmp(cachedCode.data(), code.data(), code.size()) == 0)
+		{
+			files.emplace(filename, hash);
+			return &cached->second;
+		}
+	}
+
+#ifdef DEBUG_MODE
+	std::cout << "Create shader module for \"" << filename << "\"" << std::endl;
+#endif
+
+	vk::ShaderModuleCreateInfo moduleInfo = {};
+	moduleInfo.flags = vk::ShaderModuleCreateFlags();
+	moduleInfo.codeSize = code.size();
+	moduleInfo.pCode = code.data();
+
+	ShaderModule shaderModule;
+	try {
+		shaderModule.module = device.createShaderModule(moduleInfo);
+	}
+	catch (vk::SystemError err)
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Failed to create shader module for \"" << filename << "\"" << std::endl;
+#endif
+		return nullptr;
+	}
+	shaderModule.reflection = reflectSpirv(code);
+	shaderModule.code = std::move(code);
+
+	//Different code with the same hash gets a module of its own, only shared by its path
+	if (cached != modules.end())
+	{
+#ifdef DEBUG_MODE
+		std::cout << "Shader hash collision for \"" << filename << "\", keeping it by its path" << std::endl;
+#endif
+		return &collisions.emplace(filename, std::move(shaderModule)).first->second;
+	}
+	files.emplace(filename, hash);
+	return &modules.emplace(hash, std::move(shaderModule)).first->second;
+}
+
+void ShaderModuleCache::destroy(vk::Device device)
+{
+	for (auto& cached : modules)
+	{
+		device.destroyShaderModule(cached.second.module);
+	}
+	for (auto& collided : collisions)
+	{
+		device.destroyShaderModule(collided.second.module);
+	}
+	modules.clear();
+	collisions.clear();
+	files.clear();
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+//A SPIR-V binary that was linked into the executable by cmake/EmbedSpirv.cmake
+struct EmbeddedShader
+{
+	const char* name;
+	const uint32_t* code;
+	size_t wordCount;
+};
+
+//SPIR-V words of a shader, either pointing at an embedded array or owning a copy read from disk
+struct SpirvCode
+{
+	const uint32_t* code{ nullptr };
+	size_t wordCount{ 0 };
+	std::vector<uint32_t> storage;
+
+	const uint32_t* data() const { return storage.empty() ? code : storage.data(); }
+	size_t size() const { return storage.empty() ? wordCount * sizeof(uint32_t) : storage.size() * sizeof(uint32_t); }
+	bool empty() const { return size() == 0; }
+};
+
+//Looks up a shader by its relative path, e.g. "media/shaders/vertex.spv".
+//Set the VULKAN_SHADER_DIR environment variable to load shaders from that directory
+//instead of the embedded copies, which is handy while iterating on GLSL.
+SpirvCode loadSpirv(const std::string& filename);
+
+struct ReflectedBinding
+{
+	uint32_t set;
+	uint32_t binding;
+	vk::DescriptorType type;
+	uint32_t count;
+};
+
+struct ReflectedVertexInput
+{
+	uint32_t location;
+	vk::Format format;
+	uint32_t size;
+};
+
+//The interface of one shader stage as declared in its SPIR-V
+struct ShaderReflection
+{
+	vk::ShaderStageFlagBits stage{ vk::ShaderStageFlagBits::eVertex };
+	//A size of 0 means the stage uses no push constants
+	uint32_t pushConstantOffset{ 0 };
+	uint32_t pushConstantSize{ 0 };
+	std::vector<ReflectedBinding> bindings;
+	//Only filled for vertex shaders, sorted by location
+	std::vector<ReflectedVertexInput> vertexInputs;
+};
+
+ShaderReflection reflectSpirv(const SpirvCode& code);
+
+uint64_t hashSpirv(const SpirvCode& code);
+
+struct ShaderModule
+{
+	vk::ShaderModule module{ nullptr };
+	ShaderReflection reflection;
+	SpirvCode code;
+};
+
+//Shader modules keyed by a hash of their SPIR-V. Identical code loaded through any path
+//maps to one vk::ShaderModule that stays alive, and is shared, until destroy() is called.
+class ShaderModuleCache
+{
+public:
+	//Returns nullptr when the shader can't be loaded or the module can't be created
+	const ShaderModule* get(vk::Device device, const std::string& filename);
+	void destroy(vk::Device device);
+private:
+	//Remembers which content a path resolved to, so a file is only ever read once
+	std::unordered_map<std::string, uint64_t> files;
+	std::unordered_map<uint64_t, ShaderModule> modules;
+	//Modules whose hash another module already had, by path
+	std::unordered_map<std::string, ShaderModule> collisions;
+};
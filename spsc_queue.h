@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+//Bounded queue between exactly one producer thread and one consumer thread. Neither side
+//ever blocks or takes a lock; each only writes its own index and caches the other one.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+public:
+	//Producer only, returns false when full
+	bool push(const T& item)
+	{
+		size_t position = tail.load(std::memory_order_relaxed);
+		if (position - cachedHead == Capacity)
+		{
+			cachedHead = head.load(std::memory_order_acquire);
+			if (position - cachedHead == Capacity)
+			{
+				return false;
+			}
+		}
+		items[position & (Capacity - 1)] = item;
+		tail.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	//Consumer only, returns false when empty
+	bool pop(T& item)
+	{
+		size_t position = head.load(std::memory_order_relaxed);
+		if (position == cachedTail)
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (position == cachedTail)
+			{
+				return false;
+			}
+		}
+		item = items[position & (Capacity - 1)];
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+private:
+	//Written by the consumer, next to the copy of tail only it uses
+	alignas(64) std::atomic<size_t> head{ 0 };
+	size_t cachedTail{ 0 };
+	//Written by the producer
+	alignas(64) std::atomic<size_t> tail{ 0 };
+	size_t cachedHead{ 0 };
+	alignas(64) T items[Capacity];
+};
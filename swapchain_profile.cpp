@@ -0,0 +1,81 @@
+#include "swapchain_profile.h"
+
+#include <algorithm>
+
+namespace
+{
+	bool supports(const std::vector<vk::PresentModeKHR>& presentModes, vk::PresentModeKHR presentMode)
+	{
+		return std::find(presentModes.begin(), presentModes.end(), presentMode) != presentModes.end();
+	}
+
+	//maxImageCount 0 means there is no upper limit
+	uint32_t clampImageCount(uint32_t imageCount, const vk::SurfaceCapabilitiesKHR& capabilities)
+	{
+		imageCount = std::max(imageCount, capabilities.minImageCount);
+		if (capabilities.maxImageCount > 0)
+		{
+			imageCount = std::min(imageCount, capabilities.maxImageCount);
+		}
+		return imageCount;
+	}
+}
+
+const char* getSwapchainProfileName(SwapchainProfile profile)
+{
+	switch (profile)
+	{
+	case SwapchainProfile::LowestLatency:
+		return "lowest latency";
+	case SwapchainProfile::VsyncThroughput:
+		return "vsync throughput";
+	case SwapchainProfile::TearAllowed:
+		return "tear allowed";
+	}
+	return "unknown";
+}
+
+SwapchainSettings chooseSwapchainSettings(SwapchainProfile profile, const std::vector<vk::PresentModeKHR>& presentModes,
+	const vk::SurfaceCapabilitiesKHR& capabilities)
+{
+	SwapchainSettings settings;
+	settings.presentMode = vk::PresentModeKHR::eFifo;
+
+	switch (profile)
+	{
+	case SwapchainProfile::LowestLatency:
+		//Mailbox needs a spare image to replace while one is shown and one is rendered
+		if (supports(presentModes, vk::PresentModeKHR::eMailbox))
+		{
+			settings.presentMode = vk::PresentModeKHR::eMailbox;
+			settings.imageCount = 3;
+		}
+		else
+		{
+			//Every extra image in a FIFO queue is a frame of latency
+			settings.imageCount = 2;
+		}
+		settings.framesInFlight = 1;
+		break;
+	case SwapchainProfile::VsyncThroughput:
+		settings.imageCount = capabilities.minImageCount + 1;
+		settings.framesInFlight = 2;
+		break;
+	case SwapchainProfile::TearAllowed:
+		if (supports(presentModes, vk::PresentModeKHR::eImmediate))
+		{
+			settings.presentMode = vk::PresentModeKHR::eImmediate;
+		}
+		else if (supports(presentModes, vk::PresentModeKHR::eFifoRelaxed))
+		{
+			//Only tears when a frame misses its vblank
+			settings.presentMode = vk::PresentModeKHR::eFifoRelaxed;
+		}
+		settings.imageCount = capabilities.minImageCount + 1;
+		settings.framesInFlight = 2;
+		break;
+	}
+
+	settings.imageCount = clampImageCount(settings.imageCount, capabilities);
+	return settings;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <cstdint>
+
+//What the swapchain is tuned for. Present mode, image count and frames in flight are picked together,
+//since each one on its own can undo what the others are doing for latency or throughput.
+enum class SwapchainProfile
+{
+	//Newest frame wins, without tearing when mailbox exists. The CPU never runs ahead of the GPU.
+	LowestLatency,
+	//FIFO with a frame of queueing on both sides, smooth at the display's refresh rate
+	VsyncThroughput,
+	//Presents immediately and tears, for measuring or when refresh rate doesn't matter
+	TearAllowed
+};
+
+struct SwapchainSettings
+{
+	vk::PresentModeKHR presentMode;
+	uint32_t imageCount;
+	uint32_t framesInFlight;
+};
+
+const char* getSwapchainProfileName(SwapchainProfile profile);
+
+//Falls back to FIFO, which every device supports, when the profile's present mode is missing
+SwapchainSettings chooseSwapchainSettings(SwapchainProfile profile, const std::vector<vk::PresentModeKHR>& presentModes,
+	const vk::SurfaceCapabilitiesKHR& capabilities);
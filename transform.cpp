@@ -0,0 +1,279 @@
+#include "transform.h"
+
+#include <glm/simd/matrix.h>
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+#include <immintrin.h>
+#endif
+
+uint32_t TransformStore::add(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	uint32_t index = static_cast<uint32_t>(size());
+
+	positionX.push_back(position.x);
+	positionY.push_back(position.y);
+	positionZ.push_back(position.z);
+
+	rotationX.push_back(rotation.x);
+	rotationY.push_back(rotation.y);
+	rotationZ.push_back(rotation.z);
+	rotationW.push_back(rotation.w);
+
+	scaleX.push_back(scale.x);
+	scaleY.push_back(scale.y);
+	scaleZ.push_back(scale.z);
+
+	return index;
+}
+
+void TransformStore::insert(uint32_t index, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	positionX.insert(positionX.begin() + index, position.x);
+	positionY.insert(positionY.begin() + index, position.y);
+	positionZ.insert(positionZ.begin() + index, position.z);
+
+	rotationX.insert(rotationX.begin() + index, rotation.x);
+	rotationY.insert(rotationY.begin() + index, rotation.y);
+	rotationZ.insert(rotationZ.begin() + index, rotation.z);
+	rotationW.insert(rotationW.begin() + index, rotation.w);
+
+	scaleX.insert(scaleX.begin() + index, scale.x);
+	scaleY.insert(scaleY.begin() + index, scale.y);
+	scaleZ.insert(scaleZ.begin() + index, scale.z);
+}
+
+void TransformStore::setPosition(uint32_t index, const glm::vec3& position)
+{
+	positionX[index] = position.x;
+	positionY[index] = position.y;
+	positionZ[index] = position.z;
+}
+
+void TransformStore::setRotation(uint32_t index, const glm::quat& rotation)
+{
+	rotationX[index] = rotation.x;
+	rotationY[index] = rotation.y;
+	rotationZ[index] = rotation.z;
+	rotationW[index] = rotation.w;
+}
+
+void TransformStore::setScale(uint32_t index, const glm::vec3& scale)
+{
+	scaleX[index] = scale.x;
+	scaleY[index] = scale.y;
+	scaleZ[index] = scale.z;
+}
+
+glm::vec3 TransformStore::getPosition(uint32_t index) const
+{
+	return glm::vec3(positionX[index], positionY[index], positionZ[index]);
+}
+
+glm::quat TransformStore::getRotation(uint32_t index) const
+{
+	return glm::quat(rotationW[index], rotationX[index], rotationY[index], rotationZ[index]);
+}
+
+glm::vec3 TransformStore::getScale(uint32_t index) const
+{
+	return glm::vec3(scaleX[index], scaleY[index], scaleZ[index]);
+}
+
+void TransformStore::reserve(size_t count)
+{
+	for (std::vector<float>* stream : { &positionX, &positionY, &positionZ,
+		&rotationX, &rotationY, &rotationZ, &rotationW, &scaleX, &scaleY, &scaleZ })
+	{
+		stream->reserve(count);
+	}
+}
+
+void TransformStore::clear()
+{
+	for (std::vector<float>* stream : { &positionX, &positionY, &positionZ,
+		&rotationX, &rotationY, &rotationZ, &rotationW, &scaleX, &scaleY, &scaleZ })
+	{
+		stream->clear();
+	}
+}
+
+namespace
+{
+	//Same math as glm::translate(glm::mat4_cast(q)) * glm::scale, one object at a time
+	void buildModelMatrix(const TransformStore& store, size_t i, glm::mat4& model)
+	{
+		float x = store.rotationX[i], y = store.rotationY[i], z = store.rotationZ[i], w = store.rotationW[i];
+		float sx = store.scaleX[i], sy = store.scaleY[i], sz = store.scaleZ[i];
+
+		float xx = x * x, yy = y * y, zz = z * z;
+		float xy = x * y, xz = x * z, yz = y * z;
+		float wx = w * x, wy = w * y, wz = w * z;
+
+		model[0] = glm::vec4((1.0f - 2.0f * (yy + zz)) * sx, 2.0f * (xy + wz) * sx, 2.0f * (xz - wy) * sx, 0.0f);
+		model[1] = glm::vec4(2.0f * (xy - wz) * sy, (1.0f - 2.0f * (xx + zz)) * sy, 2.0f * (yz + wx) * sy, 0.0f);
+		model[2] = glm::vec4(2.0f * (xz + wy) * sz, 2.0f * (yz - wx) * sz, (1.0f - 2.0f * (xx + yy)) * sz, 0.0f);
+		model[3] = glm::vec4(store.positionX[i], store.positionY[i], store.positionZ[i], 1.0f);
+	}
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+	//The 9 rotation/scale terms and the translation of 4 objects, one object per lane
+	struct Lanes4
+	{
+		__m128 c0x, c0y, c0z, c1x, c1y, c1z, c2x, c2y, c2z, tx, ty, tz;
+	};
+
+	//Transposes 4 objects from lanes into 4 column-major matrices and writes them out
+	void storeModelMatrices(const Lanes4& lanes, glm::mat4* models, const glm::mat4* parent)
+	{
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps(1.0f);
+
+		__m128 col0[4] = { lanes.c0x, lanes.c0y, lanes.c0z, zero };
+		__m128 col1[4] = { lanes.c1x, lanes.c1y, lanes.c1z, zero };
+		__m128 col2[4] = { lanes.c2x, lanes.c2y, lanes.c2z, zero };
+		__m128 col3[4] = { lanes.tx, lanes.ty, lanes.tz, one };
+		_MM_TRANSPOSE4_PS(col0[0], col0[1], col0[2], col0[3]);
+		_MM_TRANSPOSE4_PS(col1[0], col1[1], col1[2], col1[3]);
+		_MM_TRANSPOSE4_PS(col2[0], col2[1], col2[2], col2[3]);
+		_MM_TRANSPOSE4_PS(col3[0], col3[1], col3[2], col3[3]);
+
+		glm_vec4 parentColumns[4];
+		if (parent)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				parentColumns[c] = _mm_loadu_ps(&(*parent)[c][0]);
+			}
+		}
+
+		for (int object = 0; object < 4; ++object)
+		{
+			glm_vec4 local[4] = { col0[object], col1[object], col2[object], col3[object] };
+			glm_vec4 world[4];
+			if (parent)
+			{
+				glm_mat4_mul(parentColumns, local, world);
+			}
+			else
+			{
+				world[0] = local[0]; world[1] = local[1]; world[2] = local[2]; world[3] = local[3];
+			}
+
+			float* out = &models[object][0][0];
+			_mm_storeu_ps(out + 0, world[0]);
+			_mm_storeu_ps(out + 4, world[1]);
+			_mm_storeu_ps(out + 8, world[2]);
+			_mm_storeu_ps(out + 12, world[3]);
+		}
+	}
+
+	void buildModelMatrices4(const TransformStore& store, size_t i, glm::mat4* models, const glm::mat4* parent)
+	{
+		__m128 x = _mm_loadu_ps(&store.rotationX[i]);
+		__m128 y = _mm_loadu_ps(&store.rotationY[i]);
+		__m128 z = _mm_loadu_ps(&store.rotationZ[i]);
+		__m128 w = _mm_loadu_ps(&store.rotationW[i]);
+		__m128 sx = _mm_loadu_ps(&store.scaleX[i]);
+		__m128 sy = _mm_loadu_ps(&store.scaleY[i]);
+		__m128 sz = _mm_loadu_ps(&store.scaleZ[i]);
+
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 two = _mm_set1_ps(2.0f);
+
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		Lanes4 lanes;
+		lanes.c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		lanes.c0y = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+		lanes.c0z = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+		lanes.c1x = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+		lanes.c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		lanes.c1z = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+		lanes.c2x = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+		lanes.c2y = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+		lanes.c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+		lanes.tx = _mm_loadu_ps(&store.positionX[i]);
+		lanes.ty = _mm_loadu_ps(&store.positionY[i]);
+		lanes.tz = _mm_loadu_ps(&store.positionZ[i]);
+
+		storeModelMatrices(lanes, models, parent);
+	}
+#endif
+
+#if defined(__AVX2__)
+	void buildModelMatrices8(const TransformStore& store, size_t i, glm::mat4* models, const glm::mat4* parent)
+	{
+		__m256 x = _mm256_loadu_ps(&store.rotationX[i]);
+		__m256 y = _mm256_loadu_ps(&store.rotationY[i]);
+		__m256 z = _mm256_loadu_ps(&store.rotationZ[i]);
+		__m256 w = _mm256_loadu_ps(&store.rotationW[i]);
+		__m256 sx = _mm256_loadu_ps(&store.scaleX[i]);
+		__m256 sy = _mm256_loadu_ps(&store.scaleY[i]);
+		__m256 sz = _mm256_loadu_ps(&store.scaleZ[i]);
+
+		__m256 one = _mm256_set1_ps(1.0f);
+		__m256 two = _mm256_set1_ps(2.0f);
+
+		__m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+		__m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+		__m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+		__m256 terms[12] = {
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), sx),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy),
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), sy),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz),
+			_mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz),
+			_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))), sz),
+			_mm256_loadu_ps(&store.positionX[i]),
+			_mm256_loadu_ps(&store.positionY[i]),
+			_mm256_loadu_ps(&store.positionZ[i])
+		};
+
+		//Split into two groups of 4 and reuse the SSE transpose
+		Lanes4 low, high;
+		__m128* lowTerms = &low.c0x;
+		__m128* highTerms = &high.c0x;
+		for (int t = 0; t < 12; ++t)
+		{
+			lowTerms[t] = _mm256_castps256_ps128(terms[t]);
+			highTerms[t] = _mm256_extractf128_ps(terms[t], 1);
+		}
+		storeModelMatrices(low, models, parent);
+		storeModelMatrices(high, models + 4, parent);
+	}
+#endif
+}
+
+void TransformStore::buildModelMatrices(glm::mat4* models, size_t first, size_t count, const glm::mat4* parent) const
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	for (; i + 8 <= count; i += 8)
+	{
+		buildModelMatrices8(*this, first + i, models + i, parent);
+	}
+#endif
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+	for (; i + 4 <= count; i += 4)
+	{
+		buildModelMatrices4(*this, first + i, models + i, parent);
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		buildModelMatrix(*this, first + i, models[i]);
+		if (parent)
+		{
+			models[i] = (*parent) * models[i];
+		}
+	}
+}
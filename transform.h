@@ -0,0 +1,38 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//Structure of arrays transform storage. Every component lives in its own stream, so building
+//model matrices reads memory linearly and 4 (SSE) or 8 (AVX2) objects fit in one register.
+class TransformStore
+{
+public:
+	uint32_t add(const glm::vec3& position,
+		const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+		const glm::vec3& scale = glm::vec3(1.0f));
+	//Shifts every object from index on up by one
+	void insert(uint32_t index, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+
+	void setPosition(uint32_t index, const glm::vec3& position);
+	void setRotation(uint32_t index, const glm::quat& rotation);
+	void setScale(uint32_t index, const glm::vec3& scale);
+
+	glm::vec3 getPosition(uint32_t index) const;
+	glm::quat getRotation(uint32_t index) const;
+	glm::vec3 getScale(uint32_t index) const;
+
+	size_t size() const { return positionX.size(); }
+	void reserve(size_t count);
+	void clear();
+
+	//Writes translate * rotate * scale of objects [first, first + count) to models[0, count).
+	//When parent is given every matrix is pre-multiplied by it.
+	void buildModelMatrices(glm::mat4* models, size_t first, size_t count, const glm::mat4* parent = nullptr) const;
+
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+	std::vector<float> scaleX, scaleY, scaleZ;
+};